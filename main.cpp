@@ -12,6 +12,7 @@
 #include <scalar_viser/direct_volume_renderer.h>
 #include <scalar_viser/heat_map_renderer.h>
 #include <scalar_viser/marching_cube_renderer.h>
+#include <volume_loader/gradient_convertor.h>
 #include <volume_loader/raw_loader.h>
 #include <volume_loader/tf_loader.h>
 
@@ -61,6 +62,8 @@ int main(int argc, char **argv) {
             [](const uint8_t &src) -> float { return src / 255.f; });
         auto tfTex = SciVis::VolumeLoader::TFLoader<uint8_t>::LoadFromFileToTexture("cloud_tf.txt");
         renderer.AddVolume("cloud01", volTex, tfTex);
+        renderer.SetVolumeGradient(
+            "cloud01", SciVis::VolumeLoader::GradientConvertor::ConvertFromVolumeTexture(volTex));
     }
     grp->addChild(renderer.GetGroup());
 
@@ -77,20 +80,23 @@ int main(int argc, char **argv) {
     osg::ref_ptr grp = new osg::Group;
     grp->addChild(createEarth());
 
-    SciVis::ScalarViser::MarchingCubeCPURenderer renderer;
+    SciVis::ScalarViser::MarchingCubeCPURenderer<uint8_t> renderer;
 
     {
         std::array<int, 3> volDim{500, 500, 100};
-        auto volDat = SciVis::VolumeLoader::RawLoader<uint8_t, float>::LoadFromFile(
-            "CLOUDf01.bin", volDim, [](const uint8_t &src) -> float { return src / 255.f; });
+        auto volDat = SciVis::VolumeLoader::RawLoader<uint8_t, uint8_t>::LoadFromFile(
+            "CLOUDf01.bin", volDim, [](const uint8_t &src) { return src; });
         auto volDatShared = std::make_shared<decltype(volDat)>();
         (*volDatShared) = std::move(volDat);
         renderer.AddVolume("cloud01", volDatShared, volDim);
     }
     grp->addChild(renderer.GetGroup());
 
-    if (auto opt = renderer.GetVolume("cloud01"); opt.has_value())
-        opt.value()->second.MarchingCube(5.f / 255.f);
+    if (auto opt = renderer.GetVolume("cloud01"); opt.has_value()) {
+        opt.value()->second.SetLOD(4);
+        opt.value()->second.SetMeshCache("mc_cache");
+        opt.value()->second.MarchingCube(5.f);
+    }
 
     viewer->setSceneData(grp);
     viewer->run();
@@ -0,0 +1,146 @@
+#ifndef SCIVIS_SCALAR_VISER_BRICK_PAGER_H
+#define SCIVIS_SCALAR_VISER_BRICK_PAGER_H
+
+#include <algorithm>
+#include <cstdint>
+
+#include <array>
+#include <list>
+#include <utility>
+#include <vector>
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Keeps track of which bricks of a volume are resident in which slots of a physical atlas of
+ * slotNum slots. Each frame, bricks are requested with priorities, the slotNum most wanted of
+ * them are kept, and those missing are returned to be loaded. Loaded bricks take free slots
+ * first, then the least recently wanted ones, but never those wanted in the current frame.
+ * It knows nothing of textures, so it runs and is tested without a GL context.
+ */
+class BrickPager {
+  public:
+    static constexpr uint32_t NonResident = ~0u;
+
+  private:
+    uint64_t frameNum = 0;
+
+    std::vector<uint32_t> brickSlots;
+    std::vector<int> slotBricks;
+    std::vector<uint64_t> slotFrameNums;
+    // Slots, from the least recently wanted to the most
+    std::list<uint32_t> lru;
+    std::vector<std::list<uint32_t>::iterator> slotItrs;
+
+    std::vector<std::pair<float, int>> requests;
+    bool isSlotsChanged = true;
+
+  public:
+    BrickPager(int brickNum, int slotNum)
+        : brickSlots(brickNum, NonResident), slotBricks(slotNum, -1),
+          slotFrameNums(slotNum, 0), slotItrs(slotNum) {
+        for (uint32_t s = 0; s < static_cast<uint32_t>(slotNum); ++s)
+            slotItrs[s] = lru.insert(lru.end(), s);
+    }
+
+    /*
+     * Lays out the slots of an atlas, at most maxLenPerAxis of them per axis, in a box no more
+     * than maxSlotNum, so the atlas stays within the budget it is computed from. Of the boxes
+     * holding nearly as many slots as the fullest one, the closest to a cube is taken.
+     */
+    static std::array<int, 3> CmptSlotDimension(int maxSlotNum, int maxLenPerAxis) {
+        maxSlotNum = std::max(maxSlotNum, 1);
+        maxLenPerAxis = std::max(maxLenPerAxis, 1);
+
+        // Boxes of x >= y >= z, which are all that differ in shape
+        auto forEachBox = [&](auto f) {
+            for (int z = 1; z <= maxLenPerAxis && z * z * z <= maxSlotNum; ++z)
+                for (int y = z; y <= maxLenPerAxis && z * y * y <= maxSlotNum; ++y)
+                    f(std::array{std::min(maxLenPerAxis, maxSlotNum / (z * y)), y, z});
+        };
+        auto maxNum = 1;
+        forEachBox([&](const std::array<int, 3> &box) {
+            maxNum = std::max(maxNum, box[0] * box[1] * box[2]);
+        });
+
+        std::array<int, 3> slotDim{maxNum, 1, 1};
+        forEachBox([&](const std::array<int, 3> &box) {
+            auto num = box[0] * box[1] * box[2];
+            if (num * 16 < maxNum * 15)
+                return;
+            if (box[0] < slotDim[0] ||
+                (box[0] == slotDim[0] && num > slotDim[0] * slotDim[1] * slotDim[2]))
+                slotDim = box;
+        });
+        return slotDim;
+    }
+
+    int GetBrickNum() const { return static_cast<int>(brickSlots.size()); }
+    int GetSlotNum() const { return static_cast<int>(slotBricks.size()); }
+    uint32_t GetSlot(int brick) const { return brickSlots[brick]; }
+    // Slot of each brick, or NonResident
+    const std::vector<uint32_t> &GetBrickSlots() const { return brickSlots; }
+
+    // Returns whether any brick has entered or left the atlas since the last call
+    bool TakeSlotsChanged() { return std::exchange(isSlotsChanged, false); }
+
+    void BeginFrame() {
+        ++frameNum;
+        requests.clear();
+    }
+
+    void Request(int brick, float priority) { requests.emplace_back(priority, brick); }
+
+    /*
+     * Keeps the slotNum most wanted of the requested bricks resident over the others, and
+     * returns those of them to be loaded, most wanted first, at most maxLoadNum.
+     */
+    std::vector<int> EndFrame(size_t maxLoadNum) {
+        auto keptNum = std::min(requests.size(), slotBricks.size());
+        std::partial_sort(requests.begin(), requests.begin() + keptNum, requests.end(),
+                          [](const auto &l, const auto &r) { return l.first > r.first; });
+
+        std::vector<int> missings;
+        for (size_t i = 0; i < keptNum; ++i) {
+            auto brick = requests[i].second;
+            if (auto slot = brickSlots[brick]; slot != NonResident)
+                touch(slot);
+            else if (missings.size() < maxLoadNum)
+                missings.emplace_back(brick);
+        }
+        return missings;
+    }
+
+    /*
+     * Makes a loaded brick resident, and returns its slot, or NonResident if every slot is
+     * wanted in the current frame, in which case the brick should be dropped.
+     */
+    uint32_t Commit(int brick) {
+        if (brickSlots[brick] != NonResident)
+            return brickSlots[brick];
+
+        auto slot = lru.front();
+        if (slotBricks[slot] != -1 && slotFrameNums[slot] == frameNum)
+            return NonResident;
+
+        if (slotBricks[slot] != -1)
+            brickSlots[slotBricks[slot]] = NonResident;
+        slotBricks[slot] = brick;
+        brickSlots[brick] = slot;
+        touch(slot);
+        isSlotsChanged = true;
+        return slot;
+    }
+
+  private:
+    void touch(uint32_t slot) {
+        slotFrameNums[slot] = frameNum;
+        lru.splice(lru.end(), lru, slotItrs[slot]);
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_BRICK_PAGER_H
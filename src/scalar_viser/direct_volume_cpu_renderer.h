@@ -0,0 +1,463 @@
+#ifndef SCIVIS_SCALAR_VISER_DVR_CPU_H
+#define SCIVIS_SCALAR_VISER_DVR_CPU_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <format>
+#include <source_location>
+#include <string>
+
+#include <array>
+#include <vector>
+
+#include <osg/Image>
+#include <osg/Matrixd>
+#include <osg/Texture1D>
+#include <osg/Texture3D>
+
+#include <osgDB/WriteFile>
+
+#include <scivis/parallel.h>
+
+#include "geo_mapping.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * CPU reference of the ray-march in dvr_sphere_proxy_frag.glsl, for rendering without a GL
+ * context and as the ground truth of the shader. Rays are marched in float with the step
+ * policy, range tests, opacity correction and compositing of the shader: steps span
+ * stepInPixels pixels at their distance from the eye but no less than minDt, are
+ * lowAlphaStepScale times longer after samples more transparent than LowAlpha, and the first is
+ * offset by rayOffset of a step. Textures are sampled as GL_LINEAR with clamping to the edge
+ * texels. Unlike in the shader, rays start where they enter the outer sphere, or at the eye
+ * inside it, instead of at the front of the proxy, and do not leap over empty blocks, so that
+ * samples are spaced as in the shader but not at the same points. Samples are not shaded.
+ * Screen tiles are rendered in parallel. Inside a tile, rays are marched in packets of
+ * PacketW x PacketH neighbouring pixels, whose lanes are laid out as structures of arrays and
+ * sample nearby voxels together. The per-lane loops are not vectorized, as they take atan,
+ * atan2, sqrt and pow of the standard library, and gather from the volume and the transfer
+ * function, which keeps the math of the shader instead of approximating it.
+ */
+class DirectVolumeCPURenderer {
+  public:
+    static constexpr int TileSz = 16;
+    static constexpr int PacketW = 4;
+    static constexpr int PacketH = 2;
+    static constexpr int PacketSz = PacketW * PacketH;
+    // As in the shader
+    static constexpr float LowAlpha = .01f;
+    // As in DirectVolumeRenderer
+    static constexpr float DefStepInPixels = 1.f;
+    static constexpr float DefLowAlphaStepScale = 2.f;
+    static constexpr float MinStepInVoxels = .5f;
+
+  private:
+    std::array<int, 3> volDim = {0, 0, 0};
+    std::vector<float> volDat;
+    std::vector<osg::Vec4> tfDat;
+
+    GeoExtent geoExt;
+    // Part of geoExt rays are marched in, all of it unless set
+    GeoExtent clipExt;
+    float refDt = static_cast<float>(osg::WGS_84_RADIUS_EQUATOR) * .0005f;
+    // 0 for MinStepInVoxels of the smallest voxel edge, see GetDefaultMinStep
+    float minDt = 0.f;
+    float stepInPixels = DefStepInPixels;
+    float rayOffset = 0.f;
+    float lowAlphaStepScale = DefLowAlphaStepScale;
+
+    // Uniforms of the shader of the same names, per frame
+    struct StepParam {
+        float refDt;
+        float minDt;
+        float stepInPixels;
+        float pixelSpanPerDist;
+        float rayOffset;
+        float lowAlphaStepScale;
+    };
+
+    template <typename Ty> using Lanes = std::array<Ty, PacketSz>;
+    struct Packet {
+        alignas(32) Lanes<float> posX, posY, posZ;
+        alignas(32) Lanes<float> dirX, dirY, dirZ;
+        // tStart is the distance from the eye to where the ray starts
+        alignas(32) Lanes<float> tStart, tAcc, tMax;
+        alignas(32) Lanes<float> stepScale;
+        alignas(32) Lanes<float> r, g, b, a;
+        alignas(32) Lanes<uint8_t> isActive;
+    };
+
+    static void clearLane(Packet &pkt, int lane) {
+        pkt.r[lane] = pkt.g[lane] = pkt.b[lane] = pkt.a[lane] = 0.f;
+        pkt.tStart[lane] = pkt.tAcc[lane] = pkt.tMax[lane] = 0.f;
+        pkt.stepScale[lane] = 1.f;
+        pkt.isActive[lane] = 0;
+    }
+
+    static void setupLane(Packet &pkt, int lane, const osg::Vec3d &eyePos, const osg::Vec3d &dir,
+                          const GeoExtent &ext) {
+        clearLane(pkt, lane);
+
+        // The proxy is culled from inside the volume and from under the shell
+        auto eyeR2 = eyePos.length2();
+        if (eyeR2 < double(ext.minHeight) * ext.minHeight)
+            return;
+        auto b = eyePos * dir;
+        auto c = eyeR2 - double(ext.maxHeight) * ext.maxHeight;
+        auto tEntry = 0.;
+        if (c > 0.) {
+            auto disc = b * b - c;
+            if (disc < 0.)
+                return;
+            tEntry = -b - std::sqrt(disc);
+            if (tEntry < 0.)
+                return;
+        } else {
+            auto lat = std::atan(eyePos.z() / std::sqrt(eyePos.x() * eyePos.x() +
+                                                        eyePos.y() * eyePos.y()));
+            auto lon = std::atan2(eyePos.y(), eyePos.x());
+            if (lat >= ext.minLatitute && lat <= ext.maxLatitute && lon >= ext.minLongtitute &&
+                lon <= ext.maxLongtitute)
+                return;
+        }
+
+        // From here on, mirrors the shader in float
+        osg::Vec3 vertex = eyePos + dir * tEntry;
+        osg::Vec3 d = dir;
+        d.normalize();
+
+        auto getLatLon = [](const osg::Vec3 &p, float &lat, float &lon) {
+            auto r = std::sqrt(p.x() * p.x() + p.y() * p.y());
+            lat = std::atan(p.z() / r);
+            lon = std::atan2(p.y(), p.x());
+        };
+        float lat, lon;
+        getLatLon(vertex, lat, lon);
+        auto entryOutOfRng = 0;
+        if (lat < ext.minLatitute)
+            entryOutOfRng |= 1;
+        if (lat > ext.maxLatitute)
+            entryOutOfRng |= 2;
+        if (lon < ext.minLongtitute)
+            entryOutOfRng |= 4;
+        if (lon > ext.maxLongtitute)
+            entryOutOfRng |= 8;
+
+        auto l = d * -vertex;
+        auto m2 = vertex.length2() - l * l;
+        auto tExit = l + std::sqrt(std::max(ext.maxHeight * ext.maxHeight - m2, 0.f));
+        if (l > 0.f) {
+            auto innerR2 = ext.minHeight * ext.minHeight;
+            if (m2 < innerR2)
+                tExit = l - std::sqrt(innerR2 - m2);
+        }
+
+        auto exit = vertex + d * tExit;
+        getLatLon(exit, lat, lon);
+        if (((entryOutOfRng & 1) != 0 && lat < ext.minLatitute) ||
+            ((entryOutOfRng & 2) != 0 && lat > ext.maxLatitute) ||
+            ((entryOutOfRng & 4) != 0 && lon < ext.minLongtitute) ||
+            ((entryOutOfRng & 8) != 0 && lon > ext.maxLongtitute))
+            return;
+
+        pkt.posX[lane] = vertex.x();
+        pkt.posY[lane] = vertex.y();
+        pkt.posZ[lane] = vertex.z();
+        pkt.dirX[lane] = d.x();
+        pkt.dirY[lane] = d.y();
+        pkt.dirZ[lane] = d.z();
+        pkt.tStart[lane] = static_cast<float>(tEntry);
+        pkt.tMax[lane] = (exit - vertex).length();
+        pkt.isActive[lane] = 1;
+    }
+
+    // GL_LINEAR lookup of the coordinate x in [0, 1] over n texels
+    static void cmptLinearTexel(float x, int n, int &i0, int &i1, float &w) {
+        x = std::clamp(x * n - .5f, 0.f, static_cast<float>(n - 1));
+        i0 = std::min(static_cast<int>(x), n - 1);
+        i1 = std::min(i0 + 1, n - 1);
+        w = x - i0;
+    }
+
+    float sampleVolume(float x, float y, float z) const {
+        int x0, x1, y0, y1, z0, z1;
+        float wx, wy, wz;
+        cmptLinearTexel(x, volDim[0], x0, x1, wx);
+        cmptLinearTexel(y, volDim[1], y0, y1, wy);
+        cmptLinearTexel(z, volDim[2], z0, z1, wz);
+
+        auto at = [&](int x, int y, int z) {
+            return volDat[(static_cast<size_t>(z) * volDim[1] + y) * volDim[0] + x];
+        };
+        auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+        auto v0 = lerp(lerp(at(x0, y0, z0), at(x1, y0, z0), wx),
+                       lerp(at(x0, y1, z0), at(x1, y1, z0), wx), wy);
+        auto v1 = lerp(lerp(at(x0, y0, z1), at(x1, y0, z1), wx),
+                       lerp(at(x0, y1, z1), at(x1, y1, z1), wx), wy);
+        return lerp(v0, v1, wz);
+    }
+
+    osg::Vec4 sampleTF(float scalar) const {
+        int i0, i1;
+        float w;
+        cmptLinearTexel(scalar, static_cast<int>(tfDat.size()), i0, i1, w);
+        return tfDat[i0] * (1.f - w) + tfDat[i1] * w;
+    }
+
+    void marchPacket(Packet &pkt, const StepParam &stepParam) const {
+        auto hDlt = geoExt.maxHeight - geoExt.minHeight;
+        auto latDlt = geoExt.maxLatitute - geoExt.minLatitute;
+        auto lonDlt = geoExt.maxLongtitute - geoExt.minLongtitute;
+        auto cmptStep = [&](int i) {
+            return std::max(stepParam.minDt, stepParam.stepInPixels * stepParam.pixelSpanPerDist *
+                                                 (pkt.tStart[i] + pkt.tAcc[i]));
+        };
+
+        // The first sample is taken even if the offset leaves the ray, as in the shader
+        for (int i = 0; i < PacketSz; ++i) {
+            auto offs = pkt.isActive[i] != 0 ? stepParam.rayOffset * cmptStep(i) : 0.f;
+            pkt.posX[i] += offs * pkt.dirX[i];
+            pkt.posY[i] += offs * pkt.dirY[i];
+            pkt.posZ[i] += offs * pkt.dirZ[i];
+            pkt.tAcc[i] += offs;
+        }
+
+        alignas(32) Lanes<float> texX, texY, texZ;
+        alignas(32) Lanes<uint8_t> isInRng;
+        alignas(32) Lanes<float> tfR, tfG, tfB, tfA;
+        auto &clip = clipExt;
+        while (std::any_of(pkt.isActive.begin(), pkt.isActive.end(),
+                           [](uint8_t isActive) { return isActive != 0; })) {
+            for (int i = 0; i < PacketSz; ++i) {
+                auto x = pkt.posX[i];
+                auto y = pkt.posY[i];
+                auto z = pkt.posZ[i];
+                auto lat = std::atan(z / std::sqrt(x * x + y * y));
+                auto lon = std::atan2(y, x);
+                auto r = std::sqrt(x * x + y * y + z * z);
+                isInRng[i] = lat >= clip.minLatitute && lat <= clip.maxLatitute &&
+                             lon >= clip.minLongtitute && lon <= clip.maxLongtitute;
+                texX[i] = (lon - geoExt.minLongtitute) / lonDlt;
+                texY[i] = (lat - geoExt.minLatitute) / latDlt;
+                texZ[i] = (r - geoExt.minHeight) / hDlt;
+            }
+
+            // Gathers are left scalar
+            for (int i = 0; i < PacketSz; ++i) {
+                osg::Vec4 tfCol;
+                if (pkt.isActive[i] != 0 && isInRng[i] != 0)
+                    tfCol = sampleTF(sampleVolume(texX[i], texY[i], texZ[i]));
+                tfR[i] = tfCol.r();
+                tfG[i] = tfCol.g();
+                tfB[i] = tfCol.b();
+                tfA[i] = tfCol.a();
+            }
+
+            for (int i = 0; i < PacketSz; ++i) {
+                auto isActive = pkt.isActive[i] != 0;
+                auto step = isActive ? cmptStep(i) * pkt.stepScale[i] : 0.f;
+
+                // Opacity correction, the sample covers step instead of refDt
+                auto alpha = 1.f - std::pow(1.f - tfA[i], step / stepParam.refDt);
+                auto w = (1.f - pkt.a[i]) * alpha;
+                pkt.r[i] += w * tfR[i];
+                pkt.g[i] += w * tfG[i];
+                pkt.b[i] += w * tfB[i];
+                pkt.a[i] += w;
+
+                pkt.posX[i] += step * pkt.dirX[i];
+                pkt.posY[i] += step * pkt.dirY[i];
+                pkt.posZ[i] += step * pkt.dirZ[i];
+                pkt.tAcc[i] += step;
+                // Samples out of range keep the scale of the step, as the shader skips them
+                if (isInRng[i] != 0)
+                    pkt.stepScale[i] = tfA[i] < LowAlpha ? stepParam.lowAlphaStepScale : 1.f;
+                pkt.isActive[i] = isActive && pkt.a[i] <= .95f && pkt.tAcc[i] < pkt.tMax[i];
+            }
+        }
+    }
+
+  public:
+    DirectVolumeCPURenderer() {}
+
+    /*
+     * Copies the volume and the transfer function out of the images of the textures passed to
+     * DirectVolumeRenderer::AddVolume, i.e. GL_RED and GL_RGBA images of GL_FLOAT.
+     */
+    bool SetVolume(osg::ref_ptr<osg::Texture3D> volTex, osg::ref_ptr<osg::Texture1D> tfTex,
+                   std::string *errMsg = nullptr) {
+        auto reportErr = [&](const char *err) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), err);
+            return false;
+        };
+
+        auto volImg = volTex.valid() ? volTex->getImage() : nullptr;
+        auto tfImg = tfTex.valid() ? tfTex->getImage() : nullptr;
+        if (!volImg || !tfImg)
+            return reportErr("Textures have no image");
+        if (volImg->getPixelFormat() != GL_RED || volImg->getDataType() != GL_FLOAT)
+            return reportErr("Volume image is not GL_RED of GL_FLOAT");
+        if (tfImg->getPixelFormat() != GL_RGBA || tfImg->getDataType() != GL_FLOAT)
+            return reportErr("Transfer function image is not GL_RGBA of GL_FLOAT");
+        if (volImg->s() <= 0 || volImg->t() <= 0 || volImg->r() <= 0 || tfImg->s() <= 0)
+            return reportErr("Images are empty");
+
+        auto volPtr = reinterpret_cast<const float *>(volImg->data());
+        auto tfPtr = reinterpret_cast<const osg::Vec4 *>(tfImg->data());
+        SetVolume(std::vector<float>(volPtr, volPtr + static_cast<size_t>(volImg->s()) *
+                                                         volImg->t() * volImg->r()),
+                  {volImg->s(), volImg->t(), volImg->r()},
+                  std::vector<osg::Vec4>(tfPtr, tfPtr + tfImg->s()));
+        return true;
+    }
+    // volDat holds scalars in [0, 1] in x-fastest order, tfDat is sampled by them
+    void SetVolume(std::vector<float> volDat, const std::array<int, 3> &volDim,
+                   std::vector<osg::Vec4> tfDat) {
+        this->volDat = std::move(volDat);
+        this->volDim = volDim;
+        this->tfDat = std::move(tfDat);
+    }
+
+    void SetGeoExtent(const GeoExtent &geoExt) {
+        this->geoExt = geoExt;
+        clipExt = geoExt;
+    }
+    const GeoExtent &GetGeoExtent() const { return geoExt; }
+    /*
+     * Marches rays only in clipExt, a part of the geo extent with the same heights, as a brick
+     * of a volume split among renderers does. Samples stay where they would be without it.
+     */
+    void SetClipExtent(const GeoExtent &clipExt) { this->clipExt = clipExt; }
+    const GeoExtent &GetClipExtent() const { return clipExt; }
+
+    // Step of the opacities in the transfer function, as refDt of DirectVolumeRenderer
+    void SetReferenceStep(float refDt) { this->refDt = refDt; }
+    float GetReferenceStep() const { return refDt; }
+    // 0 takes GetDefaultMinStep of the volume and the geo extent
+    void SetMinStep(float minDt) { this->minDt = minDt; }
+    float GetMinStep() const { return minDt; }
+    void SetStepInPixels(float stepInPixels) { this->stepInPixels = stepInPixels; }
+    float GetStepInPixels() const { return stepInPixels; }
+    // Fraction of the first step to offset rays by, as of a pass of ProgressiveRefiner
+    void SetRayOffset(float rayOffset) { this->rayOffset = rayOffset; }
+    float GetRayOffset() const { return rayOffset; }
+    void SetLowAlphaStepScale(float scale) { lowAlphaStepScale = scale; }
+    float GetLowAlphaStepScale() const { return lowAlphaStepScale; }
+
+    /*
+     * MinStepInVoxels of the smallest voxel edge of volDim over geoExt, which is where the shell
+     * is the narrowest, as DirectVolumeRenderer takes minDt. Edges along longitude vanish at the
+     * poles, so they are left out of extents reaching them.
+     */
+    static float GetDefaultMinStep(const std::array<int, 3> &volDim, const GeoExtent &geoExt) {
+        auto maxAbsLat = std::max(std::abs(geoExt.minLatitute), std::abs(geoExt.maxLatitute));
+        auto lonVox = geoExt.minHeight * std::cos(maxAbsLat) *
+                      (geoExt.maxLongtitute - geoExt.minLongtitute) / std::max(volDim[0], 1);
+        auto latVox = geoExt.minHeight * (geoExt.maxLatitute - geoExt.minLatitute) /
+                      std::max(volDim[1], 1);
+        auto hVox = (geoExt.maxHeight - geoExt.minHeight) / std::max(volDim[2], 1);
+        auto minVox = std::min(latVox, hVox);
+        if (lonVox > minVox * 1e-3f)
+            minVox = std::min(minVox, lonVox);
+        return MinStepInVoxels * minVox;
+    }
+
+    /*
+     * Renders a width x height image as seen through viewMat and projMat, whose pixels are
+     * what the shader would output: associated RGBA in GL_FLOAT, zero where nothing is hit.
+     * Rows start from the bottom, as in GL.
+     */
+    osg::ref_ptr<osg::Image> Render(const osg::Matrixd &viewMat, const osg::Matrixd &projMat,
+                                    int width, int height) const {
+        osg::ref_ptr img = new osg::Image;
+        img->allocateImage(width, height, 1, GL_RGBA, GL_FLOAT);
+        img->setInternalTextureFormat(GL_RGBA);
+        auto pxs = reinterpret_cast<osg::Vec4 *>(img->data());
+        std::fill(pxs, pxs + static_cast<size_t>(width) * height, osg::Vec4());
+        StepParam stepParam{refDt,
+                            minDt > 0.f ? minDt : GetDefaultMinStep(volDim, geoExt),
+                            stepInPixels,
+                            // As CameraState takes it, 0 in orthographic views
+                            projMat(3, 3) == 0. && height > 0
+                                ? static_cast<float>(2. / (projMat(1, 1) * height))
+                                : 0.f,
+                            rayOffset,
+                            lowAlphaStepScale};
+        if (volDat.empty() || tfDat.empty() || stepParam.refDt <= 0.f || stepParam.minDt <= 0.f)
+            return img;
+
+        auto eyePos = osg::Matrixd::inverse(viewMat).getTrans();
+        auto ndc2World = osg::Matrixd::inverse(viewMat * projMat);
+
+        auto tileNumX = (width + TileSz - 1) / TileSz;
+        auto tileNumY = (height + TileSz - 1) / TileSz;
+        ParallelFor(0, static_cast<size_t>(tileNumX) * tileNumY, [&](size_t tileIdx) {
+            auto tileX = static_cast<int>(tileIdx % tileNumX) * TileSz;
+            auto tileY = static_cast<int>(tileIdx / tileNumX) * TileSz;
+
+            Packet pkt;
+            for (int py = tileY; py < std::min(tileY + TileSz, height); py += PacketH)
+                for (int px = tileX; px < std::min(tileX + TileSz, width); px += PacketW) {
+                    for (int i = 0; i < PacketSz; ++i) {
+                        auto x = px + i % PacketW;
+                        auto y = py + i / PacketW;
+                        if (x >= width || y >= height) {
+                            clearLane(pkt, i);
+                            continue;
+                        }
+
+                        osg::Vec3d ndc(2. * (x + .5) / width - 1., 2. * (y + .5) / height - 1.,
+                                       1.);
+                        auto dir = ndc2World.preMult(ndc) - eyePos;
+                        dir.normalize();
+                        setupLane(pkt, i, eyePos, dir, clipExt);
+                    }
+
+                    marchPacket(pkt, stepParam);
+
+                    for (int i = 0; i < PacketSz; ++i) {
+                        auto x = px + i % PacketW;
+                        auto y = py + i / PacketW;
+                        if (x < width && y < height)
+                            pxs[static_cast<size_t>(y) * width + x] =
+                                osg::Vec4(pkt.r[i], pkt.g[i], pkt.b[i], pkt.a[i]);
+                    }
+                }
+        });
+
+        return img;
+    }
+
+    // Writes an image of Render as 8-bit RGBA, in any format of the osgDB plugins
+    static bool WriteImage(const osg::Image &img, const std::string &filePath,
+                           std::string *errMsg = nullptr) {
+        osg::ref_ptr out = new osg::Image;
+        out->allocateImage(img.s(), img.t(), 1, GL_RGBA, GL_UNSIGNED_BYTE);
+        out->setInternalTextureFormat(GL_RGBA);
+
+        auto src = reinterpret_cast<const float *>(img.data());
+        auto dst = out->data();
+        for (size_t i = 0; i < static_cast<size_t>(img.s()) * img.t() * 4; ++i)
+            dst[i] = static_cast<uint8_t>(std::clamp(src[i], 0.f, 1.f) * 255.f + .5f);
+
+        if (!osgDB::writeImageFile(*out, filePath)) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: Cannot write file {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), filePath);
+            return false;
+        }
+        return true;
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_DVR_CPU_H
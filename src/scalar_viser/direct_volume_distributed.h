@@ -0,0 +1,195 @@
+#ifndef SCIVIS_SCALAR_VISER_DVR_DISTRIBUTED_H
+#define SCIVIS_SCALAR_VISER_DVR_DISTRIBUTED_H
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <source_location>
+#include <string>
+
+#include <array>
+#include <vector>
+
+#include <osg/Image>
+#include <osg/Matrixd>
+#include <osg/Texture1D>
+#include <osg/Texture3D>
+
+#include <scivis/binary_swap.h>
+#include <scivis/communicator.h>
+
+#include "direct_volume_cpu_renderer.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Sort-last DVR of a volume split among the ranks of a Communicator, each in its own process
+ * or thread. Rank r marches the bricks of the volume along longitude [N * r / R, N * (r + 1) / R)
+ * of N voxels and R ranks, on the CPU, then the images of all ranks are composited by binary
+ * swap and gathered into rank 0. Bricks are split by planes through the polar axis, which order
+ * them in depth from any eye as long as the volume spans at most 180 degrees of longitude.
+ * Steps are not lengthened after transparent samples, as a brick cannot tell the opacities
+ * along the ray in the others. Rays thus sample at the same points as they would in one
+ * DirectVolumeCPURenderer with a low alpha step scale of 1, so that only the termination of
+ * opaque rays differs.
+ */
+class DirectVolumeDistributedRenderer {
+  private:
+    Communicator &comm;
+    DirectVolumeCPURenderer renderer;
+    GeoExtent geoExt;
+    std::array<int, 3> volDim = {0, 0, 0};
+    float minDt = 0.f;
+
+  public:
+    DirectVolumeDistributedRenderer(Communicator &comm) : comm(comm) {
+        renderer.SetLowAlphaStepScale(1.f);
+    }
+
+    // Voxels along longitude [first, second) of rank of rankNum, out of volDimX
+    static std::pair<int, int> GetBrickRange(int volDimX, int rank, int rankNum) {
+        return {static_cast<int>(static_cast<int64_t>(volDimX) * rank / rankNum),
+                static_cast<int>(static_cast<int64_t>(volDimX) * (rank + 1) / rankNum)};
+    }
+
+    /*
+     * Takes the brick of this rank out of the textures passed to
+     * DirectVolumeRenderer::AddVolume, i.e. GL_RED and GL_RGBA images of GL_FLOAT, with an apron
+     * of one voxel for filtering across bricks. The number of ranks should be a power of 2, and
+     * no more than the voxels along longitude.
+     */
+    bool SetVolume(osg::ref_ptr<osg::Texture3D> volTex, osg::ref_ptr<osg::Texture1D> tfTex,
+                   std::string *errMsg = nullptr) {
+        auto reportErr = [&](const std::string &err) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), err);
+            return false;
+        };
+
+        auto rankNum = comm.GetRankNum();
+        if (!IsBinarySwappable(rankNum))
+            return reportErr(std::format("{} ranks are not a power of 2", rankNum));
+        auto volImg = volTex.valid() ? volTex->getImage() : nullptr;
+        auto tfImg = tfTex.valid() ? tfTex->getImage() : nullptr;
+        if (!volImg || !tfImg)
+            return reportErr("Textures have no image");
+        if (volImg->getPixelFormat() != GL_RED || volImg->getDataType() != GL_FLOAT)
+            return reportErr("Volume image is not GL_RED of GL_FLOAT");
+        if (tfImg->getPixelFormat() != GL_RGBA || tfImg->getDataType() != GL_FLOAT)
+            return reportErr("Transfer function image is not GL_RGBA of GL_FLOAT");
+        if (volImg->s() < rankNum || volImg->t() <= 0 || volImg->r() <= 0 || tfImg->s() <= 0)
+            return reportErr(std::format("Images are empty, or have fewer voxels along "
+                                         "longitude than {} ranks",
+                                         rankNum));
+
+        volDim = {volImg->s(), volImg->t(), volImg->r()};
+        auto volDimX = volDim[0];
+
+        auto [x0, x1] = GetBrickRange(volDimX, comm.GetRank(), rankNum);
+        auto apronX0 = std::max(x0 - 1, 0);
+        auto apronX1 = std::min(x1 + 1, volDimX);
+        auto src = reinterpret_cast<const float *>(volImg->data());
+        std::vector<float> brickDat(static_cast<size_t>(apronX1 - apronX0) * volDim[1] *
+                                    volDim[2]);
+        auto dst = brickDat.data();
+        for (int z = 0; z < volDim[2]; ++z)
+            for (int y = 0; y < volDim[1]; ++y) {
+                auto row = src + (static_cast<size_t>(z) * volDim[1] + y) * volDimX;
+                dst = std::copy(row + apronX0, row + apronX1, dst);
+            }
+
+        auto tfPtr = reinterpret_cast<const osg::Vec4 *>(tfImg->data());
+        renderer.SetVolume(std::move(brickDat), {apronX1 - apronX0, volDim[1], volDim[2]},
+                           std::vector<osg::Vec4>(tfPtr, tfPtr + tfImg->s()));
+        updateExtents();
+        return true;
+    }
+
+    void SetGeoExtent(const GeoExtent &geoExt) {
+        this->geoExt = geoExt;
+        updateExtents();
+    }
+    const GeoExtent &GetGeoExtent() const { return geoExt; }
+
+    void SetReferenceStep(float refDt) { renderer.SetReferenceStep(refDt); }
+    float GetReferenceStep() const { return renderer.GetReferenceStep(); }
+    // 0 takes DirectVolumeCPURenderer::GetDefaultMinStep of the whole volume, the same in all ranks
+    void SetMinStep(float minDt) {
+        this->minDt = minDt;
+        updateExtents();
+    }
+    float GetMinStep() const { return minDt; }
+    void SetStepInPixels(float stepInPixels) { renderer.SetStepInPixels(stepInPixels); }
+    float GetStepInPixels() const { return renderer.GetStepInPixels(); }
+
+    /*
+     * Renders the brick of this rank and composites it with those of the others, which should
+     * call it with the same arguments. Returns the image of the whole volume in rank 0, in the
+     * format of DirectVolumeCPURenderer::Render, and nullptr in the others, or in all if the
+     * compositing lost a message, which is reported in errMsg.
+     */
+    osg::ref_ptr<osg::Image> Render(const osg::Matrixd &viewMat, const osg::Matrixd &projMat,
+                                    int width, int height, std::string *errMsg = nullptr) {
+        auto img = renderer.Render(viewMat, projMat, width, height);
+        auto rgba = reinterpret_cast<float *>(img->data());
+        auto pxNum = static_cast<size_t>(width) * height;
+
+        auto eyePos = osg::Matrixd::inverse(viewMat).getTrans();
+        auto range = BinarySwapComposite(comm, rgba, pxNum, [&](int splitRank) {
+            // The eye is on the side of lower longitudes of the plane through the polar axis
+            auto lon =
+                getLongtitute(GetBrickRange(volDim[0], splitRank, comm.GetRankNum()).first);
+            return -std::sin(lon) * eyePos.x() + std::cos(lon) * eyePos.y() < 0.;
+        });
+        if (!range || !GatherBinarySwap(comm, rgba, pxNum)) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: Rank {} lost a message of the "
+                                      "compositing",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(),
+                                      comm.GetRank());
+            return nullptr;
+        }
+
+        return comm.GetRank() == 0 ? img : nullptr;
+    }
+
+  private:
+    // Longitude of the boundary before voxel x along longitude
+    float getLongtitute(int x) const {
+        return geoExt.minLongtitute + static_cast<float>(x) / std::max(volDim[0], 1) *
+                                          (geoExt.maxLongtitute - geoExt.minLongtitute);
+    }
+
+    /*
+     * The brick with its apron is mapped onto its part of geoExt, and rays are clipped to it.
+     * Steps are taken from the whole volume, so that they do not differ between bricks.
+     */
+    void updateExtents() {
+        renderer.SetMinStep(
+            minDt > 0.f ? minDt : DirectVolumeCPURenderer::GetDefaultMinStep(volDim, geoExt));
+        if (volDim[0] == 0) {
+            renderer.SetGeoExtent(geoExt);
+            return;
+        }
+
+        auto [x0, x1] = GetBrickRange(volDim[0], comm.GetRank(), comm.GetRankNum());
+        auto datExt = geoExt;
+        datExt.minLongtitute = getLongtitute(std::max(x0 - 1, 0));
+        datExt.maxLongtitute = getLongtitute(std::min(x1 + 1, volDim[0]));
+        auto clipExt = geoExt;
+        clipExt.minLongtitute = getLongtitute(x0);
+        clipExt.maxLongtitute = getLongtitute(x1);
+
+        renderer.SetGeoExtent(datExt);
+        renderer.SetClipExtent(clipExt);
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_DVR_DISTRIBUTED_H
@@ -0,0 +1,114 @@
+#ifndef SCIVIS_SCALAR_VISER_DVR_ECEF_H
+#define SCIVIS_SCALAR_VISER_DVR_ECEF_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <array>
+#include <vector>
+
+#include <osg/BoundingBox>
+
+#include <scivis/parallel.h>
+
+#include "geo_mapping.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * A volume resampled from (lon, lat, height) onto voxels axis-aligned in ECEF over bound. Ray-
+ * marches address it linearly, without the square root and arc tangents per sample. Coverages
+ * are 1 for voxels inside the geo extent and 0 outside, so that filtering them gives where the
+ * boundary is, and scalars are 0 outside. All in x-fastest order.
+ */
+struct ECEFVolume {
+    std::array<int, 3> dim = {0, 0, 0};
+    osg::BoundingBox bound;
+    std::vector<float> scalars;
+    std::vector<float> coverages;
+};
+
+/*
+ * Resamples a volume over geoExt, x-fastest of volDim, onto cubic voxels covering its ECEF
+ * bound, as many as maxVoxNum at most and not smaller than minVoxSz. Values are interpolated
+ * trilinearly, as GL_LINEAR with clamping would.
+ */
+inline ECEFVolume ResampleToECEF(const float *volDat, const std::array<int, 3> &volDim,
+                                 const GeoExtent &geoExt, size_t maxVoxNum, float minVoxSz) {
+    ECEFVolume ecefVol;
+    ecefVol.bound = geoExt.GridBoxToECEFBound(
+        osg::BoundingBox(osg::Vec3(0.f, 0.f, 0.f), osg::Vec3(1.f, 1.f, 1.f)));
+    auto size = ecefVol.bound._max - ecefVol.bound._min;
+    maxVoxNum = std::max(maxVoxNum, size_t(1));
+    auto voxSz =
+        std::max(std::cbrt(size.x() * size.y() * size.z() / static_cast<float>(maxVoxNum)),
+                 minVoxSz);
+    // Dimensions are rounded up, so that voxels shrink a little to cover the bound exactly
+    for (int a = 0; a < 3; ++a)
+        ecefVol.dim[a] = std::max(static_cast<int>(std::ceil(size[a] / voxSz)), 1);
+    while (static_cast<size_t>(ecefVol.dim[0]) * ecefVol.dim[1] * ecefVol.dim[2] > maxVoxNum) {
+        auto a = std::max_element(ecefVol.dim.begin(), ecefVol.dim.end()) - ecefVol.dim.begin();
+        if (ecefVol.dim[a] == 1)
+            break;
+        --ecefVol.dim[a];
+    }
+
+    auto sliceVoxNum = static_cast<size_t>(ecefVol.dim[0]) * ecefVol.dim[1];
+    ecefVol.scalars.assign(sliceVoxNum * ecefVol.dim[2], 0.f);
+    ecefVol.coverages.assign(sliceVoxNum * ecefVol.dim[2], 0.f);
+
+    auto lonDlt = geoExt.maxLongtitute - geoExt.minLongtitute;
+    auto latDlt = geoExt.maxLatitute - geoExt.minLatitute;
+    auto hDlt = geoExt.maxHeight - geoExt.minHeight;
+    auto sample = [&](const osg::Vec3 &coord) {
+        std::array<int, 3> idx0, idx1;
+        std::array<float, 3> t;
+        for (int a = 0; a < 3; ++a) {
+            auto pos = std::clamp(coord[a] * volDim[a] - .5f, 0.f, volDim[a] - 1.f);
+            idx0[a] = static_cast<int>(pos);
+            idx1[a] = std::min(idx0[a] + 1, volDim[a] - 1);
+            t[a] = pos - idx0[a];
+        }
+        auto at = [&](int x, int y, int z) {
+            return volDat[(static_cast<size_t>(z) * volDim[1] + y) * volDim[0] + x];
+        };
+        auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+        auto bilerp = [&](int z) {
+            return lerp(lerp(at(idx0[0], idx0[1], z), at(idx1[0], idx0[1], z), t[0]),
+                        lerp(at(idx0[0], idx1[1], z), at(idx1[0], idx1[1], z), t[0]), t[1]);
+        };
+        return lerp(bilerp(idx0[2]), bilerp(idx1[2]), t[2]);
+    };
+
+    ParallelFor(0, ecefVol.dim[2], [&](size_t z) {
+        for (int y = 0; y < ecefVol.dim[1]; ++y)
+            for (int x = 0; x < ecefVol.dim[0]; ++x) {
+                // Voxel centers, as GL_LINEAR addresses them
+                auto pos = ecefVol.bound._min +
+                           osg::componentMultiply(osg::Vec3((x + .5f) / ecefVol.dim[0],
+                                                            (y + .5f) / ecefVol.dim[1],
+                                                            (z + .5f) / ecefVol.dim[2]),
+                                                  size);
+                // The same mapping as of the ray-march in geo coordinates
+                auto rXY = std::sqrt(pos.x() * pos.x() + pos.y() * pos.y());
+                osg::Vec3 coord((std::atan2(pos.y(), pos.x()) - geoExt.minLongtitute) / lonDlt,
+                                (std::atan(pos.z() / rXY) - geoExt.minLatitute) / latDlt,
+                                (pos.length() - geoExt.minHeight) / hDlt);
+                if (coord.x() < 0.f || coord.x() > 1.f || coord.y() < 0.f || coord.y() > 1.f ||
+                    coord.z() < 0.f || coord.z() > 1.f)
+                    continue;
+
+                auto offs = z * sliceVoxNum + static_cast<size_t>(y) * ecefVol.dim[0] + x;
+                ecefVol.scalars[offs] = sample(coord);
+                ecefVol.coverages[offs] = 1.f;
+            }
+    });
+
+    return ecefVol;
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_DVR_ECEF_H
@@ -0,0 +1,176 @@
+#ifndef SCIVIS_SCALAR_VISER_DVR_OCCUPANCY_H
+#define SCIVIS_SCALAR_VISER_DVR_OCCUPANCY_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include <array>
+#include <vector>
+
+#include <osg/Vec4>
+
+#include <scivis/parallel.h>
+
+namespace SciVis {
+namespace ScalarViser {
+
+struct OccupancyGrid {
+    static constexpr uint8_t MaxDist = 255;
+
+    std::array<int, 3> dim = {0, 0, 0};
+    // 0 if the block may be visible, otherwise the chessboard distance in blocks to the nearest
+    // such block clamped to MaxDist. All blocks closer than it are empty. In x-fastest order.
+    std::vector<uint8_t> dat;
+};
+
+/*
+ * Turns dat of grid from 0 for blocks that may be visible and MaxDist for empty ones into the
+ * distances to the former.
+ */
+inline void CmptOccupancyDistances(OccupancyGrid &grid) {
+    std::array<size_t, 3> strides{1, static_cast<size_t>(grid.dim[0]),
+                                  static_cast<size_t>(grid.dim[0]) * grid.dim[1]};
+
+    // min_q max_a |p_a - q_a| is separable into min_q max(|p_a - q_a|, dist) along each axis.
+    // Lines are as short as the grid, so each is transformed by brute force.
+    for (int a = 0; a < 3; ++a) {
+        auto a1 = (a + 1) % 3;
+        auto a2 = (a + 2) % 3;
+        ParallelFor(0, static_cast<size_t>(grid.dim[a1]) * grid.dim[a2], [&](size_t lineIdx) {
+            auto start = (lineIdx % grid.dim[a1]) * strides[a1] +
+                         (lineIdx / grid.dim[a1]) * strides[a2];
+            std::vector<uint8_t> line(grid.dim[a]);
+            for (int i = 0; i < grid.dim[a]; ++i)
+                line[i] = grid.dat[start + i * strides[a]];
+
+            for (int i = 0; i < grid.dim[a]; ++i) {
+                int dist = line[i];
+                for (int j = 0; j < grid.dim[a]; ++j)
+                    dist = std::min(dist, std::max(std::abs(i - j), static_cast<int>(line[j])));
+                grid.dat[start + i * strides[a]] = static_cast<uint8_t>(dist);
+            }
+        });
+    }
+}
+
+/*
+ * Classifies blocks of blockLen^3 voxels of a volume of scalars in [0, 1] under a transfer
+ * function. A block is empty if the transfer function is transparent over every value that
+ * GL_LINEAR filtering of both textures can give at a point inside the block, so that skipping
+ * it does not change the image. Such values are bounded by the voxels of the block plus an
+ * apron of one voxel, and are looked up from the texels around their extremes.
+ * Distances let the ray-march leap over a cube of empty blocks at once, instead of stopping at
+ * the faces of every block.
+ */
+inline OccupancyGrid BuildOccupancyGrid(const float *volDat, const std::array<int, 3> &volDim,
+                                        const osg::Vec4 *tfDat, int tfLen, int blockLen) {
+    OccupancyGrid grid;
+    for (int a = 0; a < 3; ++a)
+        grid.dim[a] = (volDim[a] + blockLen - 1) / blockLen;
+    grid.dat.assign(static_cast<size_t>(grid.dim[0]) * grid.dim[1] * grid.dim[2], 0);
+
+    // Number of opaque texels before each texel
+    std::vector<int> opaqueCnts(tfLen + 1, 0);
+    for (int i = 0; i < tfLen; ++i)
+        opaqueCnts[i + 1] = opaqueCnts[i] + (tfDat[i].a() > 0.f ? 1 : 0);
+    auto isTransparent = [&](float minVal, float maxVal) {
+        // One more texel on each side, against the lower precision of texture coordinates
+        auto i0 = static_cast<int>(std::floor(minVal * tfLen - .5f)) - 1;
+        auto i1 = static_cast<int>(std::floor(maxVal * tfLen - .5f)) + 2;
+        i0 = std::clamp(i0, 0, tfLen - 1);
+        i1 = std::clamp(i1, 0, tfLen - 1);
+        return opaqueCnts[i1 + 1] - opaqueCnts[i0] == 0;
+    };
+
+    ParallelFor(0, static_cast<size_t>(grid.dim[1]) * grid.dim[2], [&](size_t yz) {
+        auto by = static_cast<int>(yz % grid.dim[1]);
+        auto bz = static_cast<int>(yz / grid.dim[1]);
+        auto y0 = std::max(by * blockLen - 1, 0);
+        auto y1 = std::min((by + 1) * blockLen, volDim[1] - 1);
+        auto z0 = std::max(bz * blockLen - 1, 0);
+        auto z1 = std::min((bz + 1) * blockLen, volDim[2] - 1);
+
+        for (int bx = 0; bx < grid.dim[0]; ++bx) {
+            auto x0 = std::max(bx * blockLen - 1, 0);
+            auto x1 = std::min((bx + 1) * blockLen, volDim[0] - 1);
+
+            auto minVal = 1.f;
+            auto maxVal = 0.f;
+            for (int z = z0; z <= z1; ++z)
+                for (int y = y0; y <= y1; ++y) {
+                    auto row = volDat + (static_cast<size_t>(z) * volDim[1] + y) * volDim[0];
+                    for (int x = x0; x <= x1; ++x) {
+                        minVal = std::min(minVal, row[x]);
+                        maxVal = std::max(maxVal, row[x]);
+                    }
+                }
+
+            grid.dat[yz * grid.dim[0] + bx] =
+                isTransparent(minVal, maxVal) ? OccupancyGrid::MaxDist : 0;
+        }
+    });
+
+    CmptOccupancyDistances(grid);
+
+    return grid;
+}
+
+/*
+ * Merges the grids of volumes spanning the same extent, whose blocks are blockSzs[i] long in
+ * normalized coordinates, into a grid of the finest blocks along each axis. A merged block may
+ * be visible if it overlaps a block of any grid that may be.
+ */
+inline OccupancyGrid MergeOccupancyGrids(const std::vector<const OccupancyGrid *> &grids,
+                                         const std::vector<std::array<float, 3>> &blockSzs,
+                                         std::array<float, 3> &mergedBlockSz) {
+    OccupancyGrid merged;
+    for (int a = 0; a < 3; ++a) {
+        auto finest = std::min_element(blockSzs.begin(), blockSzs.end(),
+                                       [&](const auto &l, const auto &r) { return l[a] < r[a]; });
+        merged.dim[a] = grids[finest - blockSzs.begin()]->dim[a];
+        mergedBlockSz[a] = (*finest)[a];
+    }
+    merged.dat.assign(static_cast<size_t>(merged.dim[0]) * merged.dim[1] * merged.dim[2],
+                      OccupancyGrid::MaxDist);
+
+    ParallelFor(0, static_cast<size_t>(merged.dim[1]) * merged.dim[2], [&](size_t yz) {
+        std::array<int, 3> idx3{0, static_cast<int>(yz % merged.dim[1]),
+                                static_cast<int>(yz / merged.dim[1])};
+        for (idx3[0] = 0; idx3[0] < merged.dim[0]; ++idx3[0]) {
+            auto isVisible = false;
+            for (size_t g = 0; g < grids.size() && !isVisible; ++g) {
+                auto &grid = *grids[g];
+
+                // Blocks of grid overlapping the merged one
+                std::array<int, 3> lo, hi;
+                for (int a = 0; a < 3; ++a) {
+                    auto ratio = mergedBlockSz[a] / blockSzs[g][a];
+                    lo[a] = std::clamp(static_cast<int>(std::floor(idx3[a] * ratio)), 0,
+                                       grid.dim[a] - 1);
+                    hi[a] = std::clamp(static_cast<int>(std::ceil((idx3[a] + 1) * ratio)) - 1,
+                                       lo[a], grid.dim[a] - 1);
+                }
+
+                for (int z = lo[2]; z <= hi[2] && !isVisible; ++z)
+                    for (int y = lo[1]; y <= hi[1] && !isVisible; ++y) {
+                        auto row = grid.dat.data() +
+                                   (static_cast<size_t>(z) * grid.dim[1] + y) * grid.dim[0];
+                        for (int x = lo[0]; x <= hi[0] && !isVisible; ++x)
+                            isVisible = row[x] == 0;
+                    }
+            }
+
+            if (isVisible)
+                merged.dat[yz * merged.dim[0] + idx3[0]] = 0;
+        }
+    });
+    CmptOccupancyDistances(merged);
+
+    return merged;
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_DVR_OCCUPANCY_H
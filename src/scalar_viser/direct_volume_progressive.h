@@ -0,0 +1,294 @@
+#ifndef SCIVIS_SCALAR_VISER_DVR_PROGRESSIVE_H
+#define SCIVIS_SCALAR_VISER_DVR_PROGRESSIVE_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <osg/BlendColor>
+#include <osg/BlendFunc>
+#include <osg/Camera>
+#include <osg/CullStack>
+#include <osg/FrameStamp>
+#include <osg/Geometry>
+#include <osg/Texture2D>
+
+#include "shaders/generated/dvr_composite_frag.h"
+#include "shaders/generated/dvr_composite_vert.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+// Radical inverse of i in base, the i-th point of the Halton sequence of base in [0, 1)
+inline float RadicalInverse(int i, int base) {
+    auto inv = 1.f / base;
+    auto scale = inv;
+    auto val = 0.f;
+    for (; i > 0; i /= base, scale *= inv)
+        val += (i % base) * scale;
+    return val;
+}
+
+/*
+ * Renders the volume group into an offscreen pass target, resolves it into an accumulation
+ * target, and composites that over the frame. Volumes are blended over each other in the pass
+ * target as they are on the frame, and only whole passes are averaged in the resolve.
+ * While the camera moves, passes are rendered at a reduced resolution, whose scale is adjusted
+ * to keep frames within InteractionFrameTime whatever the volumes cost, and are upscaled. Once
+ * the camera is still, full-resolution passes jittered by sub-pixel offsets and ray offsets are
+ * averaged, one per frame, until MaxAccumPassNum passes, after which the volumes are no longer
+ * rendered until the camera moves again, or Reset is called.
+ * The pass target has no depth, so volumes are not hidden by the scene in front of them as they
+ * are when not refined progressively.
+ */
+class ProgressiveRefiner : public osg::Referenced {
+  public:
+    static constexpr double InteractionFrameTime = 1. / 30.;
+    static constexpr float MinScale = .125f;
+    static constexpr float MaxScale = .5f;
+    static constexpr int MaxAccumPassNum = 16;
+
+  private:
+    float baseStepInPixels;
+
+    osg::ref_ptr<osg::Group> grp;
+    // Holds rttCam and resolveCam, which are left out once the refinement is done
+    osg::ref_ptr<osg::Group> passGrp;
+    osg::ref_ptr<osg::Camera> rttCam;
+    osg::ref_ptr<osg::Camera> resolveCam;
+    osg::ref_ptr<osg::Camera> compCam;
+    osg::ref_ptr<osg::Texture2D> passTex;
+    osg::ref_ptr<osg::Texture2D> accTex;
+    osg::ref_ptr<osg::BlendColor> accWeight;
+
+    osg::ref_ptr<osg::Uniform> stepInPixels;
+    osg::ref_ptr<osg::Uniform> rayOffset;
+    osg::ref_ptr<osg::Uniform> accTexScale;
+    osg::ref_ptr<osg::Uniform> accTexMax;
+
+    int texW = 0;
+    int texH = 0;
+    // 0 while the camera moves
+    int accumPassNum = 0;
+    float scale = MaxScale;
+    double lastTime = -1.;
+    osg::Matrixd lastModelView;
+    osg::Matrixd lastProj;
+
+    class Callback : public osg::NodeCallback {
+      private:
+        ProgressiveRefiner *refiner;
+
+      public:
+        Callback(ProgressiveRefiner *refiner) : refiner(refiner) {}
+        virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+            if (auto cs = dynamic_cast<osg::CullStack *>(nv);
+                cs && cs->getModelViewMatrix() && cs->getProjectionMatrix() && cs->getViewport())
+                refiner->update(*cs->getModelViewMatrix(), *cs->getProjectionMatrix(),
+                                *cs->getViewport(), nv->getFrameStamp());
+
+            traverse(node, nv);
+        }
+    };
+
+  public:
+    /*
+     * Takes over volGrp, which should no longer be added elsewhere. stepInPixels and rayOffset
+     * are the uniforms of the ray-march, set per pass.
+     */
+    ProgressiveRefiner(osg::ref_ptr<osg::Group> volGrp, osg::ref_ptr<osg::Uniform> stepInPixels,
+                       osg::ref_ptr<osg::Uniform> rayOffset)
+        : stepInPixels(stepInPixels), rayOffset(rayOffset) {
+        stepInPixels->get(baseStepInPixels);
+
+        auto createTexture = [&]() {
+            osg::ref_ptr tex = new osg::Texture2D;
+            tex->setInternalFormat(GL_RGBA16F_ARB);
+            tex->setSourceFormat(GL_RGBA);
+            tex->setSourceType(GL_FLOAT);
+            tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+            tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::LINEAR);
+            tex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+            tex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+            tex->setTextureSize(1, 1);
+            return tex;
+        };
+        passTex = createTexture();
+        accTex = createTexture();
+
+        // Takes the view and projection of the parent, followed by a jitter in NDC
+        rttCam = new osg::Camera;
+        rttCam->setReferenceFrame(osg::Transform::RELATIVE_RF);
+        rttCam->setTransformOrder(osg::Camera::POST_MULTIPLY);
+        rttCam->setRenderOrder(osg::Camera::PRE_RENDER, 0);
+        rttCam->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+        rttCam->attach(osg::Camera::COLOR_BUFFER0, passTex);
+        rttCam->setClearColor(osg::Vec4(0.f, 0.f, 0.f, 0.f));
+        rttCam->setClearMask(GL_COLOR_BUFFER_BIT);
+        rttCam->setViewport(new osg::Viewport(0, 0, 1, 1));
+        rttCam->addChild(volGrp);
+        {
+            // Volumes are over each other, with colors premultiplied by their opacities
+            auto states = rttCam->getOrCreateStateSet();
+            states->setAttributeAndModes(
+                new osg::BlendFunc(osg::BlendFunc::ONE, osg::BlendFunc::ONE_MINUS_SRC_ALPHA));
+            states->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+        }
+
+        osg::ref_ptr quad = new osg::Geometry;
+        {
+            osg::ref_ptr verts = new osg::Vec3Array;
+            verts->push_back(osg::Vec3(0.f, 0.f, 0.f));
+            verts->push_back(osg::Vec3(1.f, 0.f, 0.f));
+            verts->push_back(osg::Vec3(1.f, 1.f, 0.f));
+            verts->push_back(osg::Vec3(0.f, 1.f, 0.f));
+            quad->setUseVertexBufferObjects(true);
+            quad->setVertexArray(verts);
+            quad->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::QUADS, 0, 4));
+        }
+        osg::ref_ptr program = new osg::Program;
+        program->addShader(new osg::Shader(osg::Shader::VERTEX, dvr_composite_vert));
+        program->addShader(new osg::Shader(osg::Shader::FRAGMENT, dvr_composite_frag));
+        // Both take the part of the source rendered to, which is the same in passTex and accTex
+        accTexScale = new osg::Uniform("accTexScale", osg::Vec2(1.f, 1.f));
+        accTexMax = new osg::Uniform("accTexMax", osg::Vec2(1.f, 1.f));
+        auto createQuadCamera = [&](osg::ref_ptr<osg::Texture2D> srcTex) {
+            osg::ref_ptr cam = new osg::Camera;
+            cam->setReferenceFrame(osg::Transform::ABSOLUTE_RF);
+            cam->setProjectionMatrix(osg::Matrixd::ortho2D(0., 1., 0., 1.));
+            cam->setViewMatrix(osg::Matrixd::identity());
+            cam->setAllowEventFocus(false);
+            cam->addChild(quad);
+
+            auto states = cam->getOrCreateStateSet();
+            states->setDataVariance(osg::Object::DYNAMIC);
+            states->addUniform(accTexScale);
+            states->addUniform(accTexMax);
+            states->addUniform(new osg::Uniform("accTex", 0));
+            states->setTextureAttributeAndModes(0, srcTex, osg::StateAttribute::ON);
+            states->setAttributeAndModes(program, osg::StateAttribute::ON);
+            states->setMode(GL_DEPTH_TEST, osg::StateAttribute::OFF);
+            return cam;
+        };
+
+        // Draws the pass texel by texel into the same part of accTex, in a running average of
+        // passes, acc = w * pass + (1 - w) * acc
+        resolveCam = createQuadCamera(passTex);
+        resolveCam->setRenderOrder(osg::Camera::PRE_RENDER, 1);
+        resolveCam->setRenderTargetImplementation(osg::Camera::FRAME_BUFFER_OBJECT);
+        resolveCam->attach(osg::Camera::COLOR_BUFFER0, accTex);
+        resolveCam->setClearColor(osg::Vec4(0.f, 0.f, 0.f, 0.f));
+        resolveCam->setViewport(new osg::Viewport(0, 0, 1, 1));
+        {
+            auto states = resolveCam->getOrCreateStateSet();
+            accWeight = new osg::BlendColor(osg::Vec4(1.f, 1.f, 1.f, 1.f));
+            states->setAttributeAndModes(accWeight);
+            states->setAttributeAndModes(new osg::BlendFunc(
+                osg::BlendFunc::CONSTANT_ALPHA, osg::BlendFunc::ONE_MINUS_CONSTANT_ALPHA));
+        }
+
+        compCam = createQuadCamera(accTex);
+        compCam->setRenderOrder(osg::Camera::POST_RENDER);
+        compCam->setClearMask(0);
+        compCam->getOrCreateStateSet()->setAttributeAndModes(
+            new osg::BlendFunc(osg::BlendFunc::ONE, osg::BlendFunc::ONE_MINUS_SRC_ALPHA));
+
+        passGrp = new osg::Group;
+        passGrp->addChild(rttCam);
+        passGrp->addChild(resolveCam);
+
+        grp = new osg::Group;
+        grp->addChild(passGrp);
+        grp->addChild(compCam);
+        grp->addCullCallback(new Callback(this));
+    }
+
+    osg::Group *GetGroup() { return grp.get(); }
+
+    /*
+     * Starts the refinement over from the next frame, as the volumes or their states changed
+     * while the camera was still, and the passes averaged so far are stale.
+     */
+    void Reset() {
+        accumPassNum = 0;
+        passGrp->setNodeMask(~0u);
+    }
+
+  private:
+    void update(const osg::Matrixd &modelView, const osg::Matrixd &proj,
+                const osg::Viewport &viewport, const osg::FrameStamp *frameStamp) {
+        auto w = std::max(1, static_cast<int>(viewport.width()));
+        auto h = std::max(1, static_cast<int>(viewport.height()));
+        auto isMoving = modelView != lastModelView || proj != lastProj;
+        lastModelView = modelView;
+        lastProj = proj;
+        if (w != texW || h != texH) {
+            texW = w;
+            texH = h;
+            for (auto &tex : {passTex, accTex}) {
+                tex->setTextureSize(texW, texH);
+                tex->dirtyTextureObject();
+            }
+            rttCam->dirtyAttachmentMap();
+            resolveCam->dirtyAttachmentMap();
+            isMoving = true;
+        }
+
+        auto time = frameStamp ? frameStamp->getReferenceTime() : 0.;
+        auto wasMoving = accumPassNum == 0;
+        auto frameTime = lastTime < 0. ? 0. : time - lastTime;
+        lastTime = time;
+
+        if (isMoving) {
+            // Pixels, thus the cost of the volumes, go with the square of the scale
+            if (wasMoving && frameTime > 0.)
+                scale = std::clamp(
+                    scale * static_cast<float>(std::sqrt(InteractionFrameTime / frameTime)),
+                    MinScale, MaxScale);
+
+            accumPassNum = 0;
+            setPass(std::max(1, static_cast<int>(texW * scale)),
+                    std::max(1, static_cast<int>(texH * scale)), osg::Vec2(), 0.f, 1.f);
+            return;
+        }
+        if (accumPassNum == MaxAccumPassNum) {
+            passGrp->setNodeMask(0);
+            return;
+        }
+
+        ++accumPassNum;
+        osg::Vec2 jitter(RadicalInverse(accumPassNum, 2) - .5f,
+                         RadicalInverse(accumPassNum, 3) - .5f);
+        setPass(texW, texH, jitter, RadicalInverse(accumPassNum, 5),
+                1.f / static_cast<float>(accumPassNum));
+    }
+
+    /*
+     * Renders the next pass into the lower left w x h of the targets, offset by jitter in
+     * pixels, with rays offset by the fraction offs of their first step, and weighted by
+     * weight against the passes before. A weight of 1 clears the accumulation.
+     */
+    void setPass(int w, int h, const osg::Vec2 &jitter, float offs, float weight) {
+        passGrp->setNodeMask(~0u);
+        if (auto vp = rttCam->getViewport();
+            !vp || static_cast<int>(vp->width()) != w || static_cast<int>(vp->height()) != h) {
+            rttCam->setViewport(new osg::Viewport(0, 0, w, h));
+            resolveCam->setViewport(new osg::Viewport(0, 0, w, h));
+        }
+        rttCam->setProjectionMatrix(
+            osg::Matrixd::translate(2. * jitter.x() / w, 2. * jitter.y() / h, 0.));
+        resolveCam->setClearMask(weight == 1.f ? GL_COLOR_BUFFER_BIT : 0);
+        accWeight->setConstantColor(osg::Vec4(1.f, 1.f, 1.f, weight));
+
+        // Steps span pixels of the full resolution
+        stepInPixels->set(baseStepInPixels * texW / w);
+        rayOffset->set(offs);
+
+        accTexScale->set(osg::Vec2(static_cast<float>(w) / texW, static_cast<float>(h) / texH));
+        accTexMax->set(osg::Vec2((w - .5f) / texW, (h - .5f) / texH));
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_DVR_PROGRESSIVE_H
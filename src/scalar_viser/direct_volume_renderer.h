@@ -1,19 +1,34 @@
 #ifndef SCIVIS_SCALAR_VISER_DVR_H
 #define SCIVIS_SCALAR_VISER_DVR_H
 
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <memory>
 #include <numbers>
+#include <source_location>
 #include <string>
 
+#include <array>
 #include <map>
+#include <vector>
 
 #include <osg/CullFace>
-#include <osg/ShapeDrawable>
+#include <osg/CullStack>
+#include <osg/Geometry>
 #include <osg/Texture1D>
+#include <osg/Texture2D>
 #include <osg/Texture3D>
 
-#include <scivis/callback.h>
+#include <scivis/camera_state.h>
 
 #include "def_val.h"
+#include "direct_volume_ecef.h"
+#include "direct_volume_occupancy.h"
+#include "direct_volume_progressive.h"
+#include "geo_proxy.h"
+#include "virtual_volume.h"
 
 #include "shaders/generated/dvr_sphere_proxy_frag.h"
 #include "shaders/generated/dvr_sphere_proxy_vert.h"
@@ -23,15 +38,71 @@ namespace ScalarViser {
 
 class DirectVolumeRenderer {
   private:
+    // Edge length in voxels of the blocks the ray-march leaps over when they are empty
+    static constexpr int OccuBlockLen = 8;
+    // Steps span StepInPixels pixels at their distance from the eye, and at least
+    // MinStepInVoxels of the smallest voxel edge
+    static constexpr float StepInPixels = 1.f;
+    static constexpr float MinStepInVoxels = .5f;
+    // Volumes marched together at most, as in the shader
+    static constexpr int MaxVolNum = 8;
+    // Texels of the volume atlas along each axis at most, as VirtualVolume::MaxAtlasLen
+    static constexpr int MaxAtlasLen = VirtualVolume::MaxAtlasLen;
+    // Voxels of a volume resampled onto ECEF at most by default
+    static constexpr size_t DefECEFMaxVoxNum = size_t(256) * 256 * 256;
+
+    /*
+     * Pages the virtual volumes on the cull traversal of the renderer group, which goes on while
+     * the progressive refiner leaves the volumes out, and restarts the refinement once the
+     * bricks resident change.
+     */
+    class VirtualVolumeCallback : public osg::NodeCallback {
+      public:
+        std::vector<osg::ref_ptr<VirtualVolume>> virtVols;
+        osg::ref_ptr<ProgressiveRefiner> refiner;
+
+        virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+            if (auto cs = dynamic_cast<osg::CullStack *>(nv);
+                cs && cs->getModelViewMatrix() && cs->getProjectionMatrix() && cs->getViewport()) {
+                auto isChanged = false;
+                for (auto &virtVol : virtVols)
+                    if (virtVol->Update(*cs->getModelViewMatrix(), *cs->getProjectionMatrix(),
+                                        *cs->getViewport()))
+                        isChanged = true;
+                if (isChanged && refiner.valid())
+                    refiner->Reset();
+            }
+
+            traverse(node, nv);
+        }
+    };
+
     struct PerRendererParam {
         osg::ref_ptr<osg::Group> grp;
+        osg::ref_ptr<osg::Group> volGrp;
         osg::ref_ptr<osg::Program> program;
+        osg::ref_ptr<osg::Program> multiVolProgram;
+        osg::ref_ptr<osg::Program> virtVolProgram;
+        osg::ref_ptr<osg::Program> ecefProgram;
 
-        osg::ref_ptr<osg::Uniform> eyePos;
-        osg::ref_ptr<osg::Uniform> dt;
+        osg::ref_ptr<CameraState> camState;
+        osg::ref_ptr<ProgressiveRefiner> refiner;
+        osg::ref_ptr<VirtualVolumeCallback> virtVolCallback;
 
-        PerRendererParam() {
+        osg::ref_ptr<osg::Uniform> refDt;
+        osg::ref_ptr<osg::Uniform> stepInPixels;
+        osg::ref_ptr<osg::Uniform> rayOffset;
+        osg::ref_ptr<osg::Uniform> shading;
+        osg::ref_ptr<osg::Uniform> gradMagOpacity;
+
+        PerRendererParam(osg::ref_ptr<CameraState> camState)
+            : camState(camState.valid() ? camState : osg::ref_ptr<CameraState>(new CameraState)) {
             grp = new osg::Group;
+            this->camState->Attach(grp);
+            virtVolCallback = new VirtualVolumeCallback;
+            grp->addCullCallback(virtVolCallback);
+            volGrp = new osg::Group;
+            grp->addChild(volGrp);
 
             osg::ref_ptr vertShader = new osg::Shader(osg::Shader::VERTEX, dvr_sphere_proxy_vert);
             osg::ref_ptr fragShader = new osg::Shader(osg::Shader::FRAGMENT, dvr_sphere_proxy_frag);
@@ -39,49 +110,50 @@ class DirectVolumeRenderer {
             program->addShader(vertShader);
             program->addShader(fragShader);
 
+            auto createVariant = [&](const char *define) {
+                std::string fragSrc = dvr_sphere_proxy_frag;
+                fragSrc.insert(fragSrc.find('\n', fragSrc.find("#version")) + 1,
+                               std::format("#define {}\n", define));
+                osg::ref_ptr variant = new osg::Program;
+                variant->addShader(vertShader);
+                variant->addShader(new osg::Shader(osg::Shader::FRAGMENT, fragSrc));
+                return variant;
+            };
+            multiVolProgram = createVariant("MULTI_VOLUME");
+            virtVolProgram = createVariant("VIRTUAL_VOLUME");
+            ecefProgram = createVariant("ECEF_VOLUME");
+
 #define STATEMENT(name, val) name = new osg::Uniform(#name, val)
-            STATEMENT(eyePos, osg::Vec3());
-            STATEMENT(dt, static_cast<float>(osg::WGS_84_RADIUS_EQUATOR) * .0005f);
+            STATEMENT(refDt, static_cast<float>(osg::WGS_84_RADIUS_EQUATOR) * .0005f);
+            STATEMENT(stepInPixels, StepInPixels);
+            STATEMENT(rayOffset, 0.f);
+            STATEMENT(shading, osg::Vec4(.3f, .7f, .2f, 16.f));
+            STATEMENT(gradMagOpacity, 0.f);
 #undef STATEMENT
         }
     };
     PerRendererParam param;
 
-    struct PerVolParam {
+    // Proxy of one ray-march and its states
+    struct ProxyParam {
         osg::ref_ptr<osg::Uniform> minLatitute;
         osg::ref_ptr<osg::Uniform> maxLatitute;
         osg::ref_ptr<osg::Uniform> minLongtitute;
         osg::ref_ptr<osg::Uniform> maxLongtitute;
         osg::ref_ptr<osg::Uniform> minHeight;
         osg::ref_ptr<osg::Uniform> maxHeight;
+        osg::ref_ptr<osg::Uniform> occuBlockSz;
+        osg::ref_ptr<osg::Uniform> minDt;
 
-        osg::ref_ptr<osg::ShapeDrawable> sphere;
-        osg::ref_ptr<osg::Texture3D> volTex;
-        osg::ref_ptr<osg::Texture1D> tfTex;
-
-        class Callback : public osg::NodeCallback {
-          private:
-            PerRendererParam *renderer;
-
-          public:
-            Callback(PerRendererParam *renderer) : renderer(renderer) {}
-            virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
-                auto eyePos = nv->getEyePoint();
-                renderer->eyePos->setUpdateCallback(new UniformUpdateCallback<osg::Vec3>(eyePos));
+        osg::ref_ptr<osg::Geometry> proxy;
+        osg::ref_ptr<osg::Texture3D> occuTex;
 
-                traverse(node, nv);
-            }
-        };
+        void setUpStates(PerRendererParam *renderer, osg::Program *program,
+                         osg::StateAttribute *volTex, osg::StateAttribute *tfTex,
+                         const osg::Vec3 &blockSz, float minDtVal) {
+            proxy = CreateGeoShellProxy(GeoExtent());
 
-        PerVolParam(osg::ref_ptr<osg::Texture3D> volTex, osg::ref_ptr<osg::Texture1D> tfTex,
-                    PerRendererParam *renderer)
-            : volTex(volTex), tfTex(tfTex) {
-            sphere = new osg::ShapeDrawable(new osg::Sphere(osg::Vec3(0.f, 0.f, 0.f), MaxHeight),
-                                            new osg::TessellationHints);
-            sphere->setUseVertexBufferObjects(true);
-            sphere->addCullCallback(new Callback(renderer));
-
-            auto states = sphere->getOrCreateStateSet();
+            auto states = proxy->getOrCreateStateSet();
             auto deg2Rad = [](float deg) {
                 return deg * static_cast<float>(std::numbers::pi) / 180.f;
             };
@@ -94,37 +166,562 @@ class DirectVolumeRenderer {
             STATEMENT(maxLongtitute, deg2Rad(MaxLongtitute));
             STATEMENT(minHeight, MinHeight);
             STATEMENT(maxHeight, MaxHeight);
+            STATEMENT(occuBlockSz, blockSz);
+            STATEMENT(minDt, minDtVal);
 #undef STATEMENT
-            states->addUniform(renderer->eyePos);
-            states->addUniform(renderer->dt);
+            states->addUniform(renderer->refDt);
+            states->addUniform(renderer->stepInPixels);
+            states->addUniform(renderer->rayOffset);
 
+            states->addUniform(new osg::Uniform("volTex", 0));
+            states->addUniform(new osg::Uniform("tfTex", 1));
+            states->addUniform(new osg::Uniform("occuTex", 2));
             states->setTextureAttributeAndModes(0, volTex, osg::StateAttribute::ON);
             states->setTextureAttributeAndModes(1, tfTex, osg::StateAttribute::ON);
+            states->setTextureAttributeAndModes(2, occuTex, osg::StateAttribute::ON);
 
             osg::ref_ptr cf = new osg::CullFace(osg::CullFace::BACK);
             states->setAttributeAndModes(cf);
 
-            states->setAttributeAndModes(renderer->program, osg::StateAttribute::ON);
+            states->setAttributeAndModes(program, osg::StateAttribute::ON);
             states->setMode(GL_BLEND, osg::StateAttribute::ON);
         }
+
+        void createOccupancyTexture(const OccupancyGrid &grid) {
+            osg::ref_ptr img = new osg::Image;
+            img->allocateImage(grid.dim[0], grid.dim[1], grid.dim[2], GL_RED, GL_UNSIGNED_BYTE);
+            img->setInternalTextureFormat(GL_RED);
+            std::copy(grid.dat.begin(), grid.dat.end(), img->data());
+
+            occuTex = new osg::Texture3D;
+            occuTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::NEAREST);
+            occuTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+            occuTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+            occuTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+            occuTex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+            occuTex->setInternalFormatMode(
+                osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+            occuTex->setImage(img);
+        }
+    };
+
+    struct PerVolParam : ProxyParam {
+        osg::ref_ptr<osg::Texture3D> volTex;
+        osg::ref_ptr<osg::Texture1D> tfTex;
+        // Set for volumes paged from files, whose volTex is their coarse version
+        osg::ref_ptr<VirtualVolume> virtVol;
+        osg::ref_ptr<osg::Texture3D> gradTex;
+        osg::ref_ptr<osg::Uniform> isShaded;
+        // Set while volTex is marched as resampled onto ECEF
+        osg::ref_ptr<osg::Texture3D> ecefTex;
+
+        OccupancyGrid occuGrid;
+        osg::Vec3 blockSz;
+
+        PerVolParam(osg::ref_ptr<osg::Texture3D> volTex, osg::ref_ptr<osg::Texture1D> tfTex,
+                    PerRendererParam *renderer)
+            : volTex(volTex), tfTex(tfTex) {
+            buildOccupancy();
+            setUpStates(renderer, renderer->program, volTex, tfTex, blockSz,
+                        cmptMinStep(renderer));
+            setUpShadingStates(renderer);
+        }
+        PerVolParam(osg::ref_ptr<VirtualVolume> virtVol, osg::ref_ptr<osg::Texture1D> tfTex,
+                    PerRendererParam *renderer)
+            : volTex(virtVol->GetCoarseTexture()), tfTex(tfTex), virtVol(virtVol) {
+            // Blocks empty in the coarse version may hold opaque voxels of the full resolution,
+            // whose bricks are not all read, so that no block is skipped
+            occuGrid = classify(nullptr, {1, 1, 1}, blockSz);
+            createOccupancyTexture(occuGrid);
+            setUpStates(renderer, renderer->virtVolProgram, volTex, tfTex, blockSz,
+                        cmptMinStep(renderer));
+            setUpShadingStates(renderer);
+
+            auto states = proxy->getOrCreateStateSet();
+            states->addUniform(new osg::Uniform("brickAtlas", 3));
+            states->addUniform(new osg::Uniform("pageTex", 4));
+            states->addUniform(new osg::Uniform("fullVolDim", virtVol->GetVolumeDimension()));
+            states->addUniform(new osg::Uniform("atlasDim", virtVol->GetAtlasDimension()));
+            states->addUniform(
+                new osg::Uniform("brickLen", static_cast<float>(virtVol->GetBrickLength())));
+            states->setTextureAttributeAndModes(3, virtVol->GetAtlasTexture(),
+                                                osg::StateAttribute::ON);
+            states->setTextureAttributeAndModes(4, virtVol->GetPageTexture(),
+                                                osg::StateAttribute::ON);
+        }
+
+        void setUpShadingStates(PerRendererParam *renderer) {
+            auto states = proxy->getOrCreateStateSet();
+            isShaded = new osg::Uniform("isShaded", false);
+            states->addUniform(isShaded);
+            states->addUniform(renderer->shading);
+            states->addUniform(renderer->gradMagOpacity);
+            states->addUniform(new osg::Uniform("gradTex", 5));
+        }
+
+        // Shades the volume with gradTex, as from GradientConvertor, or not if it is null
+        void setGradient(osg::ref_ptr<osg::Texture3D> gradTex) {
+            auto states = proxy->getOrCreateStateSet();
+            if (this->gradTex.valid())
+                states->removeTextureAttribute(5, this->gradTex);
+            this->gradTex = gradTex;
+            if (gradTex.valid())
+                states->setTextureAttributeAndModes(5, gradTex, osg::StateAttribute::ON);
+            isShaded->set(gradTex.valid());
+        }
+
+        // MinStepInVoxels of the smallest voxel edge, which is where the shell is the narrowest
+        float cmptMinStep(PerRendererParam *renderer) const {
+            osg::Vec3 volDim;
+            if (virtVol.valid())
+                volDim = virtVol->GetVolumeDimension();
+            else if (auto volImg = volTex.valid() ? volTex->getImage() : nullptr; volImg)
+                volDim.set(volImg->s(), volImg->t(), volImg->r());
+            if (volDim.x() <= 0.f || volDim.y() <= 0.f || volDim.z() <= 0.f) {
+                float refDt;
+                renderer->refDt->get(refDt);
+                return refDt;
+            }
+
+            GeoExtent geoExt;
+            auto maxAbsLat = std::max(std::abs(geoExt.minLatitute), std::abs(geoExt.maxLatitute));
+            auto lonVox = geoExt.minHeight * std::cos(maxAbsLat) *
+                          (geoExt.maxLongtitute - geoExt.minLongtitute) / volDim.x();
+            auto latVox =
+                geoExt.minHeight * (geoExt.maxLatitute - geoExt.minLatitute) / volDim.y();
+            auto hVox = (geoExt.maxHeight - geoExt.minHeight) / volDim.z();
+            return MinStepInVoxels * std::min({lonVox, latVox, hVox});
+        }
+
+        /*
+         * Classifies blocks of the volume as empty or not under the transfer function, with
+         * blockSz as the size of a block in normalized texture coordinates. Volumes whose images
+         * are not of GL_FLOAT get a single occupied block, which disables the skipping.
+         */
+        void buildOccupancy() {
+            auto volImg = volTex.valid() ? volTex->getImage() : nullptr;
+            occuGrid = classify(IsFloatVolume(volTex)
+                                    ? reinterpret_cast<const float *>(volImg->data())
+                                    : nullptr,
+                                IsFloatVolume(volTex)
+                                    ? std::array{volImg->s(), volImg->t(), volImg->r()}
+                                    : std::array{1, 1, 1},
+                                blockSz);
+            createOccupancyTexture(occuGrid);
+        }
+        OccupancyGrid classify(const float *volDat, const std::array<int, 3> &volDim,
+                               osg::Vec3 &blockSz) const {
+            auto tfImg = tfTex.valid() ? tfTex->getImage() : nullptr;
+
+            OccupancyGrid grid;
+            blockSz = osg::Vec3(1.f, 1.f, 1.f);
+            if (volDat && tfImg && tfImg->getPixelFormat() == GL_RGBA &&
+                tfImg->getDataType() == GL_FLOAT) {
+                grid = BuildOccupancyGrid(volDat, volDim,
+                                          reinterpret_cast<const osg::Vec4 *>(tfImg->data()),
+                                          tfImg->s(), OccuBlockLen);
+                for (int a = 0; a < 3; ++a)
+                    blockSz[a] = static_cast<float>(OccuBlockLen) / volDim[a];
+            } else {
+                grid.dim = {1, 1, 1};
+                grid.dat.assign(1, 0);
+            }
+            return grid;
+        }
+
+        /*
+         * Marches a copy of volTex resampled onto ECEF voxels, as many as maxVoxNum at most, or
+         * volTex itself again. volTex should be of a GL_FLOAT image.
+         */
+        void setECEFResampled(bool isResampled, size_t maxVoxNum, PerRendererParam *renderer) {
+            auto minDtVal = cmptMinStep(renderer);
+            if (!isResampled) {
+                ecefTex = nullptr;
+                createOccupancyTexture(occuGrid);
+                setUpStates(renderer, renderer->program, volTex, tfTex, blockSz, minDtVal);
+                setUpShadingStates(renderer);
+                setGradient(gradTex);
+                return;
+            }
+
+            auto volImg = volTex->getImage();
+            // Voxels finer than those of the volume add nothing
+            auto ecefVol = ResampleToECEF(reinterpret_cast<const float *>(volImg->data()),
+                                          {volImg->s(), volImg->t(), volImg->r()}, GeoExtent(),
+                                          maxVoxNum, minDtVal / MinStepInVoxels);
+
+            osg::Vec3 ecefBlockSz;
+            createOccupancyTexture(classify(ecefVol.scalars.data(), ecefVol.dim, ecefBlockSz));
+
+            osg::ref_ptr img = new osg::Image;
+            img->allocateImage(ecefVol.dim[0], ecefVol.dim[1], ecefVol.dim[2], GL_RG, GL_FLOAT);
+            img->setInternalTextureFormat(GL_RG);
+            auto dst = reinterpret_cast<float *>(img->data());
+            for (size_t i = 0; i < ecefVol.scalars.size(); ++i) {
+                dst[2 * i] = ecefVol.scalars[i];
+                dst[2 * i + 1] = ecefVol.coverages[i];
+            }
+
+            // Borders are out of the volume, for samples outside the bound
+            ecefTex = new osg::Texture3D;
+            ecefTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+            ecefTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+            ecefTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP_TO_BORDER);
+            ecefTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP_TO_BORDER);
+            ecefTex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP_TO_BORDER);
+            ecefTex->setBorderColor(osg::Vec4d(0., 0., 0., 0.));
+            ecefTex->setInternalFormatMode(
+                osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+            ecefTex->setImage(img);
+
+            setUpStates(renderer, renderer->ecefProgram, ecefTex, tfTex, ecefBlockSz, minDtVal);
+            auto states = proxy->getOrCreateStateSet();
+            states->addUniform(new osg::Uniform("ecefMin", ecefVol.bound._min));
+            states->addUniform(
+                new osg::Uniform("ecefSize", ecefVol.bound._max - ecefVol.bound._min));
+        }
     };
     std::map<std::string, PerVolParam> vols;
 
+    /*
+     * One proxy for all volumes, whose ray-march samples every volume with its own transfer
+     * function at each step, so that overlapping volumes are composited in depth order at the
+     * cost of a single march. As GLSL 1.30 has no 3D texture arrays, volumes are packed along z
+     * into an atlas, and transfer functions into the rows of a 2D texture.
+     */
+    struct MultiVolParam : ProxyParam {
+        osg::ref_ptr<osg::Texture3D> volTex;
+        osg::ref_ptr<osg::Texture2D> tfTex;
+
+        osg::ref_ptr<osg::Uniform> volNum;
+        osg::ref_ptr<osg::Uniform> volAtlasScales;
+        osg::ref_ptr<osg::Uniform> volAtlasOffsets;
+        osg::ref_ptr<osg::Uniform> volAtlasMins;
+        osg::ref_ptr<osg::Uniform> volAtlasMaxs;
+
+        // vols should be of GL_FLOAT images, and no more than MaxVolNum
+        MultiVolParam(const std::map<std::string, PerVolParam> &vols, PerRendererParam *renderer) {
+            auto minDtVal = std::numeric_limits<float>::max();
+            std::vector<const OccupancyGrid *> grids;
+            std::vector<std::array<float, 3>> blockSzs;
+            for (auto &[name, vol] : vols) {
+                minDtVal = std::min(minDtVal, vol.cmptMinStep(renderer));
+                grids.emplace_back(&vol.occuGrid);
+                blockSzs.push_back({vol.blockSz.x(), vol.blockSz.y(), vol.blockSz.z()});
+            }
+            std::array<float, 3> mergedBlockSz;
+            createOccupancyTexture(MergeOccupancyGrids(grids, blockSzs, mergedBlockSz));
+
+            createAtlases(vols);
+            setUpStates(renderer, renderer->multiVolProgram, volTex, tfTex,
+                        osg::Vec3(mergedBlockSz[0], mergedBlockSz[1], mergedBlockSz[2]),
+                        minDtVal);
+            auto states = proxy->getOrCreateStateSet();
+            states->addUniform(volNum);
+            states->addUniform(volAtlasScales);
+            states->addUniform(volAtlasOffsets);
+            states->addUniform(volAtlasMins);
+            states->addUniform(volAtlasMaxs);
+        }
+
+        void createAtlases(const std::map<std::string, PerVolParam> &vols) {
+            std::array<int, 3> atlasDim{0, 0, 0};
+            auto tfW = 0;
+            for (auto &[name, vol] : vols) {
+                auto volImg = vol.volTex->getImage();
+                atlasDim[0] = std::max(atlasDim[0], volImg->s());
+                atlasDim[1] = std::max(atlasDim[1], volImg->t());
+                atlasDim[2] += volImg->r();
+                if (auto tfImg = vol.tfTex.valid() ? vol.tfTex->getImage() : nullptr; tfImg)
+                    tfW = std::max(tfW, tfImg->s());
+            }
+            tfW = std::max(tfW, 1);
+
+            auto volCnt = static_cast<int>(vols.size());
+#define STATEMENT(name) name = new osg::Uniform(osg::Uniform::FLOAT_VEC3, #name, MaxVolNum)
+            STATEMENT(volAtlasScales);
+            STATEMENT(volAtlasOffsets);
+            STATEMENT(volAtlasMins);
+            STATEMENT(volAtlasMaxs);
+#undef STATEMENT
+            volNum = new osg::Uniform("volNum", volCnt);
+
+            osg::ref_ptr volImg = new osg::Image;
+            volImg->allocateImage(atlasDim[0], atlasDim[1], atlasDim[2], GL_RED, GL_FLOAT);
+            volImg->setInternalTextureFormat(GL_RED);
+            std::fill_n(reinterpret_cast<float *>(volImg->data()),
+                        static_cast<size_t>(atlasDim[0]) * atlasDim[1] * atlasDim[2], 0.f);
+            osg::ref_ptr tfImg = new osg::Image;
+            tfImg->allocateImage(tfW, volCnt, 1, GL_RGBA, GL_FLOAT);
+            tfImg->setInternalTextureFormat(GL_RGBA);
+            std::fill_n(reinterpret_cast<osg::Vec4 *>(tfImg->data()),
+                        static_cast<size_t>(tfW) * volCnt, osg::Vec4());
+
+            auto i = 0;
+            auto zOffs = 0;
+            osg::Vec3 invAtlasDim(1.f / atlasDim[0], 1.f / atlasDim[1], 1.f / atlasDim[2]);
+            for (auto &[name, vol] : vols) {
+                auto srcImg = vol.volTex->getImage();
+                auto src = reinterpret_cast<const float *>(srcImg->data());
+                for (int z = 0; z < srcImg->r(); ++z)
+                    for (int y = 0; y < srcImg->t(); ++y)
+                        std::copy_n(
+                            src + (static_cast<size_t>(z) * srcImg->t() + y) * srcImg->s(),
+                            srcImg->s(),
+                            reinterpret_cast<float *>(volImg->data()) +
+                                (static_cast<size_t>(zOffs + z) * atlasDim[1] + y) * atlasDim[0]);
+
+                osg::Vec3 dim(srcImg->s(), srcImg->t(), srcImg->r());
+                volAtlasScales->setElement(i, osg::componentMultiply(dim, invAtlasDim));
+                volAtlasOffsets->setElement(i, osg::Vec3(0.f, 0.f, zOffs * invAtlasDim.z()));
+                volAtlasMins->setElement(
+                    i, osg::componentMultiply(osg::Vec3(.5f, .5f, zOffs + .5f), invAtlasDim));
+                volAtlasMaxs->setElement(
+                    i, osg::componentMultiply(dim + osg::Vec3(-.5f, -.5f, zOffs - .5f),
+                                              invAtlasDim));
+
+                // Rows are resampled to the widest transfer function as GL_LINEAR would
+                if (auto srcTFImg = vol.tfTex.valid() ? vol.tfTex->getImage() : nullptr;
+                    srcTFImg && srcTFImg->getPixelFormat() == GL_RGBA &&
+                    srcTFImg->getDataType() == GL_FLOAT) {
+                    auto srcTF = reinterpret_cast<const osg::Vec4 *>(srcTFImg->data());
+                    auto dstTF = reinterpret_cast<osg::Vec4 *>(tfImg->data()) +
+                                 static_cast<size_t>(i) * tfW;
+                    auto srcW = srcTFImg->s();
+                    for (int x = 0; x < tfW; ++x) {
+                        auto srcX = std::clamp((x + .5f) * srcW / tfW - .5f, 0.f, srcW - 1.f);
+                        auto x0 = static_cast<int>(srcX);
+                        auto x1 = std::min(x0 + 1, srcW - 1);
+                        auto t = srcX - x0;
+                        dstTF[x] = srcTF[x0] * (1.f - t) + srcTF[x1] * t;
+                    }
+                }
+
+                zOffs += srcImg->r();
+                ++i;
+            }
+
+            volTex = new osg::Texture3D;
+            volTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+            volTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+            volTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP);
+            volTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP);
+            volTex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP);
+            volTex->setInternalFormatMode(osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+            volTex->setImage(volImg);
+
+            tfTex = new osg::Texture2D;
+            tfTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+            tfTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+            tfTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP);
+            tfTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP);
+            tfTex->setInternalFormatMode(osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+            tfTex->setImage(tfImg);
+        }
+    };
+    bool isMultiVol = false;
+    std::unique_ptr<MultiVolParam> multiVol;
+
+    static bool IsFloatVolume(const osg::ref_ptr<osg::Texture3D> &volTex) {
+        auto volImg = volTex.valid() ? volTex->getImage() : nullptr;
+        return volImg && volImg->s() > 0 && volImg->t() > 0 && volImg->r() > 0 &&
+               volImg->getPixelFormat() == GL_RED && volImg->getDataType() == GL_FLOAT;
+    }
+
+    bool canMarchTogether(std::string *errMsg) const {
+        std::string err;
+        if (vols.size() > MaxVolNum)
+            err = std::format("{} volumes are more than {}", vols.size(), MaxVolNum);
+        for (auto &[name, vol] : vols)
+            if (err.empty() && vol.virtVol.valid())
+                err = std::format("Volume {} is paged from its file", name);
+            else if (err.empty() && !IsFloatVolume(vol.volTex))
+                err = std::format("Volume {} is not of GL_RED and GL_FLOAT", name);
+        if (err.empty()) {
+            // Volumes are stacked along z in the atlas
+            std::array<int, 3> atlasDim{0, 0, 0};
+            for (auto &[name, vol] : vols) {
+                auto volImg = vol.volTex->getImage();
+                atlasDim[0] = std::max(atlasDim[0], volImg->s());
+                atlasDim[1] = std::max(atlasDim[1], volImg->t());
+                atlasDim[2] += volImg->r();
+            }
+            if (std::max({atlasDim[0], atlasDim[1], atlasDim[2]}) > MaxAtlasLen)
+                err = std::format("Atlas of volumes ({},{},{}) is larger than {} on an axis",
+                                  atlasDim[0], atlasDim[1], atlasDim[2], MaxAtlasLen);
+        }
+        if (err.empty())
+            return true;
+
+        if (errMsg)
+            *errMsg = std::format("File:{} => Func:{} => Err: {}",
+                                  std::source_location::current().file_name(),
+                                  std::source_location::current().function_name(), err);
+        return false;
+    }
+
+    // Swaps the proxies under volGrp for those of the current mode
+    void updateProxies() {
+        param.volGrp->removeChildren(0, param.volGrp->getNumChildren());
+        multiVol.reset();
+        param.virtVolCallback->virtVols.clear();
+        for (auto &[name, vol] : vols)
+            if (vol.virtVol.valid())
+                param.virtVolCallback->virtVols.emplace_back(vol.virtVol);
+
+        if (isMultiVol && !vols.empty()) {
+            multiVol = std::make_unique<MultiVolParam>(vols, &param);
+            param.volGrp->addChild(multiVol->proxy);
+        } else
+            for (auto &[name, vol] : vols)
+                param.volGrp->addChild(vol.proxy);
+        resetRefinement();
+    }
+
+    // The passes refined so far no longer show what is rendered
+    void resetRefinement() {
+        if (param.refiner.valid())
+            param.refiner->Reset();
+    }
+
+    template <typename VolTy>
+    void addVolume(const std::string &name, VolTy vol, osg::ref_ptr<osg::Texture1D> tfTex,
+                   std::string *errMsg) {
+        if (auto itr = vols.find(name); itr != vols.end())
+            vols.erase(itr);
+        vols.emplace(std::piecewise_construct, std::forward_as_tuple(name),
+                     std::forward_as_tuple(vol, tfTex, &param));
+
+        if (isMultiVol && !canMarchTogether(errMsg))
+            isMultiVol = false;
+        updateProxies();
+    }
+
   public:
-    DirectVolumeRenderer() {}
+    /*
+     * Renderers given the same camState refresh it once per frame between them. A camera state
+     * of its own is created if camState is null.
+     */
+    DirectVolumeRenderer(osg::ref_ptr<CameraState> camState = nullptr) : param(camState) {}
 
     osg::Group *GetGroup() { return param.grp.get(); }
 
+    /*
+     * In multi-volume mode, a volume that cannot be marched with the others turns the mode off,
+     * which is reported in errMsg.
+     */
     void AddVolume(const std::string &name, osg::ref_ptr<osg::Texture3D> volTex,
-                   osg::ref_ptr<osg::Texture1D> tfTex) {
-        if (auto itr = vols.find(name); itr != vols.end()) {
-            param.grp->removeChild(itr->second.sphere);
-            vols.erase(itr);
+                   osg::ref_ptr<osg::Texture1D> tfTex, std::string *errMsg = nullptr) {
+        addVolume(name, volTex, tfTex, errMsg);
+    }
+    /*
+     * Adds a volume larger than the texture memory, whose bricks are paged in as the view
+     * needs them, see VirtualVolume. It cannot be marched with others in multi-volume mode, and
+     * its empty space is not skipped.
+     */
+    void AddVolume(const std::string &name, osg::ref_ptr<VirtualVolume> virtVol,
+                   osg::ref_ptr<osg::Texture1D> tfTex, std::string *errMsg = nullptr) {
+        addVolume(name, virtVol, tfTex, errMsg);
+    }
+
+    /*
+     * In multi-volume mode, all volumes are drawn by one proxy and marched together, see
+     * MultiVolParam. Volumes should be of GL_FLOAT images, as from RawConvertor, and no more
+     * than MaxVolNum. Returns false and leaves the mode as it was otherwise.
+     */
+    bool SetMultiVolume(bool isMultiVol, std::string *errMsg = nullptr) {
+        if (isMultiVol && !canMarchTogether(errMsg))
+            return false;
+
+        if (this->isMultiVol != isMultiVol) {
+            this->isMultiVol = isMultiVol;
+            updateProxies();
+        }
+        return true;
+    }
+    bool IsMultiVolume() const { return isMultiVol; }
+
+    /*
+     * Shades the volume with gradTex, as from GradientConvertor, or stops shading it if gradTex
+     * is null. Volumes are not shaded in multi-volume mode. Returns false if there is no volume
+     * of name.
+     */
+    bool SetVolumeGradient(const std::string &name, osg::ref_ptr<osg::Texture3D> gradTex) {
+        auto itr = vols.find(name);
+        if (itr == vols.end())
+            return false;
+
+        itr->second.setGradient(gradTex);
+        resetRefinement();
+        return true;
+    }
+    /*
+     * Marches the volume of name as resampled onto ECEF voxels, see ECEFVolume, which saves the
+     * trigonometry per sample for the time of resampling and up to maxVoxNum voxels of texture
+     * memory. Resampled volumes are not shaded, and are marched as they were in multi-volume
+     * mode. Returns false if there is no volume of name, or if it is not of a GL_FLOAT image.
+     */
+    bool SetVolumeECEFResampled(const std::string &name, bool isResampled,
+                                size_t maxVoxNum = DefECEFMaxVoxNum,
+                                std::string *errMsg = nullptr) {
+        std::string err;
+        auto itr = vols.find(name);
+        if (itr == vols.end())
+            err = std::format("No volume {}", name);
+        else if (itr->second.virtVol.valid() || !IsFloatVolume(itr->second.volTex))
+            err = std::format("Volume {} is not of GL_RED and GL_FLOAT", name);
+        if (!err.empty()) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), err);
+            return false;
+        }
+
+        itr->second.setECEFResampled(isResampled, maxVoxNum, &param);
+        updateProxies();
+        return true;
+    }
+
+    // Coefficients of the ambient, diffuse and specular terms and the shininess of the light
+    void SetShading(float ambient, float diffuse, float specular, float shininess) {
+        param.shading->set(osg::Vec4(ambient, diffuse, specular, shininess));
+        resetRefinement();
+    }
+    /*
+     * Scales opacities by the gradient magnitudes of shaded volumes as much as weight in [0, 1],
+     * which fades homogeneous insides and keeps boundaries.
+     */
+    void SetGradientMagnitudeOpacity(float weight) {
+        param.gradMagOpacity->set(std::clamp(weight, 0.f, 1.f));
+        resetRefinement();
+    }
+
+    /*
+     * In progressive mode, volumes are rendered at a reduced resolution while the camera moves,
+     * and refined over the frames after it stops. Volumes are then drawn over the scene, even
+     * where it is in front of them. See ProgressiveRefiner.
+     */
+    void SetProgressive(bool isProgressive) {
+        if (isProgressive == param.refiner.valid())
+            return;
+
+        if (isProgressive) {
+            param.grp->removeChild(param.volGrp);
+            param.refiner =
+                new ProgressiveRefiner(param.volGrp, param.stepInPixels, param.rayOffset);
+            param.virtVolCallback->refiner = param.refiner;
+            param.grp->addChild(param.refiner->GetGroup());
+        } else {
+            param.virtVolCallback->refiner = nullptr;
+            param.grp->removeChild(param.refiner->GetGroup());
+            param.refiner = nullptr;
+            param.grp->addChild(param.volGrp);
+            param.stepInPixels->set(StepInPixels);
+            param.rayOffset->set(0.f);
         }
-        auto opt = vols.emplace(std::piecewise_construct, std::forward_as_tuple(name),
-                                std::forward_as_tuple(volTex, tfTex, &param));
-        param.grp->addChild(opt.first->second.sphere);
     }
+    bool IsProgressive() const { return param.refiner.valid(); }
 };
 
 } // namespace ScalarViser
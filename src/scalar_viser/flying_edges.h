@@ -0,0 +1,332 @@
+#ifndef SCIVIS_SCALAR_VISER_FLYING_EDGES_H
+#define SCIVIS_SCALAR_VISER_FLYING_EDGES_H
+
+#include <algorithm>
+
+#include <array>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+#include <osg/PrimitiveSet>
+
+#include "marching_cube_classifier.h"
+#include "marching_cube_kernel.h"
+#include "marching_cube_table.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Flying Edges (Schroeder et al. 2015) over cells [cellStart, cellStart + cellDim) of a volume
+ * whose lattice point i sits at i * voxSz. It produces the triangles of TriangleTable, but
+ * interpolates every crossed edge once and shares the vertex through idxs. Normals come from
+ * central differences of the volume and face lower values, like the windings of the table.
+ *
+ * Pass 1 classifies the x-edges of every sample row and trims the row to its crossings.
+ * Pass 2 walks the trimmed cell rows, counting their y/z-edge crossings and triangles.
+ * Pass 3 turns the counts into output offsets per row.
+ * Pass 4 walks the cell rows again and writes vertices and triangles at their offsets.
+ * Passes walk the rows of the brick in order on the calling thread. Threads are spent on
+ * bricks instead, which MarchingCubeCPURenderer extracts in parallel.
+ */
+template <typename VoxTy>
+void FlyingEdgesCells(const VoxTy *volDat, const std::array<int, 3> &volDim,
+                      const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                      const osg::Vec3 &voxSz, const IsoLevel &isoLvl, SurfaceMesh &mesh) {
+    auto &classifier = MarchingCubeClassifier::Get();
+
+    auto isoVal = isoLvl.val;
+    auto nativeIsoVal = ToNativeIsoVal<VoxTy>(isoVal);
+    auto &verts = *mesh.verts;
+    auto &norms = *mesh.norms;
+    auto &levels = *mesh.levels;
+    auto &idxs = *mesh.idxs;
+
+    auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
+    auto sampleNumY = cellDim[1] + 1;
+    auto rowNum = static_cast<size_t>(cellDim[2] + 1) * sampleNumY;
+    auto rowIdx = [&](int y, int z) { return static_cast<size_t>(z) * sampleNumY + y; };
+    auto getRow = [&](int y, int z) {
+        return volDat + (cellStart[2] + z) * volDimYxX + (cellStart[1] + y) * volDim[0] +
+               cellStart[0];
+    };
+
+    struct RowMeta {
+        uint32_t xNum = 0;
+        uint32_t yNum = 0;
+        uint32_t zNum = 0;
+        uint32_t vertOffs = 0;
+        int xL;
+        int xR;
+    };
+    struct CellRowMeta {
+        uint32_t triNum = 0;
+        uint32_t triOffs = 0;
+        int xL = 0;
+        int xR = 0;
+    };
+    std::vector<RowMeta> rowMetas(rowNum);
+    std::vector<CellRowMeta> cellRowMetas(static_cast<size_t>(cellDim[2]) * cellDim[1]);
+    // Bit 0 and 1 of an x-edge case tell whether its two samples are below isoVal
+    std::vector<uint8_t> edgeCases(rowNum * cellDim[0]);
+
+    // Pass 1
+    {
+        std::vector<uint8_t> rowBits(cellDim[0] + 1);
+        for (int z = 0; z <= cellDim[2]; ++z)
+            for (int y = 0; y <= cellDim[1]; ++y) {
+                auto &meta = rowMetas[rowIdx(y, z)];
+                auto cases = edgeCases.data() + rowIdx(y, z) * cellDim[0];
+                classifier.ClassifyRow(getRow(y, z), cellDim[0] + 1, nativeIsoVal, rowBits.data());
+
+                meta.xL = cellDim[0];
+                meta.xR = 0;
+                for (int x = 0; x < cellDim[0]; ++x) {
+                    cases[x] = rowBits[x] | (rowBits[x + 1] << 1);
+                    if (rowBits[x] != rowBits[x + 1]) {
+                        ++meta.xNum;
+                        meta.xL = std::min(meta.xL, x);
+                        meta.xR = x + 1;
+                    }
+                }
+            }
+    }
+
+    static constexpr std::array<std::array<uint8_t, 2>, 12> EdgeCorners{
+        {{0, 1}, {1, 2}, {2, 3}, {3, 0}, {4, 5}, {5, 6}, {6, 7}, {7, 4}, {0, 4}, {1, 5}, {2, 6},
+         {3, 7}}};
+    auto cmptCubeIdx = [](const std::array<const uint8_t *, 4> &cases, int x) {
+        return static_cast<uint8_t>((cases[0][x] & 1) | ((cases[0][x] >> 1) << 1) |
+                                    ((cases[1][x] >> 1) << 2) | ((cases[1][x] & 1) << 3) |
+                                    ((cases[2][x] & 1) << 4) | ((cases[2][x] >> 1) << 5) |
+                                    ((cases[3][x] >> 1) << 6) | ((cases[3][x] & 1) << 7));
+    };
+    auto isCrossed = [](uint8_t cubeIdx, int edge) -> uint32_t {
+        return ((cubeIdx >> EdgeCorners[edge][0]) ^ (cubeIdx >> EdgeCorners[edge][1])) & 1;
+    };
+    auto getCellRow = [&](int y, int z) {
+        return std::array{&rowMetas[rowIdx(y, z)], &rowMetas[rowIdx(y + 1, z)],
+                          &rowMetas[rowIdx(y, z + 1)], &rowMetas[rowIdx(y + 1, z + 1)]};
+    };
+    auto getCellRowCases = [&](int y, int z) {
+        return std::array<const uint8_t *, 4>{
+            edgeCases.data() + rowIdx(y, z) * cellDim[0],
+            edgeCases.data() + rowIdx(y + 1, z) * cellDim[0],
+            edgeCases.data() + rowIdx(y, z + 1) * cellDim[0],
+            edgeCases.data() + rowIdx(y + 1, z + 1) * cellDim[0]};
+    };
+
+    // Pass 2
+    for (int z = 0; z < cellDim[2]; ++z)
+        for (int y = 0; y < cellDim[1]; ++y) {
+            auto metas = getCellRow(y, z);
+            auto cases = getCellRowCases(y, z);
+            auto &cellRowMeta = cellRowMetas[static_cast<size_t>(z) * cellDim[1] + y];
+
+            // Outside their trims the four rows keep one state each. Cells there are only
+            // crossed by y/z-edges, which happens when these states differ.
+            auto xL = cellDim[0];
+            auto xR = 0;
+            for (auto meta : metas) {
+                xL = std::min(xL, meta->xL);
+                xR = std::max(xR, meta->xR);
+            }
+            auto statesDiffer = [&](int x, int bit) {
+                auto state = (cases[0][x] >> bit) & 1;
+                for (int i = 1; i < 4; ++i)
+                    if (((cases[i][x] >> bit) & 1) != state)
+                        return true;
+                return false;
+            };
+            if (xL >= xR) {
+                if (!statesDiffer(0, 0))
+                    continue;
+                xL = 0;
+                xR = cellDim[0];
+            } else {
+                if (statesDiffer(0, 0))
+                    xL = 0;
+                if (statesDiffer(cellDim[0] - 1, 1))
+                    xR = cellDim[0];
+            }
+            cellRowMeta.xL = xL;
+            cellRowMeta.xR = xR;
+
+            // A cell row owns the y/z-edges of its first row, and those on the volume border
+            auto yLast = y == cellDim[1] - 1;
+            auto zLast = z == cellDim[2] - 1;
+            for (int x = xL; x < xR; ++x) {
+                auto cubeIdx = cmptCubeIdx(cases, x);
+                if (VertNumTable[cubeIdx] == 0)
+                    continue;
+
+                auto xLast = x == cellDim[0] - 1;
+                cellRowMeta.triNum += VertNumTable[cubeIdx] / 3;
+                metas[0]->yNum += isCrossed(cubeIdx, 3) + (xLast ? isCrossed(cubeIdx, 1) : 0);
+                metas[0]->zNum += isCrossed(cubeIdx, 8) + (xLast ? isCrossed(cubeIdx, 9) : 0);
+                if (yLast)
+                    metas[1]->zNum +=
+                        isCrossed(cubeIdx, 11) + (xLast ? isCrossed(cubeIdx, 10) : 0);
+                if (zLast)
+                    metas[2]->yNum += isCrossed(cubeIdx, 7) + (xLast ? isCrossed(cubeIdx, 5) : 0);
+            }
+        }
+
+    // Pass 3
+    auto vertOffs = static_cast<uint32_t>(verts.size());
+    for (auto &meta : rowMetas) {
+        meta.vertOffs = vertOffs;
+        vertOffs += meta.xNum + meta.yNum + meta.zNum;
+    }
+    uint32_t triOffs = 0;
+    for (auto &meta : cellRowMetas) {
+        meta.triOffs = triOffs;
+        triOffs += meta.triNum;
+    }
+    if (triOffs == 0)
+        return;
+
+    auto idxOffs = idxs.size();
+    verts.resize(vertOffs);
+    norms.resize(vertOffs);
+    levels.resize(vertOffs, isoLvl.level);
+    idxs.resize(idxOffs + 3 * triOffs);
+
+    // Pass 4
+    auto sample = [&](int x, int y, int z) {
+        return static_cast<float>(volDat[z * volDimYxX + static_cast<size_t>(y) * volDim[0] + x]);
+    };
+    auto gradient = [&](int x, int y, int z) {
+        std::array pos{x, y, z};
+        osg::Vec3 grad;
+        for (int a = 0; a < 3; ++a) {
+            auto lo = pos;
+            auto hi = pos;
+            lo[a] = std::max(pos[a] - 1, 0);
+            hi[a] = std::min(pos[a] + 1, volDim[a] - 1);
+            if (hi[a] != lo[a])
+                grad[a] = (sample(hi[0], hi[1], hi[2]) - sample(lo[0], lo[1], lo[2])) /
+                          ((hi[a] - lo[a]) * voxSz[a]);
+        }
+        return grad;
+    };
+    auto emitVert = [&](uint32_t id, int x, int y, int z, int axis) {
+        std::array p0{cellStart[0] + x, cellStart[1] + y, cellStart[2] + z};
+        auto p1 = p0;
+        ++p1[axis];
+
+        auto f0 = sample(p0[0], p0[1], p0[2]);
+        auto f1 = sample(p1[0], p1[1], p1[2]);
+        auto t = (isoVal - f0) / (f1 - f0);
+
+        osg::Vec3 pos(p0[0] * voxSz.x(), p0[1] * voxSz.y(), p0[2] * voxSz.z());
+        pos[axis] += t * voxSz[axis];
+        verts[id] = pos;
+        mesh.gridBox.expandBy(pos);
+
+        auto g0 = gradient(p0[0], p0[1], p0[2]);
+        auto g1 = gradient(p1[0], p1[1], p1[2]);
+        auto n = -(g0 + (g1 - g0) * t);
+        n.normalize();
+        norms[id] = n;
+    };
+
+    for (int z = 0; z < cellDim[2]; ++z)
+        for (int y = 0; y < cellDim[1]; ++y) {
+            auto &cellRowMeta = cellRowMetas[static_cast<size_t>(z) * cellDim[1] + y];
+            if (cellRowMeta.triNum == 0)
+                continue;
+
+            auto metas = getCellRow(y, z);
+            auto cases = getCellRowCases(y, z);
+            std::array<uint32_t, 4> xIds;
+            for (int i = 0; i < 4; ++i)
+                xIds[i] = metas[i]->vertOffs;
+            auto yIds0 = metas[0]->vertOffs + metas[0]->xNum;
+            auto yIds2 = metas[2]->vertOffs + metas[2]->xNum;
+            auto zIds0 = metas[0]->vertOffs + metas[0]->xNum + metas[0]->yNum;
+            auto zIds1 = metas[1]->vertOffs + metas[1]->xNum + metas[1]->yNum;
+            auto idxItr = idxs.begin() + idxOffs + 3 * cellRowMeta.triOffs;
+
+            auto yLast = y == cellDim[1] - 1;
+            auto zLast = z == cellDim[2] - 1;
+            for (int x = cellRowMeta.xL; x < cellRowMeta.xR; ++x) {
+                auto cubeIdx = cmptCubeIdx(cases, x);
+                if (VertNumTable[cubeIdx] == 0)
+                    continue;
+
+                std::array<uint32_t, 12> ids;
+                ids[0] = xIds[0];
+                ids[2] = xIds[1];
+                ids[4] = xIds[2];
+                ids[6] = xIds[3];
+                ids[3] = yIds0;
+                ids[1] = yIds0 + isCrossed(cubeIdx, 3);
+                ids[7] = yIds2;
+                ids[5] = yIds2 + isCrossed(cubeIdx, 7);
+                ids[8] = zIds0;
+                ids[9] = zIds0 + isCrossed(cubeIdx, 8);
+                ids[11] = zIds1;
+                ids[10] = zIds1 + isCrossed(cubeIdx, 11);
+
+                auto xLast = x == cellDim[0] - 1;
+                auto emitIfCrossed = [&](int edge, int ex, int ey, int ez, int axis) {
+                    if (isCrossed(cubeIdx, edge))
+                        emitVert(ids[edge], ex, ey, ez, axis);
+                };
+                emitIfCrossed(0, x, y, z, 0);
+                emitIfCrossed(3, x, y, z, 1);
+                emitIfCrossed(8, x, y, z, 2);
+                if (xLast) {
+                    emitIfCrossed(1, x + 1, y, z, 1);
+                    emitIfCrossed(9, x + 1, y, z, 2);
+                }
+                if (yLast) {
+                    emitIfCrossed(2, x, y + 1, z, 0);
+                    emitIfCrossed(11, x, y + 1, z, 2);
+                    if (xLast)
+                        emitIfCrossed(10, x + 1, y + 1, z, 2);
+                }
+                if (zLast) {
+                    emitIfCrossed(4, x, y, z + 1, 0);
+                    emitIfCrossed(7, x, y, z + 1, 1);
+                    if (xLast)
+                        emitIfCrossed(5, x + 1, y, z + 1, 1);
+                }
+                if (yLast && zLast)
+                    emitIfCrossed(6, x, y + 1, z + 1, 0);
+
+                for (uint32_t j = 0; j < VertNumTable[cubeIdx]; ++j)
+                    *idxItr++ = ids[TriangleTable[cubeIdx][j]];
+
+                xIds[0] += isCrossed(cubeIdx, 0);
+                xIds[1] += isCrossed(cubeIdx, 2);
+                xIds[2] += isCrossed(cubeIdx, 4);
+                xIds[3] += isCrossed(cubeIdx, 6);
+                yIds0 += isCrossed(cubeIdx, 3);
+                yIds2 += isCrossed(cubeIdx, 7);
+                zIds0 += isCrossed(cubeIdx, 8);
+                zIds1 += isCrossed(cubeIdx, 11);
+            }
+        }
+}
+
+/*
+ * Appends the surface of each of isoLvls to mesh in turn, re-running the four passes over the
+ * same rows of the brick. Edge crossings are interpolated once per isovalue, so that no vertex
+ * is shared between two surfaces.
+ */
+template <typename VoxTy>
+void FlyingEdgesCells(const VoxTy *volDat, const std::array<int, 3> &volDim,
+                      const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                      const osg::Vec3 &voxSz, const std::vector<IsoLevel> &isoLvls,
+                      SurfaceMesh &mesh) {
+    for (auto &isoLvl : isoLvls)
+        FlyingEdgesCells(volDat, volDim, cellStart, cellDim, voxSz, isoLvl, mesh);
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_FLYING_EDGES_H
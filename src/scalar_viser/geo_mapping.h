@@ -0,0 +1,104 @@
+#ifndef SCIVIS_SCALAR_VISER_GEO_MAPPING_H
+#define SCIVIS_SCALAR_VISER_GEO_MAPPING_H
+
+#include <cmath>
+#include <numbers>
+
+#include <array>
+#include <vector>
+
+#include <osg/BoundingBox>
+#include <osg/Drawable>
+
+#include "def_val.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+inline float Deg2Rad(float deg) { return deg * static_cast<float>(std::numbers::pi) / 180.f; }
+
+/*
+ * Lat/lon/height box covered by a volume, angles are in radians.
+ * Normalized grid coordinates (x, y, z) in [0, 1] map to (lon, lat, height).
+ */
+struct GeoExtent {
+    float minLongtitute = Deg2Rad(MinLongtitute);
+    float maxLongtitute = Deg2Rad(MaxLongtitute);
+    float minLatitute = Deg2Rad(MinLatitute);
+    float maxLatitute = Deg2Rad(MaxLatitute);
+    float minHeight = MinHeight;
+    float maxHeight = MaxHeight;
+
+    osg::Vec3 GridToECEF(const osg::Vec3 &grid) const {
+        auto lon = minLongtitute + grid.x() * (maxLongtitute - minLongtitute);
+        auto lat = minLatitute + grid.y() * (maxLatitute - minLatitute);
+        auto h = minHeight + grid.z() * (maxHeight - minHeight);
+        return LonLatHeightToECEF(lon, lat, h);
+    }
+
+    // Exact ECEF bounding box of the lat/lon/height box spanned by a grid-space box
+    osg::BoundingBox GridBoxToECEFBound(const osg::BoundingBox &gridBox) const {
+        osg::BoundingBox bound;
+        if (!gridBox.valid())
+            return bound;
+
+        auto lerp = [](float a, float b, float t) { return a + t * (b - a); };
+        auto halfPi = static_cast<float>(std::numbers::pi) * .5f;
+
+        // Extremes of sin/cos are either on the interval ends or on multiples of pi/2
+        auto cmptCandidates = [&](float a, float b) {
+            std::vector<float> ret{a, b};
+            for (int k = -4; k <= 4; ++k)
+                if (auto ang = k * halfPi; ang > a && ang < b)
+                    ret.emplace_back(ang);
+            return ret;
+        };
+        auto lons = cmptCandidates(lerp(minLongtitute, maxLongtitute, gridBox.xMin()),
+                                   lerp(minLongtitute, maxLongtitute, gridBox.xMax()));
+        auto lats = cmptCandidates(lerp(minLatitute, maxLatitute, gridBox.yMin()),
+                                   lerp(minLatitute, maxLatitute, gridBox.yMax()));
+        std::array hs{lerp(minHeight, maxHeight, gridBox.zMin()),
+                      lerp(minHeight, maxHeight, gridBox.zMax())};
+
+        for (auto lon : lons)
+            for (auto lat : lats)
+                for (auto h : hs)
+                    bound.expandBy(LonLatHeightToECEF(lon, lat, h));
+        return bound;
+    }
+
+    static osg::Vec3 LonLatHeightToECEF(float lon, float lat, float h) {
+        osg::Vec3 ret;
+        ret.z() = h * std::sin(lat);
+        h = h * std::cos(lat);
+        ret.y() = h * std::sin(lon);
+        ret.x() = h * std::cos(lon);
+        return ret;
+    }
+};
+
+/*
+ * Geometries emitted in normalized grid space are mapped onto the globe by shaders.
+ * Their bounds have to be mapped in the same way, otherwise OSG culls with [0, 1]^3.
+ */
+class GridToECEFBoundCallback : public osg::Drawable::ComputeBoundingBoxCallback {
+  private:
+    GeoExtent geoExt;
+    osg::BoundingBox gridBox;
+
+  public:
+    GridToECEFBoundCallback(const GeoExtent &geoExt) : geoExt(geoExt) {}
+
+    void SetGeoExtent(const GeoExtent &geoExt) { this->geoExt = geoExt; }
+    void SetGridBox(const osg::BoundingBox &gridBox) { this->gridBox = gridBox; }
+    const osg::BoundingBox &GetGridBox() const { return gridBox; }
+
+    virtual osg::BoundingBox computeBound(const osg::Drawable &) const override {
+        return geoExt.GridBoxToECEFBound(gridBox);
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_GEO_MAPPING_H
@@ -0,0 +1,99 @@
+#ifndef SCIVIS_SCALAR_VISER_GEO_PROXY_H
+#define SCIVIS_SCALAR_VISER_GEO_PROXY_H
+
+#include <algorithm>
+#include <cmath>
+
+#include <array>
+
+#include <osg/Geometry>
+
+#include "geo_mapping.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Proxy geometries covering only the lat/lon/height box of a volume, in place of spheres
+ * around the whole globe, so that fragments are shaded over the screen footprint of the
+ * volume alone. Vertices are in ECEF. Arcs are split every ProxyArcStep radians, radial edges
+ * are straight and left whole.
+ */
+inline const auto ProxyArcStep = Deg2Rad(1.f);
+
+/*
+ * Appends the face of the grid box [0, 1]^3 on which grid coordinate axis is val, wound
+ * counter-clockwise seen from the side of +axis if isFacingPos, otherwise from -axis.
+ */
+inline void AppendGeoProxyFace(const GeoExtent &geoExt, int axis, float val, bool isFacingPos,
+                               osg::Vec3Array &verts, osg::DrawElementsUInt &idxs) {
+    std::array<int, 3> segNums{
+        std::max(1, static_cast<int>(std::ceil(
+                        (geoExt.maxLongtitute - geoExt.minLongtitute) / ProxyArcStep))),
+        std::max(1, static_cast<int>(
+                        std::ceil((geoExt.maxLatitute - geoExt.minLatitute) / ProxyArcStep))),
+        1};
+    // (axis, a0, a1) is cyclic, so that a0 x a1 is +axis
+    auto a0 = (axis + 1) % 3;
+    auto a1 = (axis + 2) % 3;
+
+    auto vertStart = static_cast<GLuint>(verts.size());
+    for (int j = 0; j <= segNums[a1]; ++j)
+        for (int i = 0; i <= segNums[a0]; ++i) {
+            osg::Vec3 grid;
+            grid[axis] = val;
+            grid[a0] = static_cast<float>(i) / segNums[a0];
+            grid[a1] = static_cast<float>(j) / segNums[a1];
+            verts.push_back(geoExt.GridToECEF(grid));
+        }
+
+    // Grid to ECEF keeps the handedness, so windings carry over
+    auto rowLen = static_cast<GLuint>(segNums[a0] + 1);
+    for (int j = 0; j < segNums[a1]; ++j)
+        for (int i = 0; i < segNums[a0]; ++i) {
+            auto v00 = vertStart + j * rowLen + i;
+            auto v10 = v00 + 1;
+            auto v01 = v00 + rowLen;
+            auto v11 = v01 + 1;
+            std::array tris{v00, v10, v11, v00, v11, v01};
+            if (!isFacingPos) {
+                std::swap(tris[1], tris[2]);
+                std::swap(tris[4], tris[5]);
+            }
+            idxs.insert(idxs.end(), tris.begin(), tris.end());
+        }
+}
+
+// Closed boundary of the lat/lon/height box, facing outwards
+inline osg::ref_ptr<osg::Geometry> CreateGeoShellProxy(const GeoExtent &geoExt) {
+    osg::ref_ptr verts = new osg::Vec3Array;
+    osg::ref_ptr idxs = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+    for (int axis = 0; axis < 3; ++axis) {
+        AppendGeoProxyFace(geoExt, axis, 0.f, false, *verts, *idxs);
+        AppendGeoProxyFace(geoExt, axis, 1.f, true, *verts, *idxs);
+    }
+
+    osg::ref_ptr geom = new osg::Geometry;
+    geom->setUseVertexBufferObjects(true);
+    geom->setVertexArray(verts);
+    geom->addPrimitiveSet(idxs);
+    return geom;
+}
+
+// Lat/lon range on the normalized height h, facing up
+inline osg::ref_ptr<osg::Geometry> CreateGeoSurfaceProxy(const GeoExtent &geoExt, float h) {
+    osg::ref_ptr verts = new osg::Vec3Array;
+    osg::ref_ptr idxs = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+    AppendGeoProxyFace(geoExt, 2, h, true, *verts, *idxs);
+
+    osg::ref_ptr geom = new osg::Geometry;
+    geom->setUseVertexBufferObjects(true);
+    geom->setVertexArray(verts);
+    geom->addPrimitiveSet(idxs);
+    return geom;
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_GEO_PROXY_H
@@ -8,13 +8,14 @@
 
 #include <osg/CoordinateSystemNode>
 #include <osg/CullFace>
-#include <osg/ShapeDrawable>
+#include <osg/Geometry>
 #include <osg/Texture1D>
 #include <osg/Texture3D>
 
 #include <scivis/callback.h>
 
 #include "def_val.h"
+#include "geo_proxy.h"
 
 #include "shaders/generated/hmr_2d_frag.h"
 #include "shaders/generated/hmr_2d_vert.h"
@@ -51,18 +52,17 @@ class HeatMap3DRenderer {
         osg::ref_ptr<osg::Uniform> maxHeight;
         osg::ref_ptr<osg::Uniform> height;
 
-        osg::ref_ptr<osg::ShapeDrawable> sphere;
+        osg::ref_ptr<osg::Geometry> proxy;
         osg::ref_ptr<osg::Texture3D> volTex;
         osg::ref_ptr<osg::Texture1D> colTblTex;
 
         PerVolParam(osg::ref_ptr<osg::Texture3D> volTex, osg::ref_ptr<osg::Texture1D> colTblTex,
                     PerRendererParam *renderer)
             : volTex(volTex), colTblTex(colTblTex) {
-            sphere = new osg::ShapeDrawable(new osg::Sphere(osg::Vec3(0.f, 0.f, 0.f), MinHeight),
-                                            new osg::TessellationHints);
-            sphere->setUseVertexBufferObjects(true);
+            // Lies on the minimum height, the vertex shader lifts it to height
+            proxy = CreateGeoSurfaceProxy(GeoExtent(), 0.f);
 
-            auto states = sphere->getOrCreateStateSet();
+            auto states = proxy->getOrCreateStateSet();
             auto deg2Rad = [](float deg) {
                 return deg * static_cast<float>(std::numbers::pi) / 180.f;
             };
@@ -98,12 +98,12 @@ class HeatMap3DRenderer {
     void AddVolume(const std::string &name, osg::ref_ptr<osg::Texture3D> volTex,
                    osg::ref_ptr<osg::Texture1D> colTblTex) {
         if (auto itr = vols.find(name); itr != vols.end()) {
-            param.grp->removeChild(itr->second.sphere);
+            param.grp->removeChild(itr->second.proxy);
             vols.erase(itr);
         }
         auto opt = vols.emplace(std::piecewise_construct, std::forward_as_tuple(name),
                                 std::forward_as_tuple(volTex, colTblTex, &param));
-        param.grp->addChild(opt.first->second.sphere);
+        param.grp->addChild(opt.first->second.proxy);
     }
 };
 
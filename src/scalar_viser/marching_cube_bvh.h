@@ -0,0 +1,288 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_BVH_H
+#define SCIVIS_SCALAR_VISER_MC_BVH_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include <array>
+#include <utility>
+#include <vector>
+
+#include <osg/BoundingBox>
+
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Bounding volume hierarchy over the triangles of a SurfaceMesh for ray picking.
+ * Nodes are split by the surface area heuristic evaluated on BinNum bins of triangle
+ * centroids (Wald 2007). Triangles are copied in leaf order, so that a leaf is tested from
+ * one contiguous run of memory.
+ */
+class MeshBVH {
+  public:
+    struct Hit {
+        float t = std::numeric_limits<float>::max();
+        // Index of the triangle in the mesh, and barycentrics of its 2nd and 3rd corner
+        uint32_t tri = 0;
+        float u = 0.f;
+        float v = 0.f;
+    };
+
+  private:
+    static constexpr int BinNum = 16;
+    static constexpr uint32_t MaxLeafTriNum = 4;
+    // Bounds the traversal stack, deeper nodes are left as leaves
+    static constexpr int MaxDepth = 48;
+
+    // Children of an inner node are at first and first + 1, triNum is 0 for inner nodes
+    struct Node {
+        osg::Vec3 min;
+        osg::Vec3 max;
+        uint32_t first;
+        uint32_t triNum;
+    };
+
+    std::vector<Node> nodes;
+    std::vector<std::array<osg::Vec3, 3>> tris;
+    std::vector<uint32_t> triIds;
+
+    static float halfArea(const osg::BoundingBox &box) {
+        if (!box.valid())
+            return 0.f;
+        auto ext = box._max - box._min;
+        return ext.x() * ext.y() + ext.y() * ext.z() + ext.z() * ext.x();
+    }
+
+    static bool intersectBox(const Node &node, const osg::Vec3 &orig, const osg::Vec3 &invDir,
+                             float tMax, float &tEnter) {
+        auto t0 = 0.f;
+        auto t1 = tMax;
+        for (int a = 0; a < 3; ++a) {
+            auto tNear = (node.min[a] - orig[a]) * invDir[a];
+            auto tFar = (node.max[a] - orig[a]) * invDir[a];
+            if (tNear > tFar)
+                std::swap(tNear, tFar);
+            t0 = std::max(t0, tNear);
+            t1 = std::min(t1, tFar);
+        }
+        tEnter = t0;
+        return t0 <= t1;
+    }
+
+    // Moller-Trumbore, two-sided since surfaces are seen from both sides
+    static bool intersectTri(const std::array<osg::Vec3, 3> &tri, const osg::Vec3 &orig,
+                             const osg::Vec3 &dir, float &t, float &u, float &v) {
+        auto e1 = tri[1] - tri[0];
+        auto e2 = tri[2] - tri[0];
+        auto p = dir ^ e2;
+        auto det = e1 * p;
+        if (det == 0.f)
+            return false;
+
+        auto invDet = 1.f / det;
+        auto s = orig - tri[0];
+        u = (s * p) * invDet;
+        if (u < 0.f || u > 1.f)
+            return false;
+        auto q = s ^ e1;
+        v = (dir * q) * invDet;
+        if (v < 0.f || u + v > 1.f)
+            return false;
+        t = (e2 * q) * invDet;
+        return t >= 0.f;
+    }
+
+  public:
+    bool Empty() const { return nodes.empty(); }
+
+    void Clear() {
+        nodes.clear();
+        tris.clear();
+        triIds.clear();
+    }
+
+    osg::BoundingBox GetBound() const {
+        if (nodes.empty())
+            return osg::BoundingBox();
+        return osg::BoundingBox(nodes[0].min, nodes[0].max);
+    }
+
+    /*
+     * Builds over the triangles of mesh, whose vertices are mapped by mapVert first.
+     * Triangles are taken vertex by vertex, or from idxs if it is not empty.
+     */
+    template <typename MapFuncTy> void Build(const SurfaceMesh &mesh, MapFuncTy mapVert) {
+        Clear();
+
+        auto isIndexed = !mesh.idxs->empty();
+        auto triNum = (isIndexed ? mesh.idxs->size() : mesh.verts->size()) / 3;
+        if (triNum == 0)
+            return;
+
+        std::vector<std::array<osg::Vec3, 3>> inTris(triNum);
+        std::vector<osg::Vec3> centroids(triNum);
+        for (size_t i = 0; i < triNum; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                auto id = isIndexed ? (*mesh.idxs)[3 * i + j] : static_cast<uint32_t>(3 * i + j);
+                inTris[i][j] = mapVert((*mesh.verts)[id]);
+            }
+            centroids[i] = (inTris[i][0] + inTris[i][1] + inTris[i][2]) / 3.f;
+        }
+
+        triIds.resize(triNum);
+        for (uint32_t i = 0; i < triNum; ++i)
+            triIds[i] = i;
+
+        auto fitNode = [&](Node &node) {
+            osg::BoundingBox box;
+            for (uint32_t i = node.first; i < node.first + node.triNum; ++i)
+                for (auto &p : inTris[triIds[i]])
+                    box.expandBy(p);
+            node.min = box._min;
+            node.max = box._max;
+        };
+
+        nodes.reserve(2 * triNum);
+        nodes.push_back({{}, {}, 0, static_cast<uint32_t>(triNum)});
+        fitNode(nodes[0]);
+
+        std::vector<std::pair<uint32_t, int>> stk{{0, 0}};
+        while (!stk.empty()) {
+            auto [nodeIdx, depth] = stk.back();
+            stk.pop_back();
+            auto first = nodes[nodeIdx].first;
+            auto num = nodes[nodeIdx].triNum;
+            if (num <= MaxLeafTriNum || depth == MaxDepth)
+                continue;
+
+            osg::BoundingBox ctrBox;
+            for (uint32_t i = first; i < first + num; ++i)
+                ctrBox.expandBy(centroids[triIds[i]]);
+            auto ctrExt = ctrBox._max - ctrBox._min;
+            auto axis = ctrExt.x() >= ctrExt.y() && ctrExt.x() >= ctrExt.z() ? 0
+                        : ctrExt.y() >= ctrExt.z()                          ? 1
+                                                                            : 2;
+            if (ctrExt[axis] <= 0.f)
+                continue;
+
+            struct Bin {
+                osg::BoundingBox box;
+                uint32_t triNum = 0;
+            };
+            std::array<Bin, BinNum> bins;
+            auto binScale = BinNum / ctrExt[axis];
+            auto getBin = [&](uint32_t triId) {
+                return std::min(
+                    BinNum - 1,
+                    static_cast<int>((centroids[triId][axis] - ctrBox._min[axis]) * binScale));
+            };
+            for (uint32_t i = first; i < first + num; ++i) {
+                auto &bin = bins[getBin(triIds[i])];
+                ++bin.triNum;
+                for (auto &p : inTris[triIds[i]])
+                    bin.box.expandBy(p);
+            }
+
+            // Sweeps from the right, then from the left, to price every split between bins
+            std::array<float, BinNum - 1> rightCosts;
+            {
+                osg::BoundingBox box;
+                uint32_t cnt = 0;
+                for (int b = BinNum - 1; b > 0; --b) {
+                    box.expandBy(bins[b].box);
+                    cnt += bins[b].triNum;
+                    rightCosts[b - 1] = cnt * halfArea(box);
+                }
+            }
+            auto bestCost = std::numeric_limits<float>::max();
+            auto bestSplit = 0;
+            {
+                osg::BoundingBox box;
+                uint32_t cnt = 0;
+                for (int b = 0; b < BinNum - 1; ++b) {
+                    box.expandBy(bins[b].box);
+                    cnt += bins[b].triNum;
+                    auto cost = cnt * halfArea(box) + rightCosts[b];
+                    if (cnt != 0 && cnt != num && cost < bestCost) {
+                        bestCost = cost;
+                        bestSplit = b + 1;
+                    }
+                }
+            }
+            if (bestSplit == 0)
+                continue;
+
+            auto mid = static_cast<uint32_t>(
+                std::partition(triIds.begin() + first, triIds.begin() + first + num,
+                               [&](uint32_t triId) { return getBin(triId) < bestSplit; }) -
+                triIds.begin());
+
+            auto childIdx = static_cast<uint32_t>(nodes.size());
+            nodes.push_back({{}, {}, first, mid - first});
+            nodes.push_back({{}, {}, mid, first + num - mid});
+            fitNode(nodes[childIdx]);
+            fitNode(nodes[childIdx + 1]);
+            nodes[nodeIdx].first = childIdx;
+            nodes[nodeIdx].triNum = 0;
+            stk.emplace_back(childIdx, depth + 1);
+            stk.emplace_back(childIdx + 1, depth + 1);
+        }
+        nodes.shrink_to_fit();
+
+        tris.resize(triNum);
+        for (size_t i = 0; i < triNum; ++i)
+            tris[i] = inTris[triIds[i]];
+    }
+
+    // Keeps the nearest hit closer than hit.t, returns whether there is one
+    bool Intersect(const osg::Vec3 &orig, const osg::Vec3 &dir, Hit &hit) const {
+        if (nodes.empty())
+            return false;
+
+        osg::Vec3 invDir(1.f / dir.x(), 1.f / dir.y(), 1.f / dir.z());
+        auto isHit = false;
+        float tEnter;
+        if (!intersectBox(nodes[0], orig, invDir, hit.t, tEnter))
+            return false;
+
+        std::array<uint32_t, MaxDepth + 1> stk;
+        auto stkSz = 0;
+        stk[stkSz++] = 0;
+        while (stkSz != 0) {
+            auto &node = nodes[stk[--stkSz]];
+            if (node.triNum != 0) {
+                for (uint32_t i = node.first; i < node.first + node.triNum; ++i) {
+                    float t, u, v;
+                    if (intersectTri(tris[i], orig, dir, t, u, v) && t < hit.t) {
+                        hit = {t, triIds[i], u, v};
+                        isHit = true;
+                    }
+                }
+                continue;
+            }
+
+            // The nearer child is pushed last to be visited first
+            float t0, t1;
+            auto hit0 = intersectBox(nodes[node.first], orig, invDir, hit.t, t0);
+            auto hit1 = intersectBox(nodes[node.first + 1], orig, invDir, hit.t, t1);
+            if (hit0 && hit1) {
+                stk[stkSz++] = t0 <= t1 ? node.first + 1 : node.first;
+                stk[stkSz++] = t0 <= t1 ? node.first : node.first + 1;
+            } else if (hit0)
+                stk[stkSz++] = node.first;
+            else if (hit1)
+                stk[stkSz++] = node.first + 1;
+        }
+        return isHit;
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_BVH_H
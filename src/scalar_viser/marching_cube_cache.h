@@ -0,0 +1,242 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_CACHE_H
+#define SCIVIS_SCALAR_VISER_MC_CACHE_H
+
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+#include <array>
+#include <vector>
+
+#include <scivis/parallel.h>
+
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Identifies one extraction of a volume: its content, its layout, and how it was extracted.
+ * Meshes of the same key are the same, so they can be reused across runs.
+ */
+struct MeshCacheKey {
+    uint64_t volHash = 0;
+    std::array<int, 3> volDim;
+    uint32_t voxTySz = 0;
+    uint32_t engine = 0;
+    uint32_t lodNum = 0;
+    float decimTriRatio = 1.f;
+    float decimMaxErr = 0.f;
+    std::vector<float> isoVals;
+
+    bool operator==(const MeshCacheKey &) const = default;
+
+    uint64_t Hash() const {
+        uint64_t h = volHash;
+        auto combine = [&](uint64_t v) { h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2); };
+        for (auto d : volDim)
+            combine(static_cast<uint32_t>(d));
+        combine(voxTySz);
+        combine(engine);
+        combine(lodNum);
+        combine(std::bit_cast<uint32_t>(decimTriRatio));
+        combine(std::bit_cast<uint32_t>(decimMaxErr));
+        for (auto isoVal : isoVals)
+            combine(std::bit_cast<uint32_t>(isoVal));
+        return h;
+    }
+};
+
+constexpr uint64_t FNVOffs = 0xcbf29ce484222325ull;
+
+// FNV-1a of sz bytes, continuing from h
+inline uint64_t HashBytes(const void *dat, size_t sz, uint64_t h = FNVOffs) {
+    static constexpr uint64_t FNVPrime = 0x100000001b3ull;
+
+    auto bytes = static_cast<const uint8_t *>(dat);
+    for (size_t i = 0; i < sz; ++i) {
+        h ^= bytes[i];
+        h *= FNVPrime;
+    }
+    return h;
+}
+
+/*
+ * FNV-1a of the volume bytes. Chunks are hashed in parallel and their hashes hashed again,
+ * so that large volumes are identified in about the time of one read.
+ */
+template <typename VoxTy> uint64_t HashVolume(const std::vector<VoxTy> &volDat) {
+    static constexpr size_t ChunkSz = 1 << 20;
+
+    auto bytes = reinterpret_cast<const uint8_t *>(volDat.data());
+    auto byteNum = volDat.size() * sizeof(VoxTy);
+    std::vector<uint64_t> chunkHashes((byteNum + ChunkSz - 1) / ChunkSz);
+    ParallelFor(0, chunkHashes.size(), [&](size_t i) {
+        auto offs = i * ChunkSz;
+        chunkHashes[i] = HashBytes(bytes + offs, std::min(ChunkSz, byteNum - offs));
+    });
+    return HashBytes(chunkHashes.data(), chunkHashes.size() * sizeof(uint64_t),
+                     FNVOffs ^ byteNum);
+}
+
+/*
+ * A cache file holds all meshes of one extraction in native byte order:
+ *   magic, version, key, mesh number,
+ *   per mesh: grid box, vertex number, index number, verts, norms, levels, idxs.
+ * Arrays are stored back to back as they are laid out in memory, so loading reads them
+ * straight into the osg arrays without any parsing.
+ */
+class MeshCache {
+  private:
+    static constexpr uint32_t Magic = 0x434d5653; // "SVMC"
+    static constexpr uint32_t Version = 2;
+
+    static std::filesystem::path getPath(const std::string &dirPath, const MeshCacheKey &key) {
+        return std::filesystem::path(dirPath) / std::format("{:016x}.mcmesh", key.Hash());
+    }
+
+    template <typename Ty> static void write(std::ofstream &os, const Ty &val) {
+        os.write(reinterpret_cast<const char *>(&val), sizeof(Ty));
+    }
+    template <typename Ty> static bool read(std::ifstream &is, Ty &val) {
+        is.read(reinterpret_cast<char *>(&val), sizeof(Ty));
+        return is.good();
+    }
+    template <typename ArrTy> static void writeArray(std::ofstream &os, const ArrTy &arr) {
+        if (!arr.empty())
+            os.write(reinterpret_cast<const char *>(&arr[0]), sizeof(arr[0]) * arr.size());
+    }
+    template <typename ArrTy> static bool readArray(std::ifstream &is, ArrTy &arr, uint32_t num) {
+        arr.resize(num);
+        if (num != 0)
+            is.read(reinterpret_cast<char *>(&arr[0]), sizeof(arr[0]) * num);
+        return is.good();
+    }
+
+    static void writeKey(std::ofstream &os, const MeshCacheKey &key) {
+        write(os, key.volHash);
+        write(os, key.volDim);
+        write(os, key.voxTySz);
+        write(os, key.engine);
+        write(os, key.lodNum);
+        write(os, key.decimTriRatio);
+        write(os, key.decimMaxErr);
+        write(os, static_cast<uint32_t>(key.isoVals.size()));
+        writeArray(os, key.isoVals);
+    }
+    static bool readKey(std::ifstream &is, MeshCacheKey &key) {
+        uint32_t isoNum;
+        if (!read(is, key.volHash) || !read(is, key.volDim) || !read(is, key.voxTySz) ||
+            !read(is, key.engine) || !read(is, key.lodNum) || !read(is, key.decimTriRatio) ||
+            !read(is, key.decimMaxErr) || !read(is, isoNum))
+            return false;
+        if (isoNum > 1024)
+            return false;
+        return readArray(is, key.isoVals, isoNum);
+    }
+
+  public:
+    /*
+     * Fills meshes from the cache file of key. Returns false on a miss, or if the file does
+     * not match key and the number of meshes, in which case meshes are left empty.
+     */
+    static bool Load(const std::string &dirPath, const MeshCacheKey &key,
+                     const std::vector<SurfaceMesh *> &meshes) {
+        std::ifstream is(getPath(dirPath, key), std::ios::binary | std::ios::ate);
+        if (!is.is_open())
+            return false;
+        auto fileSz = static_cast<uint64_t>(is.tellg());
+        is.seekg(0);
+
+        auto load = [&]() {
+            uint32_t magic, version, meshNum;
+            MeshCacheKey fileKey;
+            if (!read(is, magic) || !read(is, version) || magic != Magic || version != Version)
+                return false;
+            if (!readKey(is, fileKey) || !(fileKey == key))
+                return false;
+            if (!read(is, meshNum) || meshNum != meshes.size())
+                return false;
+
+            for (auto mesh : meshes) {
+                std::array<float, 6> box;
+                uint32_t vertNum, idxNum;
+                if (!read(is, box) || !read(is, vertNum) || !read(is, idxNum))
+                    return false;
+                // Guards against allocating for a truncated or corrupted file
+                auto remained = fileSz - static_cast<uint64_t>(is.tellg());
+                if (vertNum * uint64_t(2 * sizeof(osg::Vec3) + sizeof(float)) +
+                        idxNum * uint64_t(sizeof(GLuint)) >
+                    remained)
+                    return false;
+
+                mesh->gridBox = osg::BoundingBox(box[0], box[1], box[2], box[3], box[4], box[5]);
+                if (!readArray(is, *mesh->verts, vertNum) ||
+                    !readArray(is, *mesh->norms, vertNum) ||
+                    !readArray(is, *mesh->levels, vertNum) || !readArray(is, *mesh->idxs, idxNum))
+                    return false;
+            }
+            return true;
+        };
+        if (load())
+            return true;
+
+        for (auto mesh : meshes)
+            mesh->Clear();
+        return false;
+    }
+
+    /*
+     * Writes meshes as the cache file of key. The file is written aside and renamed, so that
+     * an interrupted run never leaves a partial file behind.
+     */
+    static bool Save(const std::string &dirPath, const MeshCacheKey &key,
+                     const std::vector<const SurfaceMesh *> &meshes) {
+        std::error_code ec;
+        std::filesystem::create_directories(dirPath, ec);
+
+        auto path = getPath(dirPath, key);
+        auto tmpPath = path;
+        tmpPath += ".tmp";
+        {
+            std::ofstream os(tmpPath, std::ios::binary | std::ios::trunc);
+            if (!os.is_open())
+                return false;
+
+            write(os, Magic);
+            write(os, Version);
+            writeKey(os, key);
+            write(os, static_cast<uint32_t>(meshes.size()));
+            for (auto mesh : meshes) {
+                auto &box = mesh->gridBox;
+                write(os, std::array{box.xMin(), box.yMin(), box.zMin(), box.xMax(), box.yMax(),
+                                     box.zMax()});
+                write(os, static_cast<uint32_t>(mesh->verts->size()));
+                write(os, static_cast<uint32_t>(mesh->idxs->size()));
+                writeArray(os, *mesh->verts);
+                writeArray(os, *mesh->norms);
+                writeArray(os, *mesh->levels);
+                writeArray(os, *mesh->idxs);
+            }
+            if (!os.good())
+                return false;
+        }
+
+        std::filesystem::rename(tmpPath, path, ec);
+        if (ec) {
+            std::filesystem::remove(tmpPath, ec);
+            return false;
+        }
+        return true;
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_CACHE_H
@@ -0,0 +1,432 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_CLASSIFIER_H
+#define SCIVIS_SCALAR_VISER_MC_CLASSIFIER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SCIVIS_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// MSVC emits any intrinsic without per-function target flags, GCC/Clang need them
+#if defined(__GNUC__) || defined(__clang__)
+#define SCIVIS_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SCIVIS_TARGET(isa)
+#endif
+
+namespace SciVis {
+namespace ScalarViser {
+
+enum class SIMDLevel { Scalar, SSE4, AVX2, AVX512 };
+
+inline SIMDLevel DetectSIMDLevel() {
+#ifndef SCIVIS_X86
+    return SIMDLevel::Scalar;
+#elif defined(_MSC_VER) && !defined(__clang__)
+    int info[4];
+    __cpuid(info, 0);
+    auto maxLeaf = info[0];
+
+    __cpuid(info, 1);
+    auto sse41 = (info[2] & (1 << 19)) != 0;
+    auto osxsave = (info[2] & (1 << 27)) != 0;
+    auto xcr0 = osxsave ? _xgetbv(0) : 0;
+    auto osYMM = (xcr0 & 0x06) == 0x06;
+    auto osZMM = (xcr0 & 0xe6) == 0xe6;
+
+    auto avx2 = false;
+    auto avx512 = false;
+    if (maxLeaf >= 7) {
+        __cpuidex(info, 7, 0);
+        avx2 = (info[1] & (1 << 5)) != 0;
+        avx512 = (info[1] & (1 << 16)) != 0 && (info[1] & (1 << 30)) != 0;
+    }
+
+    if (avx512 && osZMM)
+        return SIMDLevel::AVX512;
+    if (avx2 && osYMM)
+        return SIMDLevel::AVX2;
+    if (sse41)
+        return SIMDLevel::SSE4;
+    return SIMDLevel::Scalar;
+#else
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+        return SIMDLevel::AVX512;
+    if (__builtin_cpu_supports("avx2"))
+        return SIMDLevel::AVX2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return SIMDLevel::SSE4;
+    return SIMDLevel::Scalar;
+#endif
+}
+
+/*
+ * Converts isoVal into the voxel type once, so that rows are classified without conversions.
+ * For integer types v < isoVal holds iff v < ceil(isoVal). The result is clamped to the range of
+ * the type, callers skip isovalues above the maximum voxel since they have no surface.
+ */
+template <typename VoxTy> VoxTy ToNativeIsoVal(float isoVal) {
+    if constexpr (std::is_floating_point_v<VoxTy>)
+        return static_cast<VoxTy>(isoVal);
+    else
+        return static_cast<VoxTy>(
+            std::clamp(std::ceil(isoVal), static_cast<float>(std::numeric_limits<VoxTy>::min()),
+                       static_cast<float>(std::numeric_limits<VoxTy>::max())));
+}
+
+/*
+ * Cell classification of marching cubes, done row by row.
+ * A row of samples is compared against the isovalue once (ClassifyRow, 1 if sample < isoVal).
+ * Two neighbouring rows of one slice build the 4-bit face code of each cell (CmptFaceCodes),
+ * and the face codes of two neighbouring slices build the 8-bit cube index (CmptCubeIdxs):
+ *   bits of corner 0,1,2,3 come from slice z, bits of corner 4,5,6,7 from slice z+1.
+ * So every sample is compared once and every face code is shared by the two cells it bounds.
+ * Rows are compared in their native voxel type (uint8_t, uint16_t or float), see ToNativeIsoVal.
+ */
+class MarchingCubeClassifier {
+  private:
+    template <typename VoxTy>
+    using ClassifyRowFuncTy = void (*)(const VoxTy *, int, VoxTy, uint8_t *);
+    using CombineFuncTy = void (*)(const uint8_t *, const uint8_t *, int, uint8_t *);
+
+    SIMDLevel level;
+    ClassifyRowFuncTy<uint8_t> classifyRowU8;
+    ClassifyRowFuncTy<uint16_t> classifyRowU16;
+    ClassifyRowFuncTy<float> classifyRowF32;
+    CombineFuncTy cmptFaceCodes;
+    CombineFuncTy cmptCubeIdxs;
+
+    template <typename VoxTy>
+    static void classifyRowScalar(const VoxTy *row, int num, VoxTy isoVal, uint8_t *bits) {
+        for (int i = 0; i < num; ++i)
+            bits[i] = row[i] < isoVal ? 1 : 0;
+    }
+    static void cmptFaceCodesScalar(const uint8_t *bits0, const uint8_t *bits1, int cellNum,
+                                    uint8_t *codes) {
+        for (int i = 0; i < cellNum; ++i)
+            codes[i] = bits0[i] | (bits0[i + 1] << 1) | (bits1[i + 1] << 2) | (bits1[i] << 3);
+    }
+    static void cmptCubeIdxsScalar(const uint8_t *codes0, const uint8_t *codes1, int cellNum,
+                                   uint8_t *cubeIdxs) {
+        for (int i = 0; i < cellNum; ++i)
+            cubeIdxs[i] = codes0[i] | (codes1[i] << 4);
+    }
+
+#ifdef SCIVIS_X86
+    // Shifts are done in 16-bit lanes, which is safe since no byte overflows into its neighbour.
+    // SSE4 and AVX2 lack unsigned compares, sample >= isoVal is tested as max(sample, isoVal) ==
+    // sample instead.
+
+    SCIVIS_TARGET("sse4.1")
+    static void classifyRowSSE4(const uint8_t *row, int num, uint8_t isoVal, uint8_t *bits) {
+        auto iso = _mm_set1_epi8(static_cast<char>(isoVal));
+        auto one = _mm_set1_epi8(1);
+        int i = 0;
+        for (; i + 16 <= num; i += 16) {
+            auto v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+            auto ge = _mm_cmpeq_epi8(_mm_max_epu8(v, iso), v);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(bits + i), _mm_andnot_si128(ge, one));
+        }
+        classifyRowScalar(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("sse4.1")
+    static void classifyRowSSE4(const uint16_t *row, int num, uint16_t isoVal, uint8_t *bits) {
+        auto iso = _mm_set1_epi16(static_cast<short>(isoVal));
+        auto one = _mm_set1_epi8(1);
+        int i = 0;
+        for (; i + 16 <= num; i += 16) {
+            auto v0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i + 0));
+            auto v1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i + 8));
+            auto ge0 = _mm_cmpeq_epi16(_mm_max_epu16(v0, iso), v0);
+            auto ge1 = _mm_cmpeq_epi16(_mm_max_epu16(v1, iso), v1);
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(bits + i),
+                             _mm_andnot_si128(_mm_packs_epi16(ge0, ge1), one));
+        }
+        classifyRowScalar(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("sse4.1")
+    static void classifyRowSSE4(const float *row, int num, float isoVal, uint8_t *bits) {
+        auto iso = _mm_set1_ps(isoVal);
+        auto one = _mm_set1_epi8(1);
+        int i = 0;
+        for (; i + 16 <= num; i += 16) {
+            auto m0 = _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(row + i + 0), iso));
+            auto m1 = _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(row + i + 4), iso));
+            auto m2 = _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(row + i + 8), iso));
+            auto m3 = _mm_castps_si128(_mm_cmplt_ps(_mm_loadu_ps(row + i + 12), iso));
+            auto m = _mm_packs_epi16(_mm_packs_epi32(m0, m1), _mm_packs_epi32(m2, m3));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(bits + i), _mm_and_si128(m, one));
+        }
+        classifyRowScalar(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("sse4.1")
+    static void cmptFaceCodesSSE4(const uint8_t *bits0, const uint8_t *bits1, int cellNum,
+                                  uint8_t *codes) {
+        int i = 0;
+        for (; i + 16 <= cellNum; i += 16) {
+            auto b0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits0 + i));
+            auto b1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits0 + i + 1));
+            auto b2 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits1 + i + 1));
+            auto b3 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(bits1 + i));
+            auto code = _mm_or_si128(_mm_or_si128(b0, _mm_slli_epi16(b1, 1)),
+                                     _mm_or_si128(_mm_slli_epi16(b2, 2), _mm_slli_epi16(b3, 3)));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(codes + i), code);
+        }
+        cmptFaceCodesScalar(bits0 + i, bits1 + i, cellNum - i, codes + i);
+    }
+    SCIVIS_TARGET("sse4.1")
+    static void cmptCubeIdxsSSE4(const uint8_t *codes0, const uint8_t *codes1, int cellNum,
+                                 uint8_t *cubeIdxs) {
+        int i = 0;
+        for (; i + 16 <= cellNum; i += 16) {
+            auto c0 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes0 + i));
+            auto c1 = _mm_loadu_si128(reinterpret_cast<const __m128i *>(codes1 + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(cubeIdxs + i),
+                             _mm_or_si128(c0, _mm_slli_epi16(c1, 4)));
+        }
+        cmptCubeIdxsScalar(codes0 + i, codes1 + i, cellNum - i, cubeIdxs + i);
+    }
+
+    SCIVIS_TARGET("avx2")
+    static void classifyRowAVX2(const uint8_t *row, int num, uint8_t isoVal, uint8_t *bits) {
+        auto iso = _mm256_set1_epi8(static_cast<char>(isoVal));
+        auto one = _mm256_set1_epi8(1);
+        int i = 0;
+        for (; i + 32 <= num; i += 32) {
+            auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+            auto ge = _mm256_cmpeq_epi8(_mm256_max_epu8(v, iso), v);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bits + i),
+                                _mm256_andnot_si256(ge, one));
+        }
+        classifyRowSSE4(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx2")
+    static void classifyRowAVX2(const uint16_t *row, int num, uint16_t isoVal, uint8_t *bits) {
+        auto iso = _mm256_set1_epi16(static_cast<short>(isoVal));
+        auto one = _mm256_set1_epi8(1);
+        int i = 0;
+        for (; i + 32 <= num; i += 32) {
+            auto v0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i + 0));
+            auto v1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i + 16));
+            auto ge0 = _mm256_cmpeq_epi16(_mm256_max_epu16(v0, iso), v0);
+            auto ge1 = _mm256_cmpeq_epi16(_mm256_max_epu16(v1, iso), v1);
+            // Packing works within 128-bit lanes, this restores the order of 64-bit groups
+            auto ge = _mm256_permute4x64_epi64(_mm256_packs_epi16(ge0, ge1), 0xd8);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bits + i),
+                                _mm256_andnot_si256(ge, one));
+        }
+        classifyRowSSE4(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx2")
+    static void classifyRowAVX2(const float *row, int num, float isoVal, uint8_t *bits) {
+        auto iso = _mm256_set1_ps(isoVal);
+        auto one = _mm256_set1_epi8(1);
+        // Packing works within 128-bit lanes, this restores the order of 32-bit groups
+        auto perm = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+        int i = 0;
+        for (; i + 32 <= num; i += 32) {
+            auto m0 =
+                _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(row + i + 0), iso, _CMP_LT_OQ));
+            auto m1 =
+                _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(row + i + 8), iso, _CMP_LT_OQ));
+            auto m2 =
+                _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(row + i + 16), iso, _CMP_LT_OQ));
+            auto m3 =
+                _mm256_castps_si256(_mm256_cmp_ps(_mm256_loadu_ps(row + i + 24), iso, _CMP_LT_OQ));
+            auto m = _mm256_packs_epi16(_mm256_packs_epi32(m0, m1), _mm256_packs_epi32(m2, m3));
+            m = _mm256_permutevar8x32_epi32(m, perm);
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(bits + i), _mm256_and_si256(m, one));
+        }
+        classifyRowSSE4(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx2")
+    static void cmptFaceCodesAVX2(const uint8_t *bits0, const uint8_t *bits1, int cellNum,
+                                  uint8_t *codes) {
+        int i = 0;
+        for (; i + 32 <= cellNum; i += 32) {
+            auto b0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits0 + i));
+            auto b1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits0 + i + 1));
+            auto b2 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits1 + i + 1));
+            auto b3 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(bits1 + i));
+            auto code = _mm256_or_si256(
+                _mm256_or_si256(b0, _mm256_slli_epi16(b1, 1)),
+                _mm256_or_si256(_mm256_slli_epi16(b2, 2), _mm256_slli_epi16(b3, 3)));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(codes + i), code);
+        }
+        cmptFaceCodesSSE4(bits0 + i, bits1 + i, cellNum - i, codes + i);
+    }
+    SCIVIS_TARGET("avx2")
+    static void cmptCubeIdxsAVX2(const uint8_t *codes0, const uint8_t *codes1, int cellNum,
+                                 uint8_t *cubeIdxs) {
+        int i = 0;
+        for (; i + 32 <= cellNum; i += 32) {
+            auto c0 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(codes0 + i));
+            auto c1 = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(codes1 + i));
+            _mm256_storeu_si256(reinterpret_cast<__m256i *>(cubeIdxs + i),
+                                _mm256_or_si256(c0, _mm256_slli_epi16(c1, 4)));
+        }
+        cmptCubeIdxsSSE4(codes0 + i, codes1 + i, cellNum - i, cubeIdxs + i);
+    }
+
+    SCIVIS_TARGET("avx512f,avx512bw")
+    static void classifyRowAVX512(const uint8_t *row, int num, uint8_t isoVal, uint8_t *bits) {
+        auto iso = _mm512_set1_epi8(static_cast<char>(isoVal));
+        auto one = _mm512_set1_epi8(1);
+        int i = 0;
+        for (; i + 64 <= num; i += 64) {
+            auto k = _mm512_cmplt_epu8_mask(_mm512_loadu_si512(row + i), iso);
+            _mm512_storeu_si512(bits + i, _mm512_maskz_mov_epi8(k, one));
+        }
+        classifyRowAVX2(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx512f,avx512bw")
+    static void classifyRowAVX512(const uint16_t *row, int num, uint16_t isoVal, uint8_t *bits) {
+        auto iso = _mm512_set1_epi16(static_cast<short>(isoVal));
+        auto one = _mm512_set1_epi8(1);
+        int i = 0;
+        for (; i + 64 <= num; i += 64) {
+            uint64_t k0 = _mm512_cmplt_epu16_mask(_mm512_loadu_si512(row + i + 0), iso);
+            uint64_t k1 = _mm512_cmplt_epu16_mask(_mm512_loadu_si512(row + i + 32), iso);
+            _mm512_storeu_si512(bits + i, _mm512_maskz_mov_epi8(k0 | (k1 << 32), one));
+        }
+        classifyRowAVX2(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx512f,avx512bw")
+    static void classifyRowAVX512(const float *row, int num, float isoVal, uint8_t *bits) {
+        auto iso = _mm512_set1_ps(isoVal);
+        auto one = _mm512_set1_epi8(1);
+        int i = 0;
+        for (; i + 64 <= num; i += 64) {
+            uint64_t k0 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + i + 0), iso, _CMP_LT_OQ);
+            uint64_t k1 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + i + 16), iso, _CMP_LT_OQ);
+            uint64_t k2 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + i + 32), iso, _CMP_LT_OQ);
+            uint64_t k3 = _mm512_cmp_ps_mask(_mm512_loadu_ps(row + i + 48), iso, _CMP_LT_OQ);
+            auto k = k0 | (k1 << 16) | (k2 << 32) | (k3 << 48);
+            _mm512_storeu_si512(bits + i, _mm512_maskz_mov_epi8(k, one));
+        }
+        classifyRowAVX2(row + i, num - i, isoVal, bits + i);
+    }
+    SCIVIS_TARGET("avx512f,avx512bw")
+    static void cmptFaceCodesAVX512(const uint8_t *bits0, const uint8_t *bits1, int cellNum,
+                                    uint8_t *codes) {
+        int i = 0;
+        for (; i + 64 <= cellNum; i += 64) {
+            auto b0 = _mm512_loadu_si512(bits0 + i);
+            auto b1 = _mm512_loadu_si512(bits0 + i + 1);
+            auto b2 = _mm512_loadu_si512(bits1 + i + 1);
+            auto b3 = _mm512_loadu_si512(bits1 + i);
+            auto code = _mm512_or_si512(
+                _mm512_or_si512(b0, _mm512_slli_epi16(b1, 1)),
+                _mm512_or_si512(_mm512_slli_epi16(b2, 2), _mm512_slli_epi16(b3, 3)));
+            _mm512_storeu_si512(codes + i, code);
+        }
+        cmptFaceCodesAVX2(bits0 + i, bits1 + i, cellNum - i, codes + i);
+    }
+    SCIVIS_TARGET("avx512f,avx512bw")
+    static void cmptCubeIdxsAVX512(const uint8_t *codes0, const uint8_t *codes1, int cellNum,
+                                   uint8_t *cubeIdxs) {
+        int i = 0;
+        for (; i + 64 <= cellNum; i += 64) {
+            auto c0 = _mm512_loadu_si512(codes0 + i);
+            auto c1 = _mm512_loadu_si512(codes1 + i);
+            _mm512_storeu_si512(cubeIdxs + i, _mm512_or_si512(c0, _mm512_slli_epi16(c1, 4)));
+        }
+        cmptCubeIdxsAVX2(codes0 + i, codes1 + i, cellNum - i, cubeIdxs + i);
+    }
+#endif // SCIVIS_X86
+
+    template <typename VoxTy> void setClassifyRow() {
+        ClassifyRowFuncTy<VoxTy> f = classifyRowScalar<VoxTy>;
+#ifdef SCIVIS_X86
+        switch (level) {
+        case SIMDLevel::AVX512:
+            f = classifyRowAVX512;
+            break;
+        case SIMDLevel::AVX2:
+            f = classifyRowAVX2;
+            break;
+        case SIMDLevel::SSE4:
+            f = classifyRowSSE4;
+            break;
+        default:
+            break;
+        }
+#endif
+        if constexpr (std::is_same_v<VoxTy, uint8_t>)
+            classifyRowU8 = f;
+        else if constexpr (std::is_same_v<VoxTy, uint16_t>)
+            classifyRowU16 = f;
+        else
+            classifyRowF32 = f;
+    }
+
+    MarchingCubeClassifier(SIMDLevel level) : level(level) {
+        setClassifyRow<uint8_t>();
+        setClassifyRow<uint16_t>();
+        setClassifyRow<float>();
+        cmptFaceCodes = cmptFaceCodesScalar;
+        cmptCubeIdxs = cmptCubeIdxsScalar;
+#ifdef SCIVIS_X86
+        switch (level) {
+        case SIMDLevel::AVX512:
+            cmptFaceCodes = cmptFaceCodesAVX512;
+            cmptCubeIdxs = cmptCubeIdxsAVX512;
+            break;
+        case SIMDLevel::AVX2:
+            cmptFaceCodes = cmptFaceCodesAVX2;
+            cmptCubeIdxs = cmptCubeIdxsAVX2;
+            break;
+        case SIMDLevel::SSE4:
+            cmptFaceCodes = cmptFaceCodesSSE4;
+            cmptCubeIdxs = cmptCubeIdxsSSE4;
+            break;
+        default:
+            break;
+        }
+#endif
+    }
+
+  public:
+    static const MarchingCubeClassifier &Get() {
+        static const MarchingCubeClassifier classifier(DetectSIMDLevel());
+        return classifier;
+    }
+
+    SIMDLevel GetSIMDLevel() const { return level; }
+
+    template <typename VoxTy>
+    void ClassifyRow(const VoxTy *row, int num, VoxTy isoVal, uint8_t *bits) const {
+        if constexpr (std::is_same_v<VoxTy, uint8_t>)
+            classifyRowU8(row, num, isoVal, bits);
+        else if constexpr (std::is_same_v<VoxTy, uint16_t>)
+            classifyRowU16(row, num, isoVal, bits);
+        else {
+            static_assert(std::is_same_v<VoxTy, float>, "Voxel type is not supported");
+            classifyRowF32(row, num, isoVal, bits);
+        }
+    }
+    // bits0 and bits1 hold cellNum + 1 entries
+    void CmptFaceCodes(const uint8_t *bits0, const uint8_t *bits1, int cellNum,
+                       uint8_t *codes) const {
+        cmptFaceCodes(bits0, bits1, cellNum, codes);
+    }
+    void CmptCubeIdxs(const uint8_t *codes0, const uint8_t *codes1, int cellNum,
+                      uint8_t *cubeIdxs) const {
+        cmptCubeIdxs(codes0, codes1, cellNum, cubeIdxs);
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_CLASSIFIER_H
@@ -0,0 +1,358 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_DECIMATOR_H
+#define SCIVIS_SCALAR_VISER_MC_DECIMATOR_H
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+
+#include <array>
+#include <unordered_map>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Symmetric 4x4 quadric of Garland and Heckbert, storing the upper triangle of the matrix
+ * and the total weight of its planes
+ */
+struct Quadric {
+    std::array<double, 10> a{};
+    double w = 0.;
+
+    static Quadric FromPlane(double nx, double ny, double nz, double d, double w) {
+        Quadric q;
+        q.a = {w * nx * nx, w * nx * ny, w * nx * nz, w * nx * d, w * ny * ny,
+               w * ny * nz, w * ny * d,  w * nz * nz, w * nz * d, w * d * d};
+        q.w = w;
+        return q;
+    }
+
+    Quadric &operator+=(const Quadric &other) {
+        for (int i = 0; i < 10; ++i)
+            a[i] += other.a[i];
+        w += other.w;
+        return *this;
+    }
+    Quadric operator+(const Quadric &other) const {
+        auto q = *this;
+        return q += other;
+    }
+
+    double Evaluate(const osg::Vec3d &p) const {
+        auto x = p.x(), y = p.y(), z = p.z();
+        return a[0] * x * x + 2. * a[1] * x * y + 2. * a[2] * x * z + 2. * a[3] * x +
+               a[4] * y * y + 2. * a[5] * y * z + 2. * a[6] * y + a[7] * z * z + 2. * a[8] * z +
+               a[9];
+    }
+
+    // Position of the least error, if the quadric is not (nearly) singular
+    bool Optimize(osg::Vec3d &p) const {
+        // Cramer's rule on the symmetric 3x3 part, with columns c0, c1, c2
+        osg::Vec3d c0(a[0], a[1], a[2]), c1(a[1], a[4], a[5]), c2(a[2], a[5], a[7]);
+        osg::Vec3d rhs(-a[3], -a[6], -a[8]);
+        auto det = c0 * (c1 ^ c2);
+        auto scale = a[0] + a[4] + a[7];
+        if (std::abs(det) <= 1e-9 * scale * scale * scale)
+            return false;
+
+        p.set(rhs * (c1 ^ c2) / det, c0 * (rhs ^ c2) / det, c0 * (c1 ^ rhs) / det);
+        return true;
+    }
+};
+
+/*
+ * Simplifies a mesh by quadric error edge collapses (Garland and Heckbert 1997) until
+ * triRatio of its triangles are left or the next collapse would move the surface by more
+ * than maxErr voxels, measured as the area weighted RMS distance to the planes merged into a
+ * vertex. Errors are measured in voxels, so anisotropic grids decimate evenly.
+ *
+ * Vertices on the faces of lockBox, the cells of the brick, are never moved, so the contours
+ * a brick shares with its neighbours stay intact. So are vertices of open edges, where the
+ * surface leaves the volume, and of non-manifold edges, where it pinches through a sample
+ * equal to the isovalue.
+ * Triangle lists are welded by exact position, which relies on neighbouring cells
+ * interpolating shared edges alike. They are written back as flat shaded lists, indexed
+ * meshes stay indexed and keep their vertex normals.
+ */
+inline void DecimateMesh(SurfaceMesh &mesh, const osg::BoundingBox &lockBox,
+                         const osg::Vec3 &voxSz, float triRatio, float maxErr) {
+    auto isIndexed = !mesh.idxs->empty();
+    auto inIdxNum = isIndexed ? mesh.idxs->size() : mesh.verts->size();
+    auto inTriNum = inIdxNum / 3;
+    auto tgtTriNum = static_cast<size_t>(inTriNum * std::clamp(triRatio, 0.f, 1.f));
+    if (inTriNum == 0 || tgtTriNum >= inTriNum)
+        return;
+
+    // Weld by the bits of position and level, which also keeps nested surfaces apart
+    struct VertKey {
+        std::array<uint32_t, 4> bits;
+        bool operator==(const VertKey &) const = default;
+    };
+    struct VertKeyHash {
+        size_t operator()(const VertKey &key) const {
+            uint64_t h = 0xcbf29ce484222325ull;
+            for (auto b : key.bits)
+                h = (h ^ b) * 0x100000001b3ull;
+            return static_cast<size_t>(h);
+        }
+    };
+    std::unordered_map<VertKey, uint32_t, VertKeyHash> weldedIds;
+
+    std::vector<osg::Vec3d> poses;
+    std::vector<osg::Vec3> norms;
+    std::vector<float> levels;
+    std::vector<std::array<uint32_t, 3>> tris(inTriNum);
+    for (size_t i = 0; i < inIdxNum; ++i) {
+        auto inId = isIndexed ? (*mesh.idxs)[i] : static_cast<uint32_t>(i);
+        auto &p = (*mesh.verts)[inId];
+        auto level = (*mesh.levels)[inId];
+        VertKey key{{std::bit_cast<uint32_t>(p.x()), std::bit_cast<uint32_t>(p.y()),
+                     std::bit_cast<uint32_t>(p.z()), std::bit_cast<uint32_t>(level)}};
+        auto [itr, isNew] = weldedIds.emplace(key, static_cast<uint32_t>(poses.size()));
+        if (isNew) {
+            poses.emplace_back(p.x() / voxSz.x(), p.y() / voxSz.y(), p.z() / voxSz.z());
+            norms.emplace_back((*mesh.norms)[inId]);
+            levels.emplace_back(level);
+        }
+        tris[i / 3][i % 3] = itr->second;
+    }
+    weldedIds.clear();
+
+    auto vertNum = poses.size();
+    std::vector<std::vector<uint32_t>> vertTris(vertNum);
+    std::vector<uint8_t> triAlive(inTriNum, 1);
+    size_t triNum = inTriNum;
+    auto triNormal = [&](const std::array<uint32_t, 3> &tri) {
+        return (poses[tri[1]] - poses[tri[0]]) ^ (poses[tri[2]] - poses[tri[0]]);
+    };
+    for (uint32_t t = 0; t < inTriNum; ++t) {
+        auto &tri = tris[t];
+        // Triangles with a repeated corner cover nothing. Slivers are kept, they would open
+        // the surface
+        if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+            triAlive[t] = 0;
+            --triNum;
+            continue;
+        }
+        for (auto v : tri)
+            vertTris[v].emplace_back(t);
+    }
+
+    // Plane quadrics weighted by triangle area
+    std::vector<Quadric> quadrics(vertNum);
+    for (uint32_t t = 0; t < inTriNum; ++t) {
+        if (!triAlive[t])
+            continue;
+        auto &tri = tris[t];
+        auto n = triNormal(tri);
+        auto area2 = n.length();
+        if (area2 == 0.)
+            continue;
+        n = n / area2;
+        auto q = Quadric::FromPlane(n.x(), n.y(), n.z(), -(n * poses[tri[0]]), .5 * area2);
+        for (auto v : tri)
+            quadrics[v] += q;
+    }
+
+    std::vector<uint8_t> locked(vertNum, 0);
+    {
+        osg::Vec3d lockMin(lockBox.xMin() / voxSz.x(), lockBox.yMin() / voxSz.y(),
+                           lockBox.zMin() / voxSz.z());
+        osg::Vec3d lockMax(lockBox.xMax() / voxSz.x(), lockBox.yMax() / voxSz.y(),
+                           lockBox.zMax() / voxSz.z());
+        for (size_t v = 0; v < vertNum; ++v)
+            for (int a = 0; a < 3; ++a)
+                if (std::abs(poses[v][a] - lockMin[a]) < 1e-3 ||
+                    std::abs(poses[v][a] - lockMax[a]) < 1e-3)
+                    locked[v] = 1;
+
+        // An edge is open if used by a single triangle, and non-manifold if by more than two
+        std::unordered_map<uint64_t, uint32_t> edgeUses;
+        auto edgeKey = [](uint32_t v0, uint32_t v1) {
+            return (static_cast<uint64_t>(std::min(v0, v1)) << 32) | std::max(v0, v1);
+        };
+        for (uint32_t t = 0; t < inTriNum; ++t)
+            if (triAlive[t])
+                for (int i = 0; i < 3; ++i)
+                    ++edgeUses[edgeKey(tris[t][i], tris[t][(i + 1) % 3])];
+        for (auto [key, useNum] : edgeUses)
+            if (useNum != 2) {
+                locked[key >> 32] = 1;
+                locked[key & 0xffffffff] = 1;
+            }
+    }
+
+    struct Collapse {
+        double cost;
+        uint32_t v0;
+        uint32_t v1;
+        uint32_t ver0;
+        uint32_t ver1;
+        osg::Vec3d tgt;
+
+        bool operator<(const Collapse &other) const { return cost > other.cost; }
+    };
+    std::priority_queue<Collapse> collapses;
+    std::vector<uint32_t> versions(vertNum, 0);
+    std::vector<uint8_t> removed(vertNum, 0);
+
+    auto maxCost = static_cast<double>(maxErr) * maxErr;
+    auto pushCollapse = [&](uint32_t v0, uint32_t v1) {
+        if (locked[v0] && locked[v1])
+            return;
+        if (locked[v1])
+            std::swap(v0, v1);
+
+        auto q = quadrics[v0] + quadrics[v1];
+        Collapse c{0., v0, v1, versions[v0], versions[v1], poses[v0]};
+        if (!locked[v0] && !q.Optimize(c.tgt)) {
+            auto mid = (poses[v0] + poses[v1]) * .5;
+            c.tgt = poses[v0];
+            for (auto &p : {poses[v1], mid})
+                if (q.Evaluate(p) < q.Evaluate(c.tgt))
+                    c.tgt = p;
+        }
+        c.cost = q.w > 0. ? std::max(0., q.Evaluate(c.tgt)) / q.w : 0.;
+        if (c.cost <= maxCost)
+            collapses.push(c);
+    };
+    for (uint32_t t = 0; t < inTriNum; ++t)
+        if (triAlive[t])
+            for (int i = 0; i < 3; ++i)
+                if (tris[t][i] < tris[t][(i + 1) % 3])
+                    pushCollapse(tris[t][i], tris[t][(i + 1) % 3]);
+
+    std::vector<uint32_t> nbrs0, nbrs1;
+    auto collectNbrs = [&](uint32_t v, std::vector<uint32_t> &nbrs) {
+        nbrs.clear();
+        for (auto t : vertTris[v])
+            for (auto u : tris[t])
+                if (u != v)
+                    nbrs.emplace_back(u);
+        std::sort(nbrs.begin(), nbrs.end());
+        nbrs.erase(std::unique(nbrs.begin(), nbrs.end()), nbrs.end());
+    };
+    // Rejects a collapse that flips or degenerates a remaining triangle around v
+    auto keepsOrientation = [&](uint32_t v, uint32_t other, const osg::Vec3d &tgt) {
+        for (auto t : vertTris[v]) {
+            auto &tri = tris[t];
+            if (std::find(tri.begin(), tri.end(), other) != tri.end())
+                continue;
+
+            auto before = triNormal(tri);
+            auto oldPos = poses[v];
+            poses[v] = tgt;
+            auto after = triNormal(tri);
+            poses[v] = oldPos;
+            if (after.length2() <= 1e-12 * before.length2() ||
+                before * after <= .2 * before.length() * after.length())
+                return false;
+        }
+        return true;
+    };
+
+    while (triNum > tgtTriNum && !collapses.empty()) {
+        auto c = collapses.top();
+        collapses.pop();
+        if (removed[c.v0] || removed[c.v1] || versions[c.v0] != c.ver0 ||
+            versions[c.v1] != c.ver1)
+            continue;
+
+        // Link condition: the two vertices may only share the opposite corners of their edge
+        collectNbrs(c.v0, nbrs0);
+        collectNbrs(c.v1, nbrs1);
+        size_t sharedNum = 0;
+        for (auto u : nbrs0)
+            if (std::binary_search(nbrs1.begin(), nbrs1.end(), u))
+                ++sharedNum;
+        size_t edgeTriNum = 0;
+        for (auto t : vertTris[c.v0])
+            if (std::find(tris[t].begin(), tris[t].end(), c.v1) != tris[t].end())
+                ++edgeTriNum;
+        if (edgeTriNum == 0 || sharedNum != edgeTriNum)
+            continue;
+
+        if (!keepsOrientation(c.v0, c.v1, c.tgt) || !keepsOrientation(c.v1, c.v0, c.tgt))
+            continue;
+
+        std::vector<uint32_t> keptTris;
+        for (auto t : vertTris[c.v0])
+            if (std::find(tris[t].begin(), tris[t].end(), c.v1) != tris[t].end()) {
+                triAlive[t] = 0;
+                --triNum;
+            } else
+                keptTris.emplace_back(t);
+        for (auto t : vertTris[c.v1]) {
+            if (!triAlive[t])
+                continue;
+            for (auto &u : tris[t])
+                if (u == c.v1)
+                    u = c.v0;
+            keptTris.emplace_back(t);
+        }
+        // Triangles of both ends lose the collapsed one from their third corner's list
+        for (auto u : nbrs0)
+            std::erase_if(vertTris[u], [&](uint32_t t) { return !triAlive[t]; });
+        vertTris[c.v0] = std::move(keptTris);
+        vertTris[c.v1].clear();
+
+        if (c.tgt != poses[c.v0]) {
+            norms[c.v0] = c.tgt == poses[c.v1] ? norms[c.v1] : norms[c.v0] + norms[c.v1];
+            norms[c.v0].normalize();
+        }
+        poses[c.v0] = c.tgt;
+        quadrics[c.v0] += quadrics[c.v1];
+        removed[c.v1] = 1;
+        ++versions[c.v0];
+
+        collectNbrs(c.v0, nbrs0);
+        for (auto u : nbrs0)
+            pushCollapse(c.v0, u);
+    }
+
+    auto toGrid = [&](const osg::Vec3d &p) {
+        return osg::Vec3(p.x() * voxSz.x(), p.y() * voxSz.y(), p.z() * voxSz.z());
+    };
+    mesh.Clear();
+    if (!isIndexed) {
+        mesh.verts->reserve(3 * triNum);
+        mesh.norms->reserve(3 * triNum);
+        mesh.levels->reserve(3 * triNum);
+        for (uint32_t t = 0; t < inTriNum; ++t)
+            if (triAlive[t])
+                AppendTriangle(toGrid(poses[tris[t][0]]), toGrid(poses[tris[t][1]]),
+                               toGrid(poses[tris[t][2]]), levels[tris[t][0]], mesh);
+        return;
+    }
+
+    std::vector<uint32_t> outIds(vertNum, UINT32_MAX);
+    mesh.idxs->reserve(3 * triNum);
+    for (uint32_t t = 0; t < inTriNum; ++t) {
+        if (!triAlive[t])
+            continue;
+        for (auto v : tris[t]) {
+            if (outIds[v] == UINT32_MAX) {
+                outIds[v] = static_cast<uint32_t>(mesh.verts->size());
+                auto p = toGrid(poses[v]);
+                mesh.verts->push_back(p);
+                mesh.norms->push_back(norms[v]);
+                mesh.levels->push_back(levels[v]);
+                mesh.gridBox.expandBy(p);
+            }
+            mesh.idxs->push_back(outIds[v]);
+        }
+    }
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_DECIMATOR_H
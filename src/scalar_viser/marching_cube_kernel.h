@@ -0,0 +1,242 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_KERNEL_H
+#define SCIVIS_SCALAR_VISER_MC_KERNEL_H
+
+#include <numeric>
+
+#include <array>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+#include <osg/PrimitiveSet>
+
+#include "marching_cube_classifier.h"
+#include "marching_cube_table.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+// An isovalue to extract, and the level its vertices are tagged with
+struct IsoLevel {
+    float val;
+    float level;
+};
+
+/*
+ * Output of the extraction kernels in normalized grid space.
+ * Triangles are listed vertex by vertex, unless idxs is not empty.
+ */
+struct SurfaceMesh {
+    osg::ref_ptr<osg::Vec3Array> verts;
+    osg::ref_ptr<osg::Vec3Array> norms;
+    osg::ref_ptr<osg::FloatArray> levels;
+    osg::ref_ptr<osg::DrawElementsUInt> idxs;
+    osg::BoundingBox gridBox;
+
+    SurfaceMesh() {
+        verts = new osg::Vec3Array;
+        norms = new osg::Vec3Array;
+        levels = new osg::FloatArray;
+        idxs = new osg::DrawElementsUInt(osg::PrimitiveSet::TRIANGLES);
+    }
+
+    void Clear() {
+        verts->clear();
+        norms->clear();
+        levels->clear();
+        idxs->clear();
+        gridBox.init();
+    }
+};
+
+// Appends a triangle with its flat normal
+inline void AppendTriangle(const osg::Vec3 &p0, const osg::Vec3 &p1, const osg::Vec3 &p2,
+                           float level, SurfaceMesh &mesh) {
+    mesh.verts->push_back(p0);
+    mesh.verts->push_back(p1);
+    mesh.verts->push_back(p2);
+    mesh.gridBox.expandBy(p0);
+    mesh.gridBox.expandBy(p1);
+    mesh.gridBox.expandBy(p2);
+
+    auto n = (p1 - p0) ^ (p2 - p0);
+    n.normalize();
+    mesh.norms->push_back(n);
+    mesh.norms->push_back(n);
+    mesh.norms->push_back(n);
+    mesh.levels->push_back(level);
+    mesh.levels->push_back(level);
+    mesh.levels->push_back(level);
+}
+
+/*
+ * Classic marching cubes over cells [cellStart, cellStart + cellDim) of a volume.
+ * The position of lattice point i on axis a is coords[a][i - cellStart[a]],
+ * which lets the same kernel march coarse or squeezed lattices.
+ * All isovalues are extracted in one sweep: rows are classified against each of them while
+ * they are in cache, and the corners of a cell are loaded once for all of them.
+ * Scratch memory is bound by a slice: two slices of face codes, one row of cube indices per
+ * isovalue, and one vertex number per slice.
+ * Rows are classified in the native voxel type, only corners of cut cells are read as float.
+ */
+template <typename VoxTy>
+void MarchCells(const VoxTy *volDat, const std::array<int, 3> &volDim,
+                const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                const std::array<std::vector<float>, 3> &coords,
+                const std::vector<IsoLevel> &isoLvls, SurfaceMesh &mesh) {
+    auto &classifier = MarchingCubeClassifier::Get();
+
+    auto isoNum = isoLvls.size();
+    auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
+    auto cellDimYxX = static_cast<size_t>(cellDim[1]) * cellDim[0];
+    auto sampleNumX = cellDim[0] + 1;
+
+    std::vector<std::array<std::vector<uint8_t>, 2>> rowBits(isoNum);
+    std::vector<std::array<std::vector<uint8_t>, 2>> sliceCodes(isoNum);
+    std::vector<std::vector<uint8_t>> cubeIdxs(isoNum);
+    std::vector<VoxTy> nativeIsoVals(isoNum);
+    for (size_t i = 0; i < isoNum; ++i) {
+        nativeIsoVals[i] = ToNativeIsoVal<VoxTy>(isoLvls[i].val);
+        rowBits[i][0].resize(sampleNumX);
+        rowBits[i][1].resize(sampleNumX);
+        sliceCodes[i][0].resize(cellDimYxX);
+        sliceCodes[i][1].resize(cellDimYxX);
+        cubeIdxs[i].resize(cellDim[0]);
+    }
+
+    auto getRow = [&](int y, int z) {
+        return volDat + (cellStart[2] + z) * volDimYxX + (cellStart[1] + y) * volDim[0] +
+               cellStart[0];
+    };
+    auto classifySlice = [&](int z, int slot) {
+        for (int y = 0; y <= cellDim[1]; ++y) {
+            auto row = getRow(y, z);
+            for (size_t i = 0; i < isoNum; ++i) {
+                auto &bits0 = rowBits[i][(y + 1) & 1];
+                auto &bits1 = rowBits[i][y & 1];
+                classifier.ClassifyRow(row, sampleNumX, nativeIsoVals[i], bits1.data());
+                if (y != 0)
+                    classifier.CmptFaceCodes(bits0.data(), bits1.data(), cellDim[0],
+                                             sliceCodes[i][slot].data() + (y - 1) * cellDim[0]);
+            }
+        }
+    };
+    // Slices of samples are classified only if a slice of cells on either side of them is needed
+    auto forEachCellRow = [&](auto f, auto isSliceNeeded) {
+        if (isSliceNeeded(0))
+            classifySlice(0, 0);
+        for (int z = 0; z < cellDim[2]; ++z) {
+            if (isSliceNeeded(z) || (z + 1 < cellDim[2] && isSliceNeeded(z + 1)))
+                classifySlice(z + 1, (z + 1) & 1);
+            if (!isSliceNeeded(z))
+                continue;
+            for (int y = 0; y < cellDim[1]; ++y) {
+                for (size_t i = 0; i < isoNum; ++i)
+                    classifier.CmptCubeIdxs(sliceCodes[i][z & 1].data() + y * cellDim[0],
+                                            sliceCodes[i][(z + 1) & 1].data() + y * cellDim[0],
+                                            cellDim[0], cubeIdxs[i].data());
+                f(y, z);
+            }
+        }
+    };
+
+    std::vector<uint32_t> sliceVertNums(cellDim[2], 0);
+    forEachCellRow(
+        [&](int, int z) {
+            for (auto &isoCubeIdxs : cubeIdxs)
+                for (int x = 0; x < cellDim[0]; ++x)
+                    sliceVertNums[z] += VertNumTable[isoCubeIdxs[x]];
+        },
+        [](int) { return true; });
+
+    auto vertNum = std::accumulate(sliceVertNums.begin(), sliceVertNums.end(), size_t(0));
+    if (vertNum == 0)
+        return;
+    mesh.verts->reserve(mesh.verts->size() + vertNum);
+    mesh.norms->reserve(mesh.norms->size() + vertNum);
+    mesh.levels->reserve(mesh.levels->size() + vertNum);
+
+    forEachCellRow(
+        [&](int y, int z) {
+            auto row = getRow(y, z);
+            for (int x = 0; x < cellDim[0]; ++x) {
+                auto cellVertNum = 0u;
+                for (auto &isoCubeIdxs : cubeIdxs)
+                    cellVertNum += VertNumTable[isoCubeIdxs[x]];
+                if (cellVertNum == 0)
+                    continue;
+
+                std::array<osg::Vec3, 8> v;
+                {
+                    auto x0 = coords[0][x], x1 = coords[0][x + 1];
+                    auto y0 = coords[1][y], y1 = coords[1][y + 1];
+                    auto z0 = coords[2][z], z1 = coords[2][z + 1];
+                    v[0].set(x0, y0, z0);
+                    v[1].set(x1, y0, z0);
+                    v[2].set(x1, y1, z0);
+                    v[3].set(x0, y1, z0);
+                    v[4].set(x0, y0, z1);
+                    v[5].set(x1, y0, z1);
+                    v[6].set(x1, y1, z1);
+                    v[7].set(x0, y1, z1);
+                }
+                std::array<float, 8> field;
+                {
+                    auto p = row + x;
+                    field[0] = p[0];
+                    field[1] = p[1];
+                    field[2] = p[volDim[0] + 1];
+                    field[3] = p[volDim[0]];
+                    p += volDimYxX;
+                    field[4] = p[0];
+                    field[5] = p[1];
+                    field[6] = p[volDim[0] + 1];
+                    field[7] = p[volDim[0]];
+                }
+
+                for (size_t i = 0; i < isoNum; ++i) {
+                    auto cubeIdx = cubeIdxs[i][x];
+                    if (VertNumTable[cubeIdx] == 0)
+                        continue;
+
+                    auto isoVal = isoLvls[i].val;
+                    // Edges are interpolated from their lower corner, so that the cells sharing
+                    // an edge produce the same vertex bit by bit
+                    std::array<osg::Vec3, 12> vertList;
+                    auto vertInterp = [&](const osg::Vec3 &p0, const osg::Vec3 &p1, float f0,
+                                          float f1) {
+                        float t = (isoVal - f0) / (f1 - f0);
+                        auto dlt = p1 - p0;
+                        return osg::Vec3(p0.x() + t * dlt.x(), p0.y() + t * dlt.y(),
+                                         p0.z() + t * dlt.z());
+                    };
+                    vertList[0] = vertInterp(v[0], v[1], field[0], field[1]);
+                    vertList[1] = vertInterp(v[1], v[2], field[1], field[2]);
+                    vertList[2] = vertInterp(v[3], v[2], field[3], field[2]);
+                    vertList[3] = vertInterp(v[0], v[3], field[0], field[3]);
+
+                    vertList[4] = vertInterp(v[4], v[5], field[4], field[5]);
+                    vertList[5] = vertInterp(v[5], v[6], field[5], field[6]);
+                    vertList[6] = vertInterp(v[7], v[6], field[7], field[6]);
+                    vertList[7] = vertInterp(v[4], v[7], field[4], field[7]);
+
+                    vertList[8] = vertInterp(v[0], v[4], field[0], field[4]);
+                    vertList[9] = vertInterp(v[1], v[5], field[1], field[5]);
+                    vertList[10] = vertInterp(v[2], v[6], field[2], field[6]);
+                    vertList[11] = vertInterp(v[3], v[7], field[3], field[7]);
+
+                    for (uint32_t j = 0; j < VertNumTable[cubeIdx]; j += 3)
+                        AppendTriangle(vertList[TriangleTable[cubeIdx][j]],
+                                       vertList[TriangleTable[cubeIdx][j + 1]],
+                                       vertList[TriangleTable[cubeIdx][j + 2]], isoLvls[i].level,
+                                       mesh);
+                }
+            }
+        },
+        [&](int z) { return sliceVertNums[z] != 0; });
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_KERNEL_H
@@ -0,0 +1,381 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_LOD_H
+#define SCIVIS_SCALAR_VISER_MC_LOD_H
+
+#include <algorithm>
+#include <limits>
+#include <type_traits>
+
+#include <array>
+#include <map>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+
+#include <scivis/parallel.h>
+
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Computes samples [coarseMin, coarseMax] of a volume at half the resolution of fineDat,
+ * leaving the others of coarseDat as they are. Coarse sample i sits on fine sample
+ * min(2i, dim - 1) and is filtered by a [1/4, 1/2, 1/4] tent per axis, so every level of the
+ * pyramid stays aligned with the lattice of the full resolution volume. Axes are filtered one
+ * after another over the fine samples the region reads, so that any region gives the same
+ * samples as the whole volume.
+ * Levels keep the voxel type of the volume, integer samples are rounded to the nearest after
+ * each axis.
+ */
+template <typename VoxTy>
+void DownsampleRegion(const std::vector<VoxTy> &fineDat, const std::array<int, 3> &fineDim,
+                      std::vector<VoxTy> &coarseDat, const std::array<int, 3> &coarseDim,
+                      const std::array<int, 3> &coarseMin, const std::array<int, 3> &coarseMax) {
+    // Stage i is coarse along axes below i and fine along the others. Stage 0 is fineDat and
+    // stage 3 is coarseDat, the boxes of stages 1 and 2 are kept in buffers of their own.
+    struct Stage {
+        std::array<int, 3> dim;
+        std::array<int, 3> boxMin;
+        std::array<int, 3> boxMax;
+        std::array<size_t, 3> strides;
+        VoxTy *dat;
+    };
+    std::array<Stage, 4> stages;
+    std::array<std::vector<VoxTy>, 2> bufs;
+    for (int i = 0; i < 4; ++i) {
+        auto &stage = stages[i];
+        for (int a = 0; a < 3; ++a) {
+            stage.dim[a] = a < i ? coarseDim[a] : fineDim[a];
+            stage.boxMin[a] =
+                a < i ? coarseMin[a] : std::max(std::min(2 * coarseMin[a], fineDim[a] - 1) - 1, 0);
+            stage.boxMax[a] = a < i ? coarseMax[a]
+                                    : std::min(2 * coarseMax[a] + 1, fineDim[a] - 1);
+        }
+
+        auto isInBuf = i == 1 || i == 2;
+        std::array<int, 3> layoutDim;
+        for (int a = 0; a < 3; ++a)
+            layoutDim[a] = isInBuf ? stage.boxMax[a] - stage.boxMin[a] + 1 : stage.dim[a];
+        stage.strides = {1, static_cast<size_t>(layoutDim[0]),
+                         static_cast<size_t>(layoutDim[1]) * layoutDim[0]};
+        if (isInBuf) {
+            bufs[i - 1].resize(stage.strides[2] * layoutDim[2]);
+            stage.dat = bufs[i - 1].data();
+        } else
+            stage.dat = i == 0 ? const_cast<VoxTy *>(fineDat.data()) : coarseDat.data();
+    }
+    // Offsets in fineDat and coarseDat are global, in the buffers relative to their box
+    auto getIdx = [&](const Stage &stage, int i, const std::array<int, 3> &pos) {
+        auto orig = i == 1 || i == 2 ? stage.boxMin : std::array<int, 3>{0, 0, 0};
+        return (pos[2] - orig[2]) * stage.strides[2] + (pos[1] - orig[1]) * stage.strides[1] +
+               (pos[0] - orig[0]);
+    };
+
+    for (int axis = 0; axis < 3; ++axis) {
+        auto &src = stages[axis];
+        auto &dst = stages[axis + 1];
+        std::array<int, 3> pos;
+        for (pos[2] = dst.boxMin[2]; pos[2] <= dst.boxMax[2]; ++pos[2])
+            for (pos[1] = dst.boxMin[1]; pos[1] <= dst.boxMax[1]; ++pos[1])
+                for (pos[0] = dst.boxMin[0]; pos[0] <= dst.boxMax[0]; ++pos[0]) {
+                    auto srcPos = pos;
+                    srcPos[axis] = std::min(2 * pos[axis], src.dim[axis] - 1);
+                    auto idx = getIdx(src, axis, srcPos);
+
+                    auto prev = srcPos[axis] == 0 ? idx : idx - src.strides[axis];
+                    auto next =
+                        srcPos[axis] == src.dim[axis] - 1 ? idx : idx + src.strides[axis];
+                    auto val =
+                        .25f * src.dat[prev] + .5f * src.dat[idx] + .25f * src.dat[next];
+                    if constexpr (std::is_integral_v<VoxTy>)
+                        dst.dat[getIdx(dst, axis + 1, pos)] = static_cast<VoxTy>(val + .5f);
+                    else
+                        dst.dat[getIdx(dst, axis + 1, pos)] = val;
+                }
+    }
+}
+
+// Halves the resolution of a whole volume, slabs of it are computed in parallel
+template <typename VoxTy>
+std::vector<VoxTy> DownsampleVolume(const std::vector<VoxTy> &fineDat,
+                                    const std::array<int, 3> &fineDim,
+                                    std::array<int, 3> &coarseDim) {
+    static constexpr int SlabLen = 4;
+
+    for (int a = 0; a < 3; ++a)
+        coarseDim[a] = fineDim[a] / 2 + 1;
+    std::vector<VoxTy> coarseDat(static_cast<size_t>(coarseDim[2]) * coarseDim[1] *
+                                 coarseDim[0]);
+    ParallelFor(0, (coarseDim[2] + SlabLen - 1) / SlabLen, [&](size_t i) {
+        auto z = static_cast<int>(i) * SlabLen;
+        DownsampleRegion(fineDat, fineDim, coarseDat, coarseDim, {0, 0, z},
+                         {coarseDim[0] - 1, coarseDim[1] - 1,
+                          std::min(z + SlabLen, coarseDim[2]) - 1});
+    });
+    return coarseDat;
+}
+
+/*
+ * Extracts cells [cellStart, cellStart + cellDim) of the full resolution volume on LOD level
+ * lod, whose lattice step is 2^lod. The coarse cells are squeezed by half a coarse cell and
+ * the freed shell is filled with transition cells in the spirit of Transvoxel: their outer
+ * faces lie on the brick faces and are contoured at full resolution, their inner faces
+ * match the coarse cells. A brick thus exposes the same contour on its faces whatever level
+ * it is drawn with, and neighbouring bricks on different levels meet without cracks.
+ *
+ * Each transition cell is a frustum between a coarse face square and its fine grid on the
+ * brick face. Its faces are contoured with one rule (crossings bounding a below-isovalue
+ * arc of a face loop are joined), the segments are chained into loops and fanned.
+ */
+template <typename VoxTy>
+void MarchLODBrick(const VoxTy *fineDat, const std::array<int, 3> &fineDim,
+                   const VoxTy *coarseDat, const std::array<int, 3> &coarseDim, int lod,
+                   const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                   const osg::Vec3 &voxSz, const std::vector<IsoLevel> &isoLvls,
+                   SurfaceMesh &mesh) {
+    auto step = 1 << lod;
+    auto shellWidth = .5f * step;
+
+    // Lattice of the coarse cells, in fine cells relative to the brick and after squeezing
+    std::array<int, 3> coarseStart;
+    std::array<int, 3> coarseCellDim;
+    std::array<std::vector<int>, 3> fineOffs;
+    std::array<std::vector<float>, 3> coords;
+    for (int a = 0; a < 3; ++a) {
+        coarseStart[a] = cellStart[a] / step;
+        coarseCellDim[a] = (cellDim[a] + step - 1) / step;
+
+        auto scale = (cellDim[a] - 2.f * shellWidth) / cellDim[a];
+        for (int k = 0; k <= coarseCellDim[a]; ++k) {
+            fineOffs[a].emplace_back(std::min(k * step, cellDim[a]));
+            coords[a].emplace_back((cellStart[a] + shellWidth + fineOffs[a].back() * scale) *
+                                   voxSz[a]);
+        }
+    }
+
+    MarchCells(coarseDat, coarseDim, coarseStart, coarseCellDim, coords, isoLvls, mesh);
+
+    struct LatticeVert {
+        uint64_t key;
+        osg::Vec3 pos;
+        float val;
+    };
+    auto fineVolDimYxX = static_cast<size_t>(fineDim[1]) * fineDim[0];
+    auto coarseVolDimYxX = static_cast<size_t>(coarseDim[1]) * coarseDim[0];
+    auto fineVert = [&](const std::array<int, 3> &pos) {
+        LatticeVert v;
+        v.key = static_cast<uint64_t>(pos[0]) | (static_cast<uint64_t>(pos[1]) << 16) |
+                (static_cast<uint64_t>(pos[2]) << 32);
+        v.pos.set((cellStart[0] + pos[0]) * voxSz[0], (cellStart[1] + pos[1]) * voxSz[1],
+                  (cellStart[2] + pos[2]) * voxSz[2]);
+        v.val = fineDat[(cellStart[2] + pos[2]) * fineVolDimYxX +
+                        (cellStart[1] + pos[1]) * fineDim[0] + cellStart[0] + pos[0]];
+        return v;
+    };
+    auto innerVert = [&](const std::array<int, 3> &k) {
+        LatticeVert v;
+        v.key = (uint64_t(1) << 63) | static_cast<uint64_t>(k[0]) |
+                (static_cast<uint64_t>(k[1]) << 16) | (static_cast<uint64_t>(k[2]) << 32);
+        v.pos.set(coords[0][k[0]], coords[1][k[1]], coords[2][k[2]]);
+        v.val = coarseDat[(coarseStart[2] + k[2]) * coarseVolDimYxX +
+                          (coarseStart[1] + k[1]) * coarseDim[0] + coarseStart[0] + k[0]];
+        return v;
+    };
+
+    struct Crossing {
+        osg::Vec3 pos;
+        osg::Vec3 belowDir;
+        bool onOuterFace;
+    };
+    float isoVal;
+    float level;
+    std::vector<Crossing> crossings;
+    std::map<std::pair<uint64_t, uint64_t>, size_t> edge2Crossings;
+    std::vector<std::array<size_t, 2>> segs;
+
+    // Crossings are keyed by their lattice edge, so that faces sharing an edge share it too
+    auto getCrossing = [&](const LatticeVert &u, const LatticeVert &v) {
+        auto &v0 = u.key < v.key ? u : v;
+        auto &v1 = u.key < v.key ? v : u;
+        auto [itr, inserted] =
+            edge2Crossings.emplace(std::pair(v0.key, v1.key), crossings.size());
+        if (inserted) {
+            auto t = (isoVal - v0.val) / (v1.val - v0.val);
+            auto &below = v0.val < isoVal ? v0 : v1;
+            auto &above = v0.val < isoVal ? v1 : v0;
+            crossings.push_back({v0.pos + (v1.pos - v0.pos) * t, below.pos - above.pos,
+                                 (v1.key >> 63) == 0});
+        }
+        return itr->second;
+    };
+    std::vector<std::pair<size_t, bool>> loopCrossings;
+    auto contourLoop = [&](const LatticeVert *loop, size_t n) {
+        loopCrossings.clear();
+        for (size_t i = 0; i < n; ++i) {
+            auto &u = loop[i];
+            auto &v = loop[(i + 1) % n];
+            if ((u.val < isoVal) != (v.val < isoVal))
+                loopCrossings.emplace_back(getCrossing(u, v), v.val < isoVal);
+        }
+        if (loopCrossings.empty())
+            return;
+
+        size_t first = 0;
+        while (!loopCrossings[first].second)
+            ++first;
+        for (size_t i = 0; i < loopCrossings.size(); i += 2)
+            segs.push_back({loopCrossings[(first + i) % loopCrossings.size()].first,
+                            loopCrossings[(first + i + 1) % loopCrossings.size()].first});
+    };
+
+    std::vector<std::array<size_t, 2>> crossingSegs;
+    std::vector<bool> segUsed;
+    std::vector<size_t> poly;
+    auto emitPolygons = [&](const osg::Vec3 &inward) {
+        constexpr auto None = std::numeric_limits<size_t>::max();
+        crossingSegs.assign(crossings.size(), {None, None});
+        for (size_t s = 0; s < segs.size(); ++s)
+            for (auto c : segs[s])
+                crossingSegs[c][crossingSegs[c][0] == None ? 0 : 1] = s;
+
+        segUsed.assign(segs.size(), false);
+        for (size_t s0 = 0; s0 < segs.size(); ++s0) {
+            if (segUsed[s0])
+                continue;
+
+            poly.clear();
+            poly.emplace_back(segs[s0][0]);
+            segUsed[s0] = true;
+            auto seg = s0;
+            auto cur = segs[s0][1];
+            while (cur != poly.front()) {
+                poly.emplace_back(cur);
+                auto next =
+                    crossingSegs[cur][0] == seg ? crossingSegs[cur][1] : crossingSegs[cur][0];
+                if (next == None || segUsed[next])
+                    break;
+                segUsed[next] = true;
+                seg = next;
+                cur = segs[seg][0] == cur ? segs[seg][1] : segs[seg][0];
+            }
+            if (poly.size() < 3)
+                continue;
+
+            osg::Vec3 center, belowDir;
+            auto onOuterFace = true;
+            for (auto c : poly) {
+                center += crossings[c].pos;
+                belowDir += crossings[c].belowDir;
+                onOuterFace &= crossings[c].onOuterFace;
+            }
+            center /= poly.size();
+
+            // A loop only on the brick face would be capped in the face plane by both bricks
+            // sharing it, so its cap is lifted into the shell and faces the lower side
+            if (onOuterFace) {
+                auto outerBelow = 0.f;
+                for (auto c : poly)
+                    outerBelow += crossings[c].belowDir * (crossings[c].pos - center);
+                belowDir = outerBelow < 0.f ? -inward : inward;
+                center += inward;
+            }
+
+            // Wind the loop like the marching cubes table does, with normals facing lower values
+            osg::Vec3 area;
+            for (size_t i = 0; i < poly.size(); ++i)
+                area += (crossings[poly[i]].pos - center) ^
+                        (crossings[poly[(i + 1) % poly.size()]].pos - center);
+            if (area * belowDir < 0.f)
+                std::reverse(poly.begin(), poly.end());
+
+            if (poly.size() == 3 && !onOuterFace) {
+                AppendTriangle(crossings[poly[0]].pos, crossings[poly[1]].pos,
+                               crossings[poly[2]].pos, level, mesh);
+                continue;
+            }
+            for (size_t i = 0; i < poly.size(); ++i)
+                AppendTriangle(crossings[poly[i]].pos, crossings[poly[(i + 1) % poly.size()]].pos,
+                               center, level, mesh);
+        }
+    };
+
+    std::vector<LatticeVert> loop;
+    for (auto &isoLvl : isoLvls) {
+        isoVal = isoLvl.val;
+        level = isoLvl.level;
+        for (int a = 0; a < 3; ++a) {
+            auto b = (a + 1) % 3;
+            auto c = (a + 2) % 3;
+            for (int side = 0; side < 2; ++side) {
+                auto fa = side == 0 ? 0 : cellDim[a];
+                auto ka = side == 0 ? 0 : coarseCellDim[a];
+                osg::Vec3 inward;
+                inward[a] = (side == 0 ? .5f : -.5f) * shellWidth * voxSz[a];
+                auto fineAt = [&](int ib, int ic) {
+                    std::array<int, 3> pos;
+                    pos[a] = fa;
+                    pos[b] = ib;
+                    pos[c] = ic;
+                    return fineVert(pos);
+                };
+                auto innerAt = [&](int jb, int jc) {
+                    std::array<int, 3> k;
+                    k[a] = ka;
+                    k[b] = jb;
+                    k[c] = jc;
+                    return innerVert(k);
+                };
+
+                for (int kc = 0; kc < coarseCellDim[c]; ++kc)
+                    for (int kb = 0; kb < coarseCellDim[b]; ++kb) {
+                        crossings.clear();
+                        edge2Crossings.clear();
+                        segs.clear();
+
+                        auto b0 = fineOffs[b][kb], b1 = fineOffs[b][kb + 1];
+                        auto c0 = fineOffs[c][kc], c1 = fineOffs[c][kc + 1];
+
+                        // Outer face, one square per fine cell face
+                        for (int ic = c0; ic < c1; ++ic)
+                            for (int ib = b0; ib < b1; ++ib) {
+                                std::array square{fineAt(ib, ic), fineAt(ib + 1, ic),
+                                                  fineAt(ib + 1, ic + 1), fineAt(ib, ic + 1)};
+                                contourLoop(square.data(), square.size());
+                            }
+                        // Inner face, one coarse cell face
+                        {
+                            std::array square{innerAt(kb, kc), innerAt(kb + 1, kc),
+                                              innerAt(kb + 1, kc + 1), innerAt(kb, kc + 1)};
+                            contourLoop(square.data(), square.size());
+                        }
+                        // Side faces, shared with neighbouring transition cells
+                        for (auto [jb, ib] : {std::pair(kb, b0), std::pair(kb + 1, b1)}) {
+                            loop.clear();
+                            for (int ic = c0; ic <= c1; ++ic)
+                                loop.emplace_back(fineAt(ib, ic));
+                            loop.emplace_back(innerAt(jb, kc + 1));
+                            loop.emplace_back(innerAt(jb, kc));
+                            contourLoop(loop.data(), loop.size());
+                        }
+                        for (auto [jc, ic] : {std::pair(kc, c0), std::pair(kc + 1, c1)}) {
+                            loop.clear();
+                            for (int ib = b0; ib <= b1; ++ib)
+                                loop.emplace_back(fineAt(ib, ic));
+                            loop.emplace_back(innerAt(kb + 1, jc));
+                            loop.emplace_back(innerAt(kb, jc));
+                            contourLoop(loop.data(), loop.size());
+                        }
+
+                        emitPolygons(inward);
+                    }
+            }
+        }
+    }
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_LOD_H
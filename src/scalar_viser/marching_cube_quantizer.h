@@ -0,0 +1,147 @@
+#ifndef SCIVIS_SCALAR_VISER_MC_QUANTIZER_H
+#define SCIVIS_SCALAR_VISER_MC_QUANTIZER_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+
+#include <array>
+
+#include <osg/Array>
+
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Octahedral normal encoding (Cigolle et al. 2014). A normal is projected onto the octahedron
+ * |x| + |y| + |z| = 1, whose lower half is folded over the upper half, and the resulting square
+ * is stored in 2 x 8 bits, decoded as c / 127 like a normalized GL_BYTE.
+ */
+inline osg::Vec3 DecodeOctNormal(const osg::Vec2b &code) {
+    osg::Vec3 n(std::max(code[0] / 127.f, -1.f), std::max(code[1] / 127.f, -1.f), 0.f);
+    n.z() = 1.f - std::abs(n.x()) - std::abs(n.y());
+    if (n.z() < 0.f) {
+        auto x = n.x();
+        n.x() = (1.f - std::abs(n.y())) * (x >= 0.f ? 1.f : -1.f);
+        n.y() = (1.f - std::abs(x)) * (n.y() >= 0.f ? 1.f : -1.f);
+    }
+    n.normalize();
+    return n;
+}
+
+// Of the 4 codes around the exact projection, the one decoding closest to n is kept
+inline osg::Vec2b EncodeOctNormal(const osg::Vec3 &n) {
+    auto l1 = std::abs(n.x()) + std::abs(n.y()) + std::abs(n.z());
+    if (l1 == 0.f)
+        return osg::Vec2b(0, 0);
+
+    auto x = n.x() / l1;
+    auto y = n.y() / l1;
+    if (n.z() < 0.f) {
+        auto _x = x;
+        x = (1.f - std::abs(y)) * (_x >= 0.f ? 1.f : -1.f);
+        y = (1.f - std::abs(_x)) * (y >= 0.f ? 1.f : -1.f);
+    }
+
+    osg::Vec2b best;
+    auto bestDot = std::numeric_limits<float>::lowest();
+    for (auto cx : {std::floor(x * 127.f), std::ceil(x * 127.f)})
+        for (auto cy : {std::floor(y * 127.f), std::ceil(y * 127.f)}) {
+            osg::Vec2b code(static_cast<int8_t>(std::clamp(cx, -127.f, 127.f)),
+                            static_cast<int8_t>(std::clamp(cy, -127.f, 127.f)));
+            auto dot = DecodeOctNormal(code) * n;
+            if (dot > bestDot) {
+                bestDot = dot;
+                best = code;
+            }
+        }
+    return best;
+}
+
+/*
+ * Compact vertex layout of a SurfaceMesh, 9 bytes per vertex instead of 28.
+ * Positions are quantized to 16 bits per axis within the grid box of the mesh, normals are
+ * octahedron encoded to 2 x 8 bits and levels are stored in 8 bits. All of them are bound as
+ * normalized integer attributes and decoded by mc_vert.glsl.
+ */
+struct QuantizedMesh {
+    static constexpr float MaxQuantPos = std::numeric_limits<uint16_t>::max();
+
+    osg::ref_ptr<osg::Vec3usArray> verts;
+    osg::ref_ptr<osg::Vec2bArray> norms;
+    osg::ref_ptr<osg::UByteArray> levels;
+    osg::Vec3 boxMin;
+    osg::Vec3 boxExt;
+
+    // Largest error per axis of a decoded position in normalized grid space,
+    // and largest angle in radians between a decoded normal and its original
+    osg::Vec3 maxPosErr;
+    float maxNormErr = 0.f;
+
+    QuantizedMesh() {
+        verts = new osg::Vec3usArray;
+        norms = new osg::Vec2bArray;
+        levels = new osg::UByteArray;
+        verts->setNormalize(true);
+        norms->setNormalize(true);
+        levels->setNormalize(true);
+    }
+
+    void Clear() {
+        verts->clear();
+        norms->clear();
+        levels->clear();
+        boxMin = boxExt = maxPosErr = osg::Vec3();
+        maxNormErr = 0.f;
+    }
+};
+
+inline void QuantizeMesh(const SurfaceMesh &mesh, QuantizedMesh &quantMesh) {
+    quantMesh.Clear();
+    auto vertNum = mesh.verts->size();
+    if (vertNum == 0)
+        return;
+
+    auto &box = mesh.gridBox;
+    quantMesh.boxMin.set(box.xMin(), box.yMin(), box.zMin());
+    quantMesh.boxExt.set(box.xMax() - box.xMin(), box.yMax() - box.yMin(),
+                         box.zMax() - box.zMin());
+    osg::Vec3 scale;
+    for (int a = 0; a < 3; ++a)
+        scale[a] = quantMesh.boxExt[a] > 0.f ? QuantizedMesh::MaxQuantPos / quantMesh.boxExt[a]
+                                             : 0.f;
+
+    quantMesh.verts->resize(vertNum);
+    quantMesh.norms->resize(vertNum);
+    quantMesh.levels->resize(vertNum);
+    for (size_t i = 0; i < vertNum; ++i) {
+        auto &p = (*mesh.verts)[i];
+        auto &q = (*quantMesh.verts)[i];
+        for (int a = 0; a < 3; ++a) {
+            q[a] = static_cast<uint16_t>(std::lround(std::clamp(
+                (p[a] - quantMesh.boxMin[a]) * scale[a], 0.f, QuantizedMesh::MaxQuantPos)));
+            auto decoded =
+                quantMesh.boxMin[a] + q[a] / QuantizedMesh::MaxQuantPos * quantMesh.boxExt[a];
+            quantMesh.maxPosErr[a] = std::max(quantMesh.maxPosErr[a], std::abs(decoded - p[a]));
+        }
+
+        auto &n = (*mesh.norms)[i];
+        auto code = EncodeOctNormal(n);
+        (*quantMesh.norms)[i] = code;
+        if (n.length2() != 0.f)
+            quantMesh.maxNormErr =
+                std::max(quantMesh.maxNormErr,
+                         std::acos(std::clamp(DecodeOctNormal(code) * n / n.length(), -1.f, 1.f)));
+
+        (*quantMesh.levels)[i] =
+            static_cast<uint8_t>(std::lround(std::clamp((*mesh.levels)[i], 0.f, 1.f) * 255.f));
+    }
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_MC_QUANTIZER_H
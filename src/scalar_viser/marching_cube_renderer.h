@@ -2,21 +2,36 @@
 #define SCIVIS_SCALAR_VISER_MCR_H
 
 #include <algorithm>
-#include <numeric>
+#include <cmath>
+#include <format>
+#include <limits>
+#include <memory>
+#include <source_location>
 #include <string>
 
 #include <array>
 #include <map>
 #include <optional>
+#include <vector>
 
 #include <osg/CoordinateSystemNode>
 #include <osg/Geometry>
+#include <osg/LOD>
 #include <osg/Texture3D>
 
 #include <scivis/callback.h>
+#include <scivis/parallel.h>
 
 #include "def_val.h"
-#include "marching_cube_table.h"
+#include "flying_edges.h"
+#include "geo_mapping.h"
+#include "marching_cube_bvh.h"
+#include "marching_cube_cache.h"
+#include "marching_cube_decimator.h"
+#include "marching_cube_kernel.h"
+#include "marching_cube_lod.h"
+#include "marching_cube_quantizer.h"
+#include "surface_nets.h"
 
 #include "shaders/generated/mc_frag.h"
 #include "shaders/generated/mc_vert.h"
@@ -24,8 +39,27 @@
 namespace SciVis {
 namespace ScalarViser {
 
-class MarchingCubeCPURenderer {
+/*
+ * VoxTy is the type volumes are kept in (uint8_t, uint16_t or float). Samples are classified in
+ * it and isovalues are given in its domain, e.g. 0 to 255 for uint8_t.
+ */
+template <typename VoxTy> class MarchingCubeCPURenderer {
+  public:
+    /*
+     * MarchingCube visits every cell on its own and emits flat shaded triangle lists.
+     * FlyingEdges shares vertices through indices and shades them with volume gradients.
+     * Both emit the triangles of TriangleTable.
+     * SurfaceNets places one vertex per crossed cell and joins them by quads, which gives
+     * indexed surfaces without the slivers of TriangleTable but smooths away sharp features.
+     * It is only used without LOD levels.
+     */
+    enum class Engine { MarchingCube, FlyingEdges, SurfaceNets };
+
   private:
+    static constexpr int QuantVertAttribLoc = 0;
+    static constexpr int IsoLevelAttribLoc = 6;
+    static constexpr int OctNormalAttribLoc = 7;
+
     struct PerRendererParam {
         osg::ref_ptr<osg::Group> grp;
         osg::ref_ptr<osg::Program> program;
@@ -37,33 +71,505 @@ class MarchingCubeCPURenderer {
             program = new osg::Program;
             program->addShader(vertShader);
             program->addShader(fragShader);
+            program->addBindAttribLocation("isoLevel", IsoLevelAttribLoc);
+            program->addBindAttribLocation("octNormal", OctNormalAttribLoc);
         }
     };
     PerRendererParam param;
 
     class PerVolumeParam {
-        uint8_t rndrVertsBufIdx = 0;
+      public:
+        static constexpr int BrickCellLen = 32;
+        static constexpr int MaxLODNum = 5;
+        // Side of the sample blocks UpdateVolume diffs volumes in
+        static constexpr int HashBlockLen = 8;
+
+      private:
+        /*
+         * Double-buffered geometry of one LOD level of a brick.
+         * The quantized meshes are only filled while vertices are quantized.
+         */
+        struct Surface {
+            uint8_t rndrVertsBufIdx = 0;
+            bool hasSurf = false;
+
+            osg::ref_ptr<GridToECEFBoundCallback> boundCallback;
+            osg::ref_ptr<osg::Geometry> geom;
+            osg::ref_ptr<osg::Geode> geode;
+            osg::ref_ptr<osg::Uniform> isVertQuantized;
+            osg::ref_ptr<osg::Uniform> quantBoxMin;
+            osg::ref_ptr<osg::Uniform> quantBoxExt;
+            std::array<SurfaceMesh, 2> meshes;
+            std::array<QuantizedMesh, 2> quantMeshes;
+
+            Surface(const GeoExtent &geoExt) {
+                boundCallback = new GridToECEFBoundCallback(geoExt);
+                geom = new osg::Geometry;
+                geom->setComputeBoundingBoxCallback(boundCallback);
+                geode = new osg::Geode;
+                geode->addDrawable(geom);
+                geode->setNodeMask(0);
+
+                auto states = geode->getOrCreateStateSet();
+                isVertQuantized = new osg::Uniform("isVertQuantized", false);
+                quantBoxMin = new osg::Uniform("quantBoxMin", osg::Vec3());
+                quantBoxExt = new osg::Uniform("quantBoxExt", osg::Vec3());
+                states->addUniform(isVertQuantized);
+                states->addUniform(quantBoxMin);
+                states->addUniform(quantBoxExt);
+            }
+
+            SurfaceMesh &GetCmptMesh() { return meshes[(rndrVertsBufIdx + 1) & 1]; }
+            const SurfaceMesh &GetRndrMesh() const { return meshes[rndrVertsBufIdx]; }
+            QuantizedMesh &GetCmptQuantMesh() { return quantMeshes[(rndrVertsBufIdx + 1) & 1]; }
+            QuantizedMesh &GetRndrQuantMesh() { return quantMeshes[rndrVertsBufIdx]; }
+
+            void SwapVertsBuf(bool isVertQuantized) {
+                rndrVertsBufIdx = (rndrVertsBufIdx + 1) & 1;
+                BindVertsBuf(isVertQuantized);
+            }
+
+            void BindVertsBuf(bool isVertQuantized) {
+                auto &mesh = meshes[rndrVertsBufIdx];
+
+                boundCallback->SetGridBox(mesh.gridBox);
+                geom->dirtyBound();
+
+                this->isVertQuantized->set(isVertQuantized);
+                if (isVertQuantized) {
+                    auto &quantMesh = quantMeshes[rndrVertsBufIdx];
+                    quantBoxMin->set(quantMesh.boxMin);
+                    quantBoxExt->set(quantMesh.boxExt);
+
+                    geom->setVertexArray(nullptr);
+                    geom->setNormalArray(nullptr);
+                    geom->setVertexAttribArray(QuantVertAttribLoc, quantMesh.verts,
+                                               osg::Array::BIND_PER_VERTEX);
+                    geom->setVertexAttribArray(OctNormalAttribLoc, quantMesh.norms,
+                                               osg::Array::BIND_PER_VERTEX);
+                    geom->setVertexAttribArray(IsoLevelAttribLoc, quantMesh.levels,
+                                               osg::Array::BIND_PER_VERTEX);
+                } else {
+                    geom->setVertexAttribArray(QuantVertAttribLoc, nullptr);
+                    geom->setVertexAttribArray(OctNormalAttribLoc, nullptr);
+                    geom->setVertexArray(mesh.verts);
+                    geom->setNormalArray(mesh.norms);
+                    geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+                    geom->setVertexAttribArray(IsoLevelAttribLoc, mesh.levels,
+                                               osg::Array::BIND_PER_VERTEX);
+                }
+
+                geom->getPrimitiveSetList().clear();
+                if (mesh.idxs->empty())
+                    geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0,
+                                                              mesh.verts->size()));
+                else
+                    geom->addPrimitiveSet(mesh.idxs);
+
+                hasSurf = !mesh.verts->empty();
+                geode->setNodeMask(hasSurf ? ~0u : 0u);
+            }
+        };
+
+        /*
+         * Spatial brick of BrickCellLen^3 cells, drawn by its own geometries.
+         * Its samples span [cellStart, cellStart + cellDim], so neighbouring bricks share a face.
+         * With more than one LOD level, the levels are switched by an osg::LOD on screen size.
+         * Picking goes through the BVH of its level 0 surface in ECEF relative to bvhOrig, which
+         * is only built once a ray passes pickBound.
+         */
+        struct Brick {
+            std::array<int, 3> cellStart;
+            std::array<int, 3> cellDim;
+            VoxTy minVal;
+            VoxTy maxVal;
+
+            std::vector<Surface> surfs;
+            osg::ref_ptr<osg::LOD> lod;
+
+            bool isBVHDirty = true;
+            osg::BoundingBox pickBound;
+            osg::Vec3 bvhOrig;
+            MeshBVH bvh;
+
+            bool MayHaveSurface(float isoVal) const { return minVal < isoVal && maxVal >= isoVal; }
+            bool MayHaveSurface(const std::vector<IsoLevel> &isoLvls) const {
+                return std::any_of(isoLvls.begin(), isoLvls.end(), [&](const IsoLevel &isoLvl) {
+                    return MayHaveSurface(isoLvl.val);
+                });
+            }
+            bool HasSurface() const {
+                return std::any_of(surfs.begin(), surfs.end(),
+                                   [](const Surface &surf) { return surf.hasSurf; });
+            }
+            osg::Node *GetNode() {
+                return lod.valid() ? static_cast<osg::Node *>(lod.get()) : surfs[0].geode.get();
+            }
+        };
+
         std::array<int, 3> volDim;
         osg::Vec3 voxSz;
+        std::vector<float> isoVals;
+        int lodNum = 1;
+        float maxScreenErr = 1.f;
+        Engine engine = Engine::MarchingCube;
+        bool isVertQuantized = false;
+        float decimTriRatio = 1.f;
+        float decimMaxErr = .5f;
+        std::string meshCacheDir;
+        uint64_t volHash = 0;
+
+        std::shared_ptr<std::vector<VoxTy>> volDat;
+        // Level l of the pyramid is stored at l - 1, level 0 is volDat itself
+        std::vector<std::vector<VoxTy>> lodDats;
+        std::vector<std::array<int, 3>> lodDims;
+
+        GeoExtent geoExt;
+        osg::ref_ptr<osg::Uniform> minLatitute;
+        osg::ref_ptr<osg::Uniform> maxLatitute;
+        osg::ref_ptr<osg::Uniform> minLongtitute;
+        osg::ref_ptr<osg::Uniform> maxLongtitute;
+        osg::ref_ptr<osg::Uniform> minHeight;
+        osg::ref_ptr<osg::Uniform> maxHeight;
 
-        std::shared_ptr<std::vector<float>> volDat;
+        osg::ref_ptr<osg::Group> grp;
+        std::array<int, 3> brickNum;
+        std::vector<Brick> bricks;
 
-        osg::ref_ptr<osg::Geometry> geom;
-        osg::ref_ptr<osg::Geode> geode;
-        std::array<osg::ref_ptr<osg::Vec3Array>, 2> vertsBuf;
-        std::array<osg::ref_ptr<osg::Vec3Array>, 2> normsBuf;
+        std::array<int, 3> hashBlockNum;
+        std::vector<uint64_t> blockHashes;
 
       private:
-        void swapVertsBuf() {
-            rndrVertsBufIdx = (rndrVertsBufIdx + 1) & 1;
+        void initBricks() {
+            std::array cellDim{volDim[0] - 1, volDim[1] - 1, volDim[2] - 1};
+            for (int i = 0; i < 3; ++i)
+                brickNum[i] = std::max(0, (cellDim[i] + BrickCellLen - 1) / BrickCellLen);
+
+            bricks.resize(static_cast<size_t>(brickNum[2]) * brickNum[1] * brickNum[0]);
+            for (int bz = 0; bz < brickNum[2]; ++bz)
+                for (int by = 0; by < brickNum[1]; ++by)
+                    for (int bx = 0; bx < brickNum[0]; ++bx) {
+                        auto &brick =
+                            bricks[(static_cast<size_t>(bz) * brickNum[1] + by) * brickNum[0] + bx];
+                        brick.cellStart = {bx * BrickCellLen, by * BrickCellLen,
+                                           bz * BrickCellLen};
+                        for (int i = 0; i < 3; ++i)
+                            brick.cellDim[i] =
+                                std::min(BrickCellLen, cellDim[i] - brick.cellStart[i]);
+                    }
+
+            ParallelFor(0, bricks.size(), [&](size_t i) { cmptBrickRange(bricks[i]); });
+
+            for (int i = 0; i < 3; ++i)
+                hashBlockNum[i] = (volDim[i] + HashBlockLen - 1) / HashBlockLen;
+            blockHashes = cmptBlockHashes();
+
+            initBrickNodes();
+        }
+
+        void cmptBrickRange(Brick &brick) {
+            auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
+            brick.minVal = std::numeric_limits<VoxTy>::max();
+            brick.maxVal = std::numeric_limits<VoxTy>::lowest();
+            for (int z = 0; z <= brick.cellDim[2]; ++z)
+                for (int y = 0; y <= brick.cellDim[1]; ++y) {
+                    auto row = volDat->data() + (brick.cellStart[2] + z) * volDimYxX +
+                               (brick.cellStart[1] + y) * volDim[0] + brick.cellStart[0];
+                    auto [minItr, maxItr] = std::minmax_element(row, row + brick.cellDim[0] + 1);
+                    brick.minVal = std::min(brick.minVal, *minItr);
+                    brick.maxVal = std::max(brick.maxVal, *maxItr);
+                }
+        }
+
+        // Blocks partition the samples, the last ones along an axis may be thinner
+        std::vector<uint64_t> cmptBlockHashes() const {
+            std::vector<uint64_t> hashes(static_cast<size_t>(hashBlockNum[2]) * hashBlockNum[1] *
+                                         hashBlockNum[0]);
+            auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
+            ParallelFor(0, hashes.size(), [&](size_t i) {
+                std::array<int, 3> start{
+                    static_cast<int>(i % hashBlockNum[0]) * HashBlockLen,
+                    static_cast<int>(i / hashBlockNum[0] % hashBlockNum[1]) * HashBlockLen,
+                    static_cast<int>(i / hashBlockNum[0] / hashBlockNum[1]) * HashBlockLen};
+                std::array<int, 3> end;
+                for (int a = 0; a < 3; ++a)
+                    end[a] = std::min(start[a] + HashBlockLen, volDim[a]);
+
+                auto h = FNVOffs;
+                for (int z = start[2]; z < end[2]; ++z)
+                    for (int y = start[1]; y < end[1]; ++y)
+                        h = HashBytes(volDat->data() + z * volDimYxX +
+                                          static_cast<size_t>(y) * volDim[0] + start[0],
+                                      sizeof(VoxTy) * (end[0] - start[0]), h);
+                hashes[i] = h;
+            });
+            return hashes;
+        }
+
+        void initBrickNodes() {
+            for (auto &brick : bricks) {
+                if (!brick.surfs.empty())
+                    grp->removeChild(brick.GetNode());
+                brick.surfs.clear();
+                brick.lod = nullptr;
+
+                // A level needs at least 2 coarse cells per axis to leave room for its shell
+                auto minCellDim = *std::min_element(brick.cellDim.begin(), brick.cellDim.end());
+                auto brickLODNum = 1;
+                while (brickLODNum < lodNum && (2 << brickLODNum) <= minCellDim)
+                    ++brickLODNum;
+                for (int l = 0; l < brickLODNum; ++l)
+                    brick.surfs.emplace_back(geoExt);
+
+                if (brickLODNum > 1) {
+                    brick.lod = new osg::LOD;
+                    brick.lod->setRangeMode(osg::LOD::PIXEL_SIZE_ON_SCREEN);
+                    for (int l = 0; l < brickLODNum; ++l)
+                        brick.lod->addChild(brick.surfs[l].geode, 0.f, 0.f);
+                    updateLODRanges(brick);
+                    updateLODBound(brick);
+                }
+
+                grp->addChild(brick.GetNode());
+            }
+        }
+
+        void updateLODRanges(Brick &brick) {
+            if (!brick.lod.valid())
+                return;
+
+            // Level l is exact up to 2^l voxels, and the brick radius spans about
+            // |cellDim| / 2 voxels, which osg::LOD measures in pixels
+            auto radiusInVox = .5f * std::sqrt(static_cast<float>(
+                                         brick.cellDim[0] * brick.cellDim[0] +
+                                         brick.cellDim[1] * brick.cellDim[1] +
+                                         brick.cellDim[2] * brick.cellDim[2]));
+            auto maxPixelSz = [&](int l) {
+                return l == 0 ? std::numeric_limits<float>::max()
+                              : maxScreenErr * radiusInVox / (1 << l);
+            };
+
+            auto brickLODNum = static_cast<int>(brick.surfs.size());
+            for (int l = 0; l < brickLODNum; ++l)
+                brick.lod->setRange(l, l == brickLODNum - 1 ? 0.f : maxPixelSz(l + 1),
+                                    maxPixelSz(l));
+        }
+
+        // osg::LOD measures the whole brick instead of the bound of its current surfaces
+        void updateLODBound(Brick &brick) {
+            if (!brick.lod.valid())
+                return;
+
+            osg::BoundingBox gridBox(
+                brick.cellStart[0] * voxSz.x(), brick.cellStart[1] * voxSz.y(),
+                brick.cellStart[2] * voxSz.z(), (brick.cellStart[0] + brick.cellDim[0]) * voxSz.x(),
+                (brick.cellStart[1] + brick.cellDim[1]) * voxSz.y(),
+                (brick.cellStart[2] + brick.cellDim[2]) * voxSz.z());
+            auto bound = geoExt.GridBoxToECEFBound(gridBox);
+            brick.lod->setCenter(bound.center());
+            brick.lod->setRadius(bound.radius());
+        }
+
+        void dirtyBVH(Brick &brick) {
+            brick.isBVHDirty = true;
+            brick.bvh.Clear();
+            brick.pickBound = geoExt.GridBoxToECEFBound(brick.surfs[0].GetRndrMesh().gridBox);
+        }
+
+        void remarch() {
+            auto isoVals = std::move(this->isoVals);
+            this->isoVals.clear();
+            if (!isoVals.empty())
+                MarchingCube(isoVals);
+        }
+
+        void marchBrick(Brick &brick, int lod, const std::vector<IsoLevel> &isoLvls) {
+            auto &mesh = brick.surfs[lod].GetCmptMesh();
+            mesh.Clear();
+
+            if (lod == 0 && engine == Engine::FlyingEdges)
+                FlyingEdgesCells(volDat->data(), volDim, brick.cellStart, brick.cellDim, voxSz,
+                                 isoLvls, mesh);
+            else if (lod == 0 && engine == Engine::SurfaceNets)
+                SurfaceNetsCells(volDat->data(), volDim, brick.cellStart, brick.cellDim, voxSz,
+                                 isoLvls, mesh);
+            else if (lod == 0) {
+                std::array<std::vector<float>, 3> coords;
+                for (int a = 0; a < 3; ++a)
+                    for (int i = 0; i <= brick.cellDim[a]; ++i)
+                        coords[a].emplace_back((brick.cellStart[a] + i) * voxSz[a]);
+                MarchCells(volDat->data(), volDim, brick.cellStart, brick.cellDim, coords, isoLvls,
+                           mesh);
+            } else
+                MarchLODBrick(volDat->data(), volDim, lodDats[lod - 1].data(), lodDims[lod - 1],
+                              lod, brick.cellStart, brick.cellDim, voxSz, isoLvls, mesh);
+
+            if (decimTriRatio < 1.f) {
+                osg::BoundingBox lockBox(
+                    brick.cellStart[0] * voxSz.x(), brick.cellStart[1] * voxSz.y(),
+                    brick.cellStart[2] * voxSz.z(),
+                    (brick.cellStart[0] + brick.cellDim[0]) * voxSz.x(),
+                    (brick.cellStart[1] + brick.cellDim[1]) * voxSz.y(),
+                    (brick.cellStart[2] + brick.cellDim[2]) * voxSz.z());
+                DecimateMesh(mesh, lockBox, voxSz, decimTriRatio, decimMaxErr);
+            }
+        }
 
-            geom->setVertexArray(vertsBuf[rndrVertsBufIdx]);
-            geom->setNormalArray(normsBuf[rndrVertsBufIdx]);
-            geom->setNormalBinding(osg::Geometry::BIND_PER_VERTEX);
+        /*
+         * Recomputes the samples of the pyramid filtered from changed blocks. Changes are
+         * tracked in blocks of HashBlockLen^3 samples on every level, and the changed blocks
+         * of a level are recomputed in runs along x, in parallel as they do not overlap.
+         */
+        void updateLODDats(std::vector<uint8_t> blockChanged) {
+            auto blockNum = hashBlockNum;
+            for (int l = 1; l < lodNum; ++l) {
+                auto &fineDim = l == 1 ? volDim : lodDims[l - 2];
+                auto &coarseDim = lodDims[l - 1];
+
+                // Coarse sample i is filtered from fine samples 2i - 1 to 2i + 1
+                std::array<int, 3> coarseBlockNum;
+                for (int a = 0; a < 3; ++a)
+                    coarseBlockNum[a] = (coarseDim[a] + HashBlockLen - 1) / HashBlockLen;
+                std::vector<uint8_t> coarseBlockChanged(static_cast<size_t>(coarseBlockNum[2]) *
+                                                        coarseBlockNum[1] * coarseBlockNum[0]);
+                for (size_t i = 0; i < blockChanged.size(); ++i) {
+                    if (!blockChanged[i])
+                        continue;
+                    std::array<int, 3> block{static_cast<int>(i % blockNum[0]),
+                                             static_cast<int>(i / blockNum[0] % blockNum[1]),
+                                             static_cast<int>(i / blockNum[0] / blockNum[1])};
+                    std::array<int, 3> min, max;
+                    for (int a = 0; a < 3; ++a) {
+                        auto fineMin = block[a] * HashBlockLen;
+                        auto fineMax = std::min(fineMin + HashBlockLen, fineDim[a]) - 1;
+                        min[a] = fineMin / 2 / HashBlockLen;
+                        max[a] = std::min((fineMax + 1) / 2, coarseDim[a] - 1) / HashBlockLen;
+                    }
+                    for (int z = min[2]; z <= max[2]; ++z)
+                        for (int y = min[1]; y <= max[1]; ++y)
+                            for (int x = min[0]; x <= max[0]; ++x)
+                                coarseBlockChanged[(static_cast<size_t>(z) * coarseBlockNum[1] +
+                                                    y) *
+                                                       coarseBlockNum[0] +
+                                                   x] = 1;
+                }
 
-            geom->getPrimitiveSetList().clear();
-            geom->addPrimitiveSet(new osg::DrawArrays(osg::PrimitiveSet::TRIANGLES, 0,
-                                                      vertsBuf[rndrVertsBufIdx]->size()));
+                std::vector<std::array<std::array<int, 3>, 2>> regions;
+                for (int z = 0; z < coarseBlockNum[2]; ++z)
+                    for (int y = 0; y < coarseBlockNum[1]; ++y) {
+                        auto row = coarseBlockChanged.data() +
+                                   (static_cast<size_t>(z) * coarseBlockNum[1] + y) *
+                                       coarseBlockNum[0];
+                        for (int x = 0; x < coarseBlockNum[0]; ++x) {
+                            if (!row[x])
+                                continue;
+                            auto xEnd = x;
+                            while (xEnd + 1 < coarseBlockNum[0] && row[xEnd + 1])
+                                ++xEnd;
+                            std::array<int, 3> min{x * HashBlockLen, y * HashBlockLen,
+                                                   z * HashBlockLen};
+                            std::array<int, 3> max{(xEnd + 1) * HashBlockLen,
+                                                   (y + 1) * HashBlockLen,
+                                                   (z + 1) * HashBlockLen};
+                            for (int a = 0; a < 3; ++a)
+                                max[a] = std::min(max[a], coarseDim[a]) - 1;
+                            regions.push_back({min, max});
+                            x = xEnd;
+                        }
+                    }
+                ParallelFor(0, regions.size(), [&](size_t i) {
+                    DownsampleRegion(l == 1 ? *volDat : lodDats[l - 2], fineDim, lodDats[l - 1],
+                                     coarseDim, regions[i][0], regions[i][1]);
+                });
+
+                blockChanged = std::move(coarseBlockChanged);
+                blockNum = coarseBlockNum;
+            }
+        }
+
+        std::vector<IsoLevel> getIsoLevels(const std::vector<float> &isoVals) const {
+            std::vector<IsoLevel> isoLvls;
+            for (size_t i = 0; i < isoVals.size(); ++i)
+                isoLvls.push_back({isoVals[i], isoVals.size() == 1
+                                                   ? 0.f
+                                                   : static_cast<float>(i) / (isoVals.size() - 1)});
+            return isoLvls;
+        }
+
+        // Re-extracts surfaces in parallel and swaps them in once all are done
+        void marchSurfaces(const std::vector<std::pair<Brick *, int>> &dirtySurfs,
+                           const std::vector<IsoLevel> &isoLvls) {
+            ParallelFor(0, dirtySurfs.size(), [&](size_t i) {
+                auto [brick, lod] = dirtySurfs[i];
+
+                // Coarse levels would invent surfaces for values outside the brick
+                std::vector<IsoLevel> brickIsoLvls;
+                for (auto &isoLvl : isoLvls)
+                    if (brick->MayHaveSurface(isoLvl.val))
+                        brickIsoLvls.emplace_back(isoLvl);
+
+                if (brickIsoLvls.empty())
+                    brick->surfs[lod].GetCmptMesh().Clear();
+                else
+                    marchBrick(*brick, lod, brickIsoLvls);
+                if (isVertQuantized)
+                    QuantizeMesh(brick->surfs[lod].GetCmptMesh(),
+                                 brick->surfs[lod].GetCmptQuantMesh());
+            });
+            for (auto [brick, lod] : dirtySurfs) {
+                brick->surfs[lod].SwapVertsBuf(isVertQuantized);
+                if (lod == 0)
+                    dirtyBVH(*brick);
+            }
+        }
+
+        std::vector<Surface *> getSurfaces() {
+            std::vector<Surface *> surfs;
+            for (auto &brick : bricks)
+                for (auto &surf : brick.surfs)
+                    surfs.emplace_back(&surf);
+            return surfs;
+        }
+
+        MeshCacheKey getMeshCacheKey(const std::vector<float> &isoVals) const {
+            MeshCacheKey key;
+            key.volHash = volHash;
+            key.volDim = volDim;
+            key.voxTySz = sizeof(VoxTy);
+            key.engine = static_cast<uint32_t>(engine);
+            key.lodNum = lodNum;
+            key.decimTriRatio = decimTriRatio;
+            key.decimMaxErr = decimMaxErr;
+            key.isoVals = isoVals;
+            return key;
+        }
+
+        bool loadMeshCache(const std::vector<float> &isoVals) {
+            std::vector<SurfaceMesh *> meshes;
+            for (auto &brick : bricks)
+                for (auto &surf : brick.surfs)
+                    meshes.emplace_back(&surf.GetCmptMesh());
+            if (!MeshCache::Load(meshCacheDir, getMeshCacheKey(isoVals), meshes))
+                return false;
+
+            auto surfs = getSurfaces();
+            if (isVertQuantized)
+                ParallelFor(0, surfs.size(), [&](size_t i) {
+                    QuantizeMesh(surfs[i]->GetCmptMesh(), surfs[i]->GetCmptQuantMesh());
+                });
+            for (auto surf : surfs)
+                surf->SwapVertsBuf(isVertQuantized);
+            for (auto &brick : bricks)
+                dirtyBVH(brick);
+            return true;
+        }
+
+        void saveMeshCache(const std::vector<float> &isoVals) const {
+            std::vector<const SurfaceMesh *> meshes;
+            for (auto &brick : bricks)
+                for (auto &surf : brick.surfs)
+                    meshes.emplace_back(&surf.GetRndrMesh());
+            MeshCache::Save(meshCacheDir, getMeshCacheKey(isoVals), meshes);
         }
 
       public:
@@ -72,163 +578,381 @@ class MarchingCubeCPURenderer {
             : volDat(volDat), volDim(volDim) {
             voxSz = osg::Vec3(1.f / volDim[0], 1.f / volDim[1], 1.f / volDim[2]);
 
-            vertsBuf[0] = new osg::Vec3Array;
-            vertsBuf[1] = new osg::Vec3Array;
-            normsBuf[0] = new osg::Vec3Array;
-            normsBuf[1] = new osg::Vec3Array;
+            grp = new osg::Group;
+
+            auto states = grp->getOrCreateStateSet();
+#define STATEMENT(name)                                                                            \
+    name = new osg::Uniform(#name, geoExt.name);                                                   \
+    states->addUniform(name)
+            STATEMENT(minLatitute);
+            STATEMENT(maxLatitute);
+            STATEMENT(minLongtitute);
+            STATEMENT(maxLongtitute);
+            STATEMENT(minHeight);
+            STATEMENT(maxHeight);
+#undef STATEMENT
+
+            states->setAttributeAndModes(renderer->program, osg::StateAttribute::ON);
+
+            initBricks();
+        }
+
+        /*
+         * Meshes are kept in normalized grid space and mapped onto the globe by mc_vert.glsl,
+         * so changing the extent (or exaggerating the height) needs no re-extraction.
+         */
+        void SetGeoExtent(const GeoExtent &geoExt) {
+            this->geoExt = geoExt;
+#define STATEMENT(name) name->set(geoExt.name)
+            STATEMENT(minLatitute);
+            STATEMENT(maxLatitute);
+            STATEMENT(minLongtitute);
+            STATEMENT(maxLongtitute);
+            STATEMENT(minHeight);
+            STATEMENT(maxHeight);
+#undef STATEMENT
+
+            for (auto &brick : bricks) {
+                for (auto &surf : brick.surfs) {
+                    surf.boundCallback->SetGeoExtent(geoExt);
+                    surf.geom->dirtyBound();
+                }
+                updateLODBound(brick);
+                dirtyBVH(brick);
+            }
+        }
 
-            geom = new osg::Geometry;
-            geode = new osg::Geode;
-            geode->addDrawable(geom);
+        /*
+         * Builds a pyramid of lodNum levels, which are extracted per brick and selected by
+         * osg::LOD, so that the triangle count follows the screen rather than the volume.
+         * Level l is drawn while a voxel of it covers at most maxScreenErr pixels.
+         * Returns false and keeps the previous levels if more than one level is asked for while
+         * the engine is SurfaceNets, see SetEngine.
+         */
+        bool SetLOD(int lodNum, float maxScreenErr = 1.f, std::string *errMsg = nullptr) {
+            lodNum = std::clamp(lodNum, 1, MaxLODNum);
+            if (lodNum > 1 && engine == Engine::SurfaceNets) {
+                if (errMsg)
+                    *errMsg = std::format("File:{} => Func:{} => Err: SurfaceNets has no LOD",
+                                          std::source_location::current().file_name(),
+                                          std::source_location::current().function_name());
+                return false;
+            }
 
-            auto states = geode->getOrCreateStateSet();
+            this->maxScreenErr = maxScreenErr;
+            // Bricks and their surfaces are kept when only the switching distances change
+            if (lodNum == this->lodNum) {
+                for (auto &brick : bricks)
+                    updateLODRanges(brick);
+                return true;
+            }
 
-            //states->setAttributeAndModes(renderer->program, osg::StateAttribute::ON);
+            this->lodNum = lodNum;
+            lodDats.resize(lodNum - 1);
+            lodDims.resize(lodNum - 1);
+            for (int l = 1; l < lodNum; ++l)
+                lodDats[l - 1] = DownsampleVolume(l == 1 ? *volDat : lodDats[l - 2],
+                                                  l == 1 ? volDim : lodDims[l - 2], lodDims[l - 1]);
+            initBrickNodes();
+            remarch();
+            return true;
         }
 
-        void MarchingCube(float isoVal) {
-            using DimTy = decltype(volDim)::value_type;
+        /*
+         * Selects the engine of the full resolution level, coarser LOD levels always use
+         * MarchCells since their squeezed lattices are not uniform. Their transition shells follow
+         * the cells of TriangleTable, which do not meet the dual vertices of SurfaceNets.
+         * Returns false and keeps the previous engine if SurfaceNets is asked for while there are
+         * more than one LOD level.
+         */
+        bool SetEngine(Engine engine, std::string *errMsg = nullptr) {
+            if (engine == Engine::SurfaceNets && lodNum > 1) {
+                if (errMsg)
+                    *errMsg = std::format("File:{} => Func:{} => Err: SurfaceNets has no LOD",
+                                          std::source_location::current().file_name(),
+                                          std::source_location::current().function_name());
+                return false;
+            }
 
-            auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
-            auto sample = [&](DimTy x, DimTy y, DimTy z) {
-                x = std::min(x, volDim[0] - 1);
-                y = std::min(y, volDim[1] - 1);
-                z = std::min(z, volDim[2] - 1);
-                auto i = z * volDimYxX + y * volDim[0] + x;
-                return (*volDat)[i];
-            };
-            auto cmptField = [&](DimTy x, DimTy y, DimTy z) {
-                std::array<float, 8> field;
-                field[0] = sample(x + 0, y + 0, z + 0);
-                field[1] = sample(x + 1, y + 0, z + 0);
-                field[2] = sample(x + 1, y + 1, z + 0);
-                field[3] = sample(x + 0, y + 1, z + 0);
-                field[4] = sample(x + 0, y + 0, z + 1);
-                field[5] = sample(x + 1, y + 0, z + 1);
-                field[6] = sample(x + 1, y + 1, z + 1);
-                field[7] = sample(x + 0, y + 1, z + 1);
-                return field;
-            };
-            auto cmptCubeIdx = [&](const std::array<float, 8> &field) {
-                uint32_t cubeIdx = 0;
-                cubeIdx |= field[0] < isoVal ? (1 << 0) : 0;
-                cubeIdx |= field[1] < isoVal ? (1 << 1) : 0;
-                cubeIdx |= field[2] < isoVal ? (1 << 2) : 0;
-                cubeIdx |= field[3] < isoVal ? (1 << 3) : 0;
-                cubeIdx |= field[4] < isoVal ? (1 << 4) : 0;
-                cubeIdx |= field[5] < isoVal ? (1 << 5) : 0;
-                cubeIdx |= field[6] < isoVal ? (1 << 6) : 0;
-                cubeIdx |= field[7] < isoVal ? (1 << 7) : 0;
-                return cubeIdx;
-            };
+            if (engine == this->engine)
+                return true;
+            this->engine = engine;
+            remarch();
+            return true;
+        }
+
+        /*
+         * Stores every extraction in dirPath and loads it back when the same volume is shown
+         * with the same isovalues, LOD levels and engine again. An empty path disables the cache.
+         */
+        void SetMeshCache(const std::string &dirPath) {
+            meshCacheDir = dirPath;
+            if (!meshCacheDir.empty() && volHash == 0)
+                volHash = HashVolume(*volDat);
+        }
 
-            std::vector<size_t> voxVertNums(volDat->size(), 0);
-            for (size_t i = 0; i < volDat->size(); ++i) {
-                DimTy z = i / volDimYxX;
-                DimTy y = (i - z * volDimYxX) / volDim[0];
-                DimTy x = i - z * volDimYxX - y * volDim[0];
+        /*
+         * Simplifies every extracted surface before upload, down to triRatio of its triangles
+         * as long as the surface moves by at most maxErr voxels (see DecimateMesh).
+         * Bricks are simplified in parallel with their faces locked. triRatio 1 disables it.
+         */
+        void SetDecimation(float triRatio, float maxErr = .5f) {
+            triRatio = std::clamp(triRatio, 0.f, 1.f);
+            if (triRatio == decimTriRatio && maxErr == decimMaxErr)
+                return;
+            decimTriRatio = triRatio;
+            decimMaxErr = maxErr;
+            remarch();
+        }
+
+        /*
+         * Switches the surfaces to the compact layout of QuantizedMesh, which takes about a
+         * third of the GPU memory and bandwidth of float vertices.
+         */
+        void SetVertexQuantization(bool isVertQuantized) {
+            if (isVertQuantized == this->isVertQuantized)
+                return;
+            this->isVertQuantized = isVertQuantized;
+
+            auto surfs = getSurfaces();
+            ParallelFor(0, surfs.size(), [&](size_t i) {
+                if (isVertQuantized)
+                    QuantizeMesh(surfs[i]->GetRndrMesh(), surfs[i]->GetRndrQuantMesh());
+                else {
+                    surfs[i]->GetRndrQuantMesh().Clear();
+                    surfs[i]->GetCmptQuantMesh().Clear();
+                }
+            });
+            for (auto surf : surfs)
+                surf->BindVertsBuf(isVertQuantized);
+        }
 
-                auto field = cmptField(x, y, z);
-                auto cubeIdx = cmptCubeIdx(field);
+        /*
+         * Quantization error of every drawn surface, positions in voxels per axis and normals
+         * in radians. Empty without quantization.
+         */
+        struct QuantizationError {
+            std::array<int, 3> cellStart;
+            int lod;
+            osg::Vec3 pos;
+            float norm;
+        };
+        std::vector<QuantizationError> GetQuantizationErrors() {
+            std::vector<QuantizationError> errs;
+            if (!isVertQuantized)
+                return errs;
+
+            for (auto &brick : bricks)
+                for (size_t l = 0; l < brick.surfs.size(); ++l) {
+                    auto &quantMesh = brick.surfs[l].GetRndrQuantMesh();
+                    if (quantMesh.verts->empty())
+                        continue;
+
+                    auto &err = errs.emplace_back();
+                    err.cellStart = brick.cellStart;
+                    err.lod = static_cast<int>(l);
+                    for (int a = 0; a < 3; ++a)
+                        err.pos[a] = quantMesh.maxPosErr[a] / voxSz[a];
+                    err.norm = quantMesh.maxNormErr;
+                }
+            return errs;
+        }
 
-                voxVertNums[i] = VertNumTable[cubeIdx];
+        void MarchingCube(float isoVal) { MarchingCube(std::vector<float>{isoVal}); }
+
+        /*
+         * Extracts nested surfaces in one sweep over the volume. Vertices are tagged by the rank
+         * of their isovalue in isoVals, mapped to [0, 1] in the isoLevel vertex attribute.
+         * Only bricks whose value range straddles a new or a previous isovalue are
+         * re-extracted, the others keep (or stay without) their geometry.
+         */
+        void MarchingCube(std::vector<float> isoVals) {
+            std::sort(isoVals.begin(), isoVals.end());
+            isoVals.erase(std::unique(isoVals.begin(), isoVals.end()), isoVals.end());
+            if (isoVals == this->isoVals)
+                return;
+            auto useCache = !meshCacheDir.empty() && !isoVals.empty();
+            if (useCache && loadMeshCache(isoVals)) {
+                this->isoVals = std::move(isoVals);
+                return;
             }
 
-            auto vertNum = std::accumulate(voxVertNums.begin(), voxVertNums.end(), 0);
-
-            auto cmptVerts = vertsBuf[(rndrVertsBufIdx + 1) & 1];
-            cmptVerts->clear();
-            cmptVerts->reserve(vertNum);
-            auto cmptNorms = normsBuf[(rndrVertsBufIdx + 1) & 1];
-            cmptNorms->clear();
-            cmptNorms->reserve(vertNum);
-
-            for (size_t i = 0; i < volDat->size(); ++i) {
-                if (voxVertNums[i] == 0)
-                    continue;
-
-                DimTy z = i / volDimYxX;
-                DimTy y = (i - z * volDimYxX) / volDim[0];
-                DimTy x = i - z * volDimYxX - y * volDim[0];
-
-                std::array<osg::Vec3, 8> v;
-                {
-                    osg::Vec3f p(x * voxSz.x(), y * voxSz.y(), z * voxSz.z());
-                    v[0] = p;
-                    v[1] = p + osg::Vec3(voxSz.x(), 0.f, 0.f);
-                    v[2] = p + osg::Vec3(voxSz.x(), voxSz.y(), 0.f);
-                    v[3] = p + osg::Vec3(0.f, voxSz.y(), 0.f);
-                    v[4] = p + osg::Vec3(0.f, 0.f, voxSz.z());
-                    v[5] = p + osg::Vec3(voxSz.x(), 0.f, voxSz.z());
-                    v[6] = p + osg::Vec3(voxSz.x(), voxSz.y(), voxSz.z());
-                    v[7] = p + osg::Vec3(0.f, voxSz.y(), voxSz.z());
+            auto isoLvls = getIsoLevels(isoVals);
+            std::vector<std::pair<Brick *, int>> dirtySurfs;
+            for (auto &brick : bricks)
+                if (brick.HasSurface() || brick.MayHaveSurface(isoLvls))
+                    for (size_t l = 0; l < brick.surfs.size(); ++l)
+                        dirtySurfs.emplace_back(&brick, static_cast<int>(l));
+            marchSurfaces(dirtySurfs, isoLvls);
+            if (useCache)
+                saveMeshCache(isoVals);
+
+            this->isoVals = std::move(isoVals);
+        }
+
+        /*
+         * Replaces the samples by those of another time step of the same dimensions, volDat
+         * may also be the previous buffer modified in place. Volumes are diffed by the hashes
+         * of their blocks of HashBlockLen^3 samples, and only the LOD levels of bricks that read
+         * a changed block are re-extracted with the current isovalues, the others keep their
+         * geometry. Diffing and the pyramid take a pass over the volume, extraction follows
+         * the change. Returns false and keeps the previous samples if volDat is null or not of
+         * the dimensions of the volume.
+         */
+        bool UpdateVolume(decltype(volDat) volDat, std::string *errMsg = nullptr) {
+            if (!volDat ||
+                volDat->size() != static_cast<size_t>(volDim[0]) * volDim[1] * volDim[2]) {
+                if (errMsg)
+                    *errMsg = std::format(
+                        "File:{} => Func:{} => Err: Volume is not of {}x{}x{} samples",
+                        std::source_location::current().file_name(),
+                        std::source_location::current().function_name(), volDim[0], volDim[1],
+                        volDim[2]);
+                return false;
+            }
+
+            this->volDat = volDat;
+            auto hashes = cmptBlockHashes();
+            std::vector<uint8_t> blockChanged(hashes.size());
+            auto isChanged = false;
+            for (size_t i = 0; i < hashes.size(); ++i) {
+                blockChanged[i] = hashes[i] != blockHashes[i];
+                isChanged |= blockChanged[i] != 0;
+            }
+            blockHashes = std::move(hashes);
+            if (!isChanged)
+                return true;
+
+            volHash = meshCacheDir.empty() ? 0 : HashVolume(*volDat);
+            updateLODDats(blockChanged);
+
+            // Level 0 reads one sample around the brick (for gradients and the extra cells of
+            // SurfaceNets). Level l reads coarse samples up to 2^l past the brick, each
+            // filtered from 2^l - 1 fine samples around it.
+            auto readsChangedBlock = [&](const Brick &brick, int margin) {
+                std::array<int, 3> blockMin, blockMax;
+                for (int a = 0; a < 3; ++a) {
+                    blockMin[a] = std::max(brick.cellStart[a] - margin, 0) / HashBlockLen;
+                    blockMax[a] = std::min(brick.cellStart[a] + brick.cellDim[a] + margin,
+                                           volDim[a] - 1) /
+                                  HashBlockLen;
                 }
-                auto field = cmptField(x, y, z);
-                auto cubeIdx = cmptCubeIdx(field);
-
-                std::array<osg::Vec3, 12> vertList;
-                auto vertInterp = [&](const osg::Vec3 &p0, const osg::Vec3 &p1, float f0,
-                                      float f1) {
-                    float t = (isoVal - f0) / (f1 - f0);
-                    auto dlt = p1 - p0;
-                    return osg::Vec3(p0.x() + t * dlt.x(), p0.y() + t * dlt.y(),
-                                     p0.z() + t * dlt.z());
-                };
-                vertList[0] = vertInterp(v[0], v[1], field[0], field[1]);
-                vertList[1] = vertInterp(v[1], v[2], field[1], field[2]);
-                vertList[2] = vertInterp(v[2], v[3], field[2], field[3]);
-                vertList[3] = vertInterp(v[3], v[0], field[3], field[0]);
-
-                vertList[4] = vertInterp(v[4], v[5], field[4], field[5]);
-                vertList[5] = vertInterp(v[5], v[6], field[5], field[6]);
-                vertList[6] = vertInterp(v[6], v[7], field[6], field[7]);
-                vertList[7] = vertInterp(v[7], v[4], field[7], field[4]);
-
-                vertList[8] = vertInterp(v[0], v[4], field[0], field[4]);
-                vertList[9] = vertInterp(v[1], v[5], field[1], field[5]);
-                vertList[10] = vertInterp(v[2], v[6], field[2], field[6]);
-                vertList[11] = vertInterp(v[3], v[7], field[3], field[7]);
-
-                auto vec3ToSphere = [&](const osg::Vec3 &v3) {
-                    auto deg2Rad = [](float deg) {
-                        return deg * static_cast<float>(std::numbers::pi) / 180.f;
-                    };
-
-                    auto dlt = deg2Rad(MaxLongtitute) - deg2Rad(MinLongtitute);
-                    auto lon = deg2Rad(MinLongtitute) + v3.x() * dlt;
-                    dlt = deg2Rad(MaxLatitute) - deg2Rad(MinLatitute);
-                    auto lat = deg2Rad(MinLatitute) + v3.y() * dlt;
-                    dlt = MaxHeight - MinHeight;
-                    auto h = MinHeight + v3.z() * dlt;
-
-                    osg::Vec3 ret;
-                    ret.z() = h * std::sinf(lat);
-                    h = h * std::cosf(lat);
-                    ret.y() = h * std::sinf(lon);
-                    ret.x() = h * std::cosf(lon);
-
-                    return ret;
-                };
-                for (uint32_t j = 0; j < voxVertNums[i]; j += 3) {
-                    auto edge = TriangleTable[cubeIdx][j];
-                    cmptVerts->push_back(vec3ToSphere(vertList[edge]));
-                    edge = TriangleTable[cubeIdx][j + 1];
-                    cmptVerts->push_back(vec3ToSphere(vertList[edge]));
-                    edge = TriangleTable[cubeIdx][j + 2];
-                    cmptVerts->push_back(vec3ToSphere(vertList[edge]));
-
-                    auto n = cmptVerts->size();
-                    auto e0 = (*cmptVerts)[n - 2] - (*cmptVerts)[n - 3];
-                    auto e1 = (*cmptVerts)[n - 1] - (*cmptVerts)[n - 3];
-                    e0 = e0 ^ e1;
-                    e0.normalize();
-                    cmptNorms->push_back(e0);
-                    cmptNorms->push_back(e0);
-                    cmptNorms->push_back(e0);
+                for (int z = blockMin[2]; z <= blockMax[2]; ++z)
+                    for (int y = blockMin[1]; y <= blockMax[1]; ++y)
+                        for (int x = blockMin[0]; x <= blockMax[0]; ++x)
+                            if (blockChanged[(static_cast<size_t>(z) * hashBlockNum[1] + y) *
+                                                 hashBlockNum[0] +
+                                             x])
+                                return true;
+                return false;
+            };
+            std::vector<std::pair<Brick *, int>> dirtySurfs;
+            for (auto &brick : bricks)
+                for (size_t l = 0; l < brick.surfs.size(); ++l)
+                    if (readsChangedBlock(brick, l == 0 ? 1 : 2 << l))
+                        dirtySurfs.emplace_back(&brick, static_cast<int>(l));
+            ParallelFor(0, dirtySurfs.size(), [&](size_t i) {
+                if (auto [brick, lod] = dirtySurfs[i]; lod == 0)
+                    cmptBrickRange(*brick);
+            });
+
+            if (isoVals.empty())
+                return true;
+            auto useCache = !meshCacheDir.empty();
+            if (useCache && loadMeshCache(isoVals))
+                return true;
+            marchSurfaces(dirtySurfs, getIsoLevels(isoVals));
+            if (useCache)
+                saveMeshCache(isoVals);
+            return true;
+        }
+
+        // gridPos is interpolated in grid space within the hit triangle
+        struct PickHit {
+            osg::Vec3d pos;
+            osg::Vec3 gridPos;
+            float isoVal;
+            double dist;
+        };
+        /*
+         * Nearest intersection of the ray orig + t * dir (t >= 0) with the full resolution
+         * surfaces, in ECEF like the nodes of GetGroup(). Only bricks whose bound the ray passes
+         * are tested, nearest first. Their BVHs are built here in parallel if their surfaces
+         * changed since the last pick, so the first pick after an extraction pays for them.
+         */
+        std::optional<PickHit> Pick(const osg::Vec3d &orig, const osg::Vec3d &dir) {
+            auto dirLen = dir.length();
+            if (dirLen == 0.)
+                return {};
+            auto unitDir = dir / dirLen;
+
+            auto intersectBound = [&](const osg::BoundingBox &bound, double &tEnter) {
+                if (!bound.valid())
+                    return false;
+                auto t0 = 0.;
+                auto t1 = std::numeric_limits<double>::max();
+                for (int a = 0; a < 3; ++a) {
+                    auto tNear = (bound._min[a] - orig[a]) / unitDir[a];
+                    auto tFar = (bound._max[a] - orig[a]) / unitDir[a];
+                    if (tNear > tFar)
+                        std::swap(tNear, tFar);
+                    t0 = std::max(t0, tNear);
+                    t1 = std::min(t1, tFar);
                 }
+                tEnter = t0;
+                return t0 <= t1;
+            };
+            std::vector<std::pair<double, Brick *>> cands;
+            for (auto &brick : bricks) {
+                double tEnter;
+                if (brick.surfs[0].hasSurf && intersectBound(brick.pickBound, tEnter))
+                    cands.emplace_back(tEnter, &brick);
             }
-
-            swapVertsBuf();
+            std::sort(cands.begin(), cands.end(),
+                      [](const auto &a, const auto &b) { return a.first < b.first; });
+
+            std::vector<Brick *> dirtyBricks;
+            for (auto [tEnter, brick] : cands)
+                if (brick->isBVHDirty)
+                    dirtyBricks.emplace_back(brick);
+            ParallelFor(0, dirtyBricks.size(), [&](size_t i) {
+                auto brick = dirtyBricks[i];
+                brick->bvhOrig = brick->pickBound.center();
+                brick->bvh.Build(brick->surfs[0].GetRndrMesh(), [&](const osg::Vec3 &p) {
+                    return geoExt.GridToECEF(p) - brick->bvhOrig;
+                });
+                brick->isBVHDirty = false;
+            });
+
+            MeshBVH::Hit nearest;
+            Brick *nearestBrick = nullptr;
+            for (auto [tEnter, brick] : cands) {
+                if (tEnter > nearest.t)
+                    break;
+                osg::Vec3 localOrig = orig - osg::Vec3d(brick->bvhOrig);
+                if (brick->bvh.Intersect(localOrig, unitDir, nearest))
+                    nearestBrick = brick;
+            }
+            if (!nearestBrick)
+                return {};
+
+            auto &mesh = nearestBrick->surfs[0].GetRndrMesh();
+            std::array<uint32_t, 3> ids;
+            for (int j = 0; j < 3; ++j)
+                ids[j] = mesh.idxs->empty() ? 3 * nearest.tri + j
+                                            : (*mesh.idxs)[3 * nearest.tri + j];
+
+            PickHit hit;
+            hit.dist = nearest.t;
+            hit.pos = orig + unitDir * hit.dist;
+            hit.gridPos = (*mesh.verts)[ids[0]] * (1.f - nearest.u - nearest.v) +
+                          (*mesh.verts)[ids[1]] * nearest.u + (*mesh.verts)[ids[2]] * nearest.v;
+            // Levels are the ranks of isovalues mapped to [0, 1]
+            auto level = (*mesh.levels)[ids[0]];
+            hit.isoVal = isoVals[isoVals.size() == 1
+                                     ? 0
+                                     : std::lround(level * (isoVals.size() - 1))];
+            return hit;
         }
 
         friend class MarchingCubeCPURenderer;
@@ -243,15 +967,15 @@ class MarchingCubeCPURenderer {
     void AddVolume(const std::string &name, decltype(PerVolumeParam::volDat) volDat,
                    const std::array<int, 3> &volDim) {
         if (auto itr = vols.find(name); itr != vols.end()) {
-            param.grp->removeChild(itr->second.geode);
+            param.grp->removeChild(itr->second.grp);
             vols.erase(itr);
         }
         auto opt = vols.emplace(std::piecewise_construct, std::forward_as_tuple(name),
                                 std::forward_as_tuple(volDat, volDim, &param));
-        param.grp->addChild(opt.first->second.geode);
+        param.grp->addChild(opt.first->second.grp);
     }
 
-    std::optional<decltype(vols)::iterator> GetVolume(const std::string &name) {
+    std::optional<typename decltype(vols)::iterator> GetVolume(const std::string &name) {
         auto itr = vols.find(name);
         if (itr == vols.end())
             return {};
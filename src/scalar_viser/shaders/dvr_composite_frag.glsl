@@ -0,0 +1,13 @@
+#version 130 core
+
+uniform sampler2D accTex;
+// Part of accTex rendered to, and the last texel center in it, against bleeding of the rest
+uniform vec2 accTexScale;
+uniform vec2 accTexMax;
+
+in vec2 screenCoord;
+
+void main() {
+    // Colors are premultiplied by their opacities
+    gl_FragColor = texture(accTex, min(screenCoord * accTexScale, accTexMax));
+}
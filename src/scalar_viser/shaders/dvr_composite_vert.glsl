@@ -0,0 +1,8 @@
+#version 130 core
+
+out vec2 screenCoord;
+
+void main() {
+    screenCoord = gl_Vertex.xy;
+    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+}
@@ -1,10 +1,57 @@
 #version 130 core
 
 uniform sampler3D volTex;
+#ifdef MULTI_VOLUME
+// Volumes are packed along z in volTex, and their transfer functions are the rows of tfTex.
+// Scales and offsets map normalized coordinates into the atlas, mins and maxs are the outer
+// texel centers of each volume, so that filtering never mixes in another volume.
+const int MaxVolNum = 8;
+uniform int volNum;
+uniform vec3 volAtlasScales[MaxVolNum];
+uniform vec3 volAtlasOffsets[MaxVolNum];
+uniform vec3 volAtlasMins[MaxVolNum];
+uniform vec3 volAtlasMaxs[MaxVolNum];
+uniform sampler2D tfTex;
+#else
 uniform sampler1D tfTex;
+#endif
+#ifdef VIRTUAL_VOLUME
+// volTex is a coarse version of the volume, sampled where bricks of the full resolution are not
+// resident in brickAtlas. Texels of pageTex hold the slot of their brick and 1 in alpha if it is.
+// Slots hold brickLen^3 voxels with an apron of one voxel on every side.
+uniform sampler3D brickAtlas;
+uniform sampler3D pageTex;
+uniform vec3 fullVolDim;
+uniform vec3 atlasDim;
+uniform float brickLen;
+#endif
+#ifdef ECEF_VOLUME
+// volTex is resampled over the ECEF box from ecefMin of ecefSize, with the scalars weighted by
+// the coverages of the volume in R and the coverages in G
+uniform vec3 ecefMin;
+uniform vec3 ecefSize;
+#endif
+uniform sampler3D occuTex;
+uniform vec3 occuBlockSz;
+#if !defined(MULTI_VOLUME) && !defined(ECEF_VOLUME)
+// Gradients in voxels, with directions in RGB and normalized magnitudes in A, if isShaded
+uniform bool isShaded;
+uniform sampler3D gradTex;
+// Ambient, diffuse, specular coefficients and shininess of the head light
+uniform vec4 shading;
+// Opacities are scaled by mix(1, gradient magnitude, gradMagOpacity), damping homogeneous media
+uniform float gradMagOpacity;
+#endif
 
 uniform vec3 eyePos;
-uniform float dt;
+// Step of the opacities in the transfer function
+uniform float refDt;
+// Steps span stepInPixels pixels at their distance from the eye, but not shorter than minDt
+uniform float pixelSpanPerDist;
+uniform float stepInPixels;
+// Fraction of the first step to offset rays by, varied between passes that are averaged
+uniform float rayOffset;
+uniform float minDt;
 
 uniform float minLatitute;
 uniform float maxLatitute;
@@ -15,6 +62,10 @@ uniform float maxHeight;
 
 in vec3 vertex;
 
+// Steps after samples more transparent than LowAlpha are LowAlphaStepScale times longer
+const float LowAlpha = .01f;
+const float LowAlphaStepScale = 2.f;
+
 vec3 intersectOuterSphere(vec3 p) {
     vec3 p2eDir = normalize(eyePos - p);
     vec3 p2c = -p;
@@ -36,7 +87,7 @@ Hit intersectInnerSphere(vec3 p, vec3 p2eDir) {
     float l = dot(p2eDir, p2c);
     if (l <= 0.f)
         return hit;
-    float m2 = maxHeight * maxHeight - l * l;
+    float m2 = dot(p, p) - l * l;
     float innerR2 = minHeight * minHeight;
     if (m2 >= innerR2)
         return hit;
@@ -50,9 +101,97 @@ Hit intersectInnerSphere(vec3 p, vec3 p2eDir) {
 float anotherIntersectionOuterSphere(vec3 p, vec3 p2eDir) {
     vec3 p2c = -p;
     float l = dot(p2eDir, p2c);
-    return 2.f * l;
+    float m2 = dot(p, p) - l * l;
+    return l + sqrt(max(maxHeight * maxHeight - m2, 0.f));
+}
+
+// Distance from a point to the nearest of the 6 surfaces bounding a box of blocks, whose
+// normalized range is [lo, hi). A step not longer than it stays inside the box.
+float distanceToBlockBound(vec3 lo, vec3 hi, float rXY, float r, float lat, float lon) {
+    float hDlt = maxHeight - minHeight;
+    float latDlt = maxLatitute - minLatitute;
+    float lonDlt = maxLongtitute - minLongtitute;
+
+    float dLon = min(lon - (minLongtitute + lo.x * lonDlt), minLongtitute + hi.x * lonDlt - lon);
+    float dLat = min(lat - (minLatitute + lo.y * latDlt), minLatitute + hi.y * latDlt - lat);
+    float dH = min(r - (minHeight + lo.z * hDlt), minHeight + hi.z * hDlt - r);
+    // Beyond a right angle, the nearest point of a meridian plane or a cone is on the axis
+    float halfPi = 1.5707963f;
+    return min(min(rXY * sin(min(dLon, halfPi)), r * sin(min(dLat, halfPi))), dH);
 }
 
+#ifdef MULTI_VOLUME
+// Media of all volumes mix at the sample, so that their transparencies multiply and their
+// colors are weighted by their opacities
+vec4 sampleVolumes(vec3 coord) {
+    vec3 colSum = vec3(0.f);
+    float alphaSum = 0.f;
+    float transparency = 1.f;
+    for (int i = 0; i < volNum; ++i) {
+        vec3 atlasCoord =
+            clamp(volAtlasOffsets[i] + coord * volAtlasScales[i], volAtlasMins[i], volAtlasMaxs[i]);
+        float scalar = texture(volTex, atlasCoord).r;
+        vec4 col = texture(tfTex, vec2(scalar, (float(i) + .5f) / float(volNum)));
+        colSum += col.a * col.rgb;
+        alphaSum += col.a;
+        transparency *= 1.f - col.a;
+    }
+    return vec4(colSum / max(alphaSum, 1e-6f), 1.f - transparency);
+}
+#endif
+
+#ifdef ECEF_VOLUME
+// Distance from p along d to the exit of the box [lo, hi)
+float distanceToBoxBound(vec3 lo, vec3 hi, vec3 p, vec3 d) {
+    vec3 tExits = (mix(lo, hi, step(0.f, d)) - p) / d;
+    return min(min(tExits.x, tExits.y), tExits.z);
+}
+#endif
+
+#if !defined(MULTI_VOLUME) && !defined(ECEF_VOLUME)
+// Lights col at pos in ECEF, coord in the volume, seen along d
+vec4 shade(vec4 col, vec3 pos, vec3 coord, vec3 d) {
+    vec4 grad = texture(gradTex, coord);
+    col.a *= mix(1.f, grad.a, gradMagOpacity);
+    if (grad.a == 0.f)
+        return col;
+
+    // Gradients in voxels are brought to ECEF through the spans of voxels along east, north
+    // and up at pos
+    float rXY = length(pos.xy);
+    float r = length(pos);
+    vec3 up = pos / r;
+    vec3 east = vec3(-pos.y, pos.x, 0.f) / max(rXY, 1e-6f);
+    vec3 north = cross(up, east);
+    vec3 voxSpans = vec3(rXY * (maxLongtitute - minLongtitute), r * (maxLatitute - minLatitute),
+                         maxHeight - minHeight) /
+                    vec3(textureSize(gradTex, 0));
+    vec3 g = (grad.rgb * 2.f - 1.f) / voxSpans;
+    vec3 n = normalize(g.x * east + g.y * north + g.z * up);
+
+    // Two-sided, as media have no outside
+    float cosTheta = abs(dot(n, d));
+    col.rgb = col.rgb * (shading.x + shading.y * cosTheta) + shading.z * pow(cosTheta, shading.w);
+    return col;
+}
+#endif
+
+#ifdef VIRTUAL_VOLUME
+float sampleScalar(vec3 coord) {
+    // Position in voxels of the full resolution, with voxel centers on integers
+    vec3 pos = clamp(coord * fullVolDim - .5f, vec3(0.f), fullVolDim - 1.f);
+    vec3 brickDim = ceil(fullVolDim / brickLen);
+    vec3 brick = min(floor(pos / brickLen), brickDim - 1.f);
+    vec4 page = texture(pageTex, (brick + .5f) / brickDim);
+    if (page.a < .5f)
+        return texture(volTex, coord).r;
+
+    vec3 slot = floor(page.rgb * 255.f + .5f);
+    vec3 atlasPos = slot * (brickLen + 2.f) + 1.f + (pos - brick * brickLen) + .5f;
+    return texture(brickAtlas, atlasPos / atlasDim).r;
+}
+#endif
+
 void main() {
 //#define TEST
 #ifdef TEST
@@ -99,8 +238,18 @@ void main() {
 
     gl_FragColor = vec4(1.f, 1.f, 1.f, 1.f);
 #else
+    if (dot(eyePos, eyePos) < minHeight * minHeight)
+        discard;
+
+    // The proxy only wraps the volume. Range tests and the exit are still taken from where rays
+    // enter the outer sphere, or from the eye inside it, as with a sphere proxy.
     vec3 d = normalize(vertex - eyePos);
-    vec3 pos = vertex;
+    float eyeL = dot(d, -eyePos);
+    float eyeC = dot(eyePos, eyePos) - maxHeight * maxHeight;
+    float tStart = eyeC > 0.f ? eyeL - sqrt(max(eyeL * eyeL - eyeC, 0.f)) : 0.f;
+    vec3 start = eyePos + tStart * d;
+
+    vec3 pos = start;
     float r = sqrt(pos.x * pos.x + pos.y * pos.y);
     float lat = atan(pos.z / r);
     float lon = atan(pos.y, pos.x);
@@ -114,13 +263,13 @@ void main() {
     if (lon > maxLongtitute)
         entryOutOfRng |= 8;
 
-    float tExit = anotherIntersectionOuterSphere(vertex, d);
-    Hit hitInner = intersectInnerSphere(vertex, d);
+    float tExit = anotherIntersectionOuterSphere(start, d);
+    Hit hitInner = intersectInnerSphere(start, d);
 
     if (hitInner.isHit != 0)
         tExit = hitInner.tEntry;
 
-    pos = vertex + tExit * d;
+    pos = start + tExit * d;
     r = sqrt(pos.x * pos.x + pos.y * pos.y);
     lat = atan(pos.z / r);
     lon = atan(pos.y, pos.x);
@@ -138,13 +287,43 @@ void main() {
     float lonDlt = maxLongtitute - minLongtitute;
 
     vec4 color = vec4(0, 0, 0, 0);
-    vec3 entry2Exit = pos - vertex;
+    vec3 entry2Exit = pos - start;
     float tMax = length(entry2Exit);
-    float tAcc = 0.f;
-    pos.xyz = vertex;
+    // Samples in front of the proxy are out of the volume
+    float tAcc = max(dot(vertex - start, d), 0.f);
+    if (tAcc > tMax)
+        discard;
+    ivec3 occuDim = textureSize(occuTex, 0);
+    float stepScale = 1.f;
+    tAcc += rayOffset * max(minDt, stepInPixels * pixelSpanPerDist * (tStart + tAcc));
+    pos.xyz = start + tAcc * d;
     do {
-        r = sqrt(pos.x * pos.x + pos.y * pos.y);
-        lat = atan(pos.z / r);
+        float dt = max(minDt, stepInPixels * pixelSpanPerDist * (tStart + tAcc)) * stepScale;
+
+#ifdef ECEF_VOLUME
+        // Samples are addressed linearly, out of the volume where the coverage is under half
+        vec3 coord = (pos - ecefMin) / ecefSize;
+        ivec3 blockIdx = clamp(ivec3(floor(coord / occuBlockSz)), ivec3(0), occuDim - 1);
+        float emptyDist = floor(texelFetch(occuTex, blockIdx, 0).r * 255.f + .5f);
+        if (emptyDist != 0.f) {
+            vec3 lo = ecefMin + (vec3(blockIdx) - (emptyDist - 1.f)) * occuBlockSz * ecefSize;
+            vec3 hi = ecefMin + (vec3(blockIdx) + emptyDist) * occuBlockSz * ecefSize;
+            float skip = max(dt, distanceToBoxBound(lo, hi, pos, d));
+            pos += skip * d;
+            tAcc += skip;
+            continue;
+        }
+
+        vec2 scalarCoverage = texture(volTex, coord).rg;
+        if (scalarCoverage.g < .5f) {
+            pos += dt * d;
+            tAcc += dt;
+            continue;
+        }
+        vec4 tfCol = texture(tfTex, scalarCoverage.r / scalarCoverage.g);
+#else
+        float rXY = sqrt(pos.x * pos.x + pos.y * pos.y);
+        lat = atan(pos.z / rXY);
         r = length(pos);
         lon = atan(pos.y, pos.x);
         if (lat < minLatitute || lat > maxLatitute || lon < minLongtitute || lon > maxLongtitute) {
@@ -153,20 +332,48 @@ void main() {
             continue;
         }
 
-        r = (r - minHeight) / hDlt;
-        lat = (lat - minLatitute) / latDlt;
-        lon = (lon - minLongtitute) / lonDlt;
+        vec3 coord = vec3((lon - minLongtitute) / lonDlt, (lat - minLatitute) / latDlt,
+                          (r - minHeight) / hDlt);
+        ivec3 blockIdx = clamp(ivec3(floor(coord / occuBlockSz)), ivec3(0), occuDim - 1);
+        float emptyDist = floor(texelFetch(occuTex, blockIdx, 0).r * 255.f + .5f);
+        if (emptyDist != 0.f) {
+            // Leaps over the cube of empty blocks around
+            vec3 lo = (vec3(blockIdx) - (emptyDist - 1.f)) * occuBlockSz;
+            vec3 hi = (vec3(blockIdx) + emptyDist) * occuBlockSz;
+            float skip = max(dt, distanceToBlockBound(lo, hi, rXY, r, lat, lon));
+            pos += skip * d;
+            tAcc += skip;
+            continue;
+        }
 
+        r = coord.z;
+        lat = coord.y;
+        lon = coord.x;
+
+#ifdef MULTI_VOLUME
+        vec4 tfCol = sampleVolumes(coord);
+#else
+#ifdef VIRTUAL_VOLUME
+        float scalar = sampleScalar(vec3(lon, lat, r));
+#else
         float scalar = texture(volTex, vec3(lon, lat, r)).r;
+#endif
         vec4 tfCol = texture(tfTex, scalar);
+        if (isShaded)
+            tfCol = shade(tfCol, pos, coord, d);
+#endif
+#endif
+        // Opacity correction, the sample covers dt instead of refDt
+        float alpha = 1.f - pow(1.f - tfCol.a, dt / refDt);
 
-        color.rgb = color.rgb + (1.f - color.a) * tfCol.a * tfCol.rgb;
-        color.a = color.a + (1.f - color.a) * tfCol.a;
+        color.rgb = color.rgb + (1.f - color.a) * alpha * tfCol.rgb;
+        color.a = color.a + (1.f - color.a) * alpha;
         if (color.a > .95f)
             break;
 
         pos += dt * d;
         tAcc += dt;
+        stepScale = tfCol.a < LowAlpha ? LowAlphaStepScale : 1.f;
     } while (tAcc < tMax);
 
     gl_FragColor = color;
@@ -2,7 +2,9 @@
 
 in vec3 vertex;
 in vec3 normal;
+in float level;
 
 void main() {
-	gl_FragColor = vec4(abs(normal), 1); 
+	// Surfaces of higher isovalues are darker, a single surface keeps level 0
+	gl_FragColor = vec4(abs(normal) * (1.f - .5f * level), 1); 
 }
@@ -1,10 +1,60 @@
 #version 130 core
 
+uniform float minLatitute;
+uniform float maxLatitute;
+uniform float minLongtitute;
+uniform float maxLongtitute;
+uniform float minHeight;
+uniform float maxHeight;
+
+uniform bool isVertQuantized;
+uniform vec3 quantBoxMin;
+uniform vec3 quantBoxExt;
+
+in float isoLevel;
+in vec2 octNormal;
+
 out vec3 vertex;
 out vec3 normal;
+out float level;
+
+vec3 decodeOctNormal(vec2 code) {
+    vec3 n = vec3(code, 1.f - abs(code.x) - abs(code.y));
+    if (n.z < 0.f)
+        n.xy = (1.f - abs(n.yx)) * vec2(n.x >= 0.f ? 1.f : -1.f, n.y >= 0.f ? 1.f : -1.f);
+    return normalize(n);
+}
 
 void main() {
-    vertex = gl_Vertex.xyz;
-    normal = gl_Normal;
-	gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;
+    // Quantized positions arrive in [0, 1] of the box of their brick through attribute 0,
+    // which aliases gl_Vertex
+    vec3 gridPos = gl_Vertex.xyz;
+    vec3 gridNorm = gl_Normal;
+    if (isVertQuantized) {
+        gridPos = quantBoxMin + gl_Vertex.xyz * quantBoxExt;
+        gridNorm = decodeOctNormal(max(octNormal, vec2(-1.f)));
+    }
+
+    // Vertices and normals are in normalized grid space, (x, y, z) -> (lon, lat, height)
+    float lonDlt = maxLongtitute - minLongtitute;
+    float latDlt = maxLatitute - minLatitute;
+    float hDlt = maxHeight - minHeight;
+    float lon = minLongtitute + gridPos.x * lonDlt;
+    float lat = minLatitute + gridPos.y * latDlt;
+    float h = minHeight + gridPos.z * hDlt;
+
+    vec3 up = vec3(cos(lat) * cos(lon), cos(lat) * sin(lon), sin(lat));
+    vec3 east = vec3(-sin(lon), cos(lon), 0.f);
+    vec3 north = vec3(-sin(lat) * cos(lon), -sin(lat) * sin(lon), cos(lat));
+    vec4 pos = vec4(h * up, 1.f);
+
+    // The Jacobian of the mapping is [east, north, up] * diag(scale),
+    // so normals are transformed by its inverse transpose [east, north, up] * diag(1 / scale)
+    vec3 scale = vec3(h * cos(lat) * lonDlt, h * latDlt, hDlt);
+    vec3 n = gridNorm / scale;
+
+    vertex = pos.xyz;
+    normal = normalize(n.x * east + n.y * north + n.z * up);
+    level = isoLevel;
+	gl_Position = gl_ModelViewProjectionMatrix * pos;
 }
@@ -0,0 +1,259 @@
+#ifndef SCIVIS_SCALAR_VISER_SURFACE_NETS_H
+#define SCIVIS_SCALAR_VISER_SURFACE_NETS_H
+
+#include <algorithm>
+#include <limits>
+
+#include <array>
+#include <vector>
+
+#include <osg/Array>
+#include <osg/BoundingBox>
+#include <osg/PrimitiveSet>
+
+#include "marching_cube_classifier.h"
+#include "marching_cube_kernel.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * Surface Nets (Gibson 1998) over cells [cellStart, cellStart + cellDim) of a volume whose
+ * lattice point i sits at i * voxSz. Every cell crossed by the surface gets one vertex, the
+ * mean of its edge crossings, and every crossed lattice edge joins the vertices of its 4 cells
+ * by a quad, split along its shorter diagonal. Normals are the gradients of the trilinear field
+ * of the cell at its vertex, and face lower values like the windings.
+ *
+ * A brick owns the lattice edges whose lower end lies in (cellStart, cellStart + cellDim] across
+ * the edge, so it also places the vertices of one more cell layer on its upper faces. Those are
+ * computed from the same samples as in the neighbouring brick, so their quads meet exactly.
+ *
+ * Pass 1 classifies the samples and numbers the crossed cells within each cell slab.
+ * Pass 2 counts the crossed lattice edges, one quad each, of each lattice slab.
+ * Pass 3 prefix-sums both counts into vertex and index offsets per slab.
+ * Pass 4 places the vertices of crossed cells, then writes the quads of each slab.
+ * Slabs are visited in z order on the calling thread. Only bricks run in parallel, as
+ * MarchingCubeCPURenderer extracts them.
+ */
+template <typename VoxTy>
+void SurfaceNetsCells(const VoxTy *volDat, const std::array<int, 3> &volDim,
+                      const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                      const osg::Vec3 &voxSz, const IsoLevel &isoLvl, SurfaceMesh &mesh) {
+    auto &classifier = MarchingCubeClassifier::Get();
+
+    auto isoVal = isoLvl.val;
+    auto nativeIsoVal = ToNativeIsoVal<VoxTy>(isoVal);
+    auto &verts = *mesh.verts;
+    auto &norms = *mesh.norms;
+    auto &levels = *mesh.levels;
+    auto &idxs = *mesh.idxs;
+
+    // Cells of the brick and of the extra layer, as far as the volume reaches
+    std::array<int, 3> extDim;
+    for (int a = 0; a < 3; ++a)
+        extDim[a] = std::min(cellDim[a] + 1, volDim[a] - 1 - cellStart[a]);
+    std::array<int, 3> sampleDim{extDim[0] + 1, extDim[1] + 1, extDim[2] + 1};
+
+    auto volDimYxX = static_cast<size_t>(volDim[1]) * volDim[0];
+    std::array<size_t, 3> sampleStrides{1, static_cast<size_t>(sampleDim[0]),
+                                        static_cast<size_t>(sampleDim[1]) * sampleDim[0]};
+    auto sampleIdx = [&](int x, int y, int z) {
+        return z * sampleStrides[2] + y * sampleStrides[1] + x;
+    };
+    auto cellIdx = [&](int x, int y, int z) {
+        return (static_cast<size_t>(z) * extDim[1] + y) * extDim[0] + x;
+    };
+    static constexpr std::array<std::array<int, 3>, 8> CornerOffsets{
+        {{0, 0, 0}, {1, 0, 0}, {0, 1, 0}, {1, 1, 0}, {0, 0, 1}, {1, 0, 1}, {0, 1, 1}, {1, 1, 1}}};
+    static constexpr std::array<std::array<uint8_t, 2>, 12> EdgeCorners{
+        {{0, 1}, {2, 3}, {4, 5}, {6, 7}, {0, 2}, {1, 3}, {4, 6}, {5, 7}, {0, 4}, {1, 5}, {2, 6},
+         {3, 7}}};
+
+    // Pass 1
+    std::vector<uint8_t> belowBits(sampleIdx(0, 0, sampleDim[2]));
+    for (int z = 0; z < sampleDim[2]; ++z)
+        for (int y = 0; y < sampleDim[1]; ++y)
+            classifier.ClassifyRow(volDat + (cellStart[2] + z) * volDimYxX +
+                                       static_cast<size_t>(cellStart[1] + y) * volDim[0] +
+                                       cellStart[0],
+                                   sampleDim[0], nativeIsoVal,
+                                   belowBits.data() + sampleIdx(0, y, z));
+
+    // Only whether a cell is crossed matters here, which the cube indices of MarchCells tell
+    static constexpr auto NoVert = std::numeric_limits<uint32_t>::max();
+    std::vector<uint32_t> cellVertIds(cellIdx(0, 0, extDim[2]), NoVert);
+    std::vector<uint32_t> slabVertOffs(extDim[2] + 1, 0);
+    {
+        auto cellDimYxX = static_cast<size_t>(extDim[1]) * extDim[0];
+        std::array<std::vector<uint8_t>, 2> sliceCodes{std::vector<uint8_t>(cellDimYxX),
+                                                       std::vector<uint8_t>(cellDimYxX)};
+        std::vector<uint8_t> cubeIdxs(extDim[0]);
+        auto cmptSliceCodes = [&](int z, std::vector<uint8_t> &codes) {
+            for (int y = 0; y < extDim[1]; ++y)
+                classifier.CmptFaceCodes(belowBits.data() + sampleIdx(0, y, z),
+                                         belowBits.data() + sampleIdx(0, y + 1, z), extDim[0],
+                                         codes.data() + y * extDim[0]);
+        };
+
+        cmptSliceCodes(0, sliceCodes[0]);
+        for (int z = 0; z < extDim[2]; ++z) {
+            cmptSliceCodes(z + 1, sliceCodes[(z + 1) & 1]);
+            uint32_t vertNum = 0;
+            for (int y = 0; y < extDim[1]; ++y) {
+                classifier.CmptCubeIdxs(sliceCodes[z & 1].data() + y * extDim[0],
+                                        sliceCodes[(z + 1) & 1].data() + y * extDim[0],
+                                        extDim[0], cubeIdxs.data());
+                auto ids = cellVertIds.data() + cellIdx(0, y, z);
+                for (int x = 0; x < extDim[0]; ++x)
+                    if (cubeIdxs[x] != 0 && cubeIdxs[x] != 0xff)
+                        ids[x] = vertNum++;
+            }
+            slabVertOffs[z + 1] = vertNum;
+        }
+    }
+
+    // Pass 2
+    // Lattice point p starts a quad edge along axis a if the edge lies in the brick, its 4 cells
+    // exist, and it crosses the surface. Lattice slab z holds the p with p[2] = z.
+    std::array<std::array<int, 3>, 3> quadEdgeLos, quadEdgeHis;
+    for (int a = 0; a < 3; ++a)
+        for (int b = 0; b < 3; ++b) {
+            quadEdgeLos[a][b] = b == a ? 0 : 1;
+            quadEdgeHis[a][b] = b == a ? cellDim[b] : std::min(cellDim[b] + 1, extDim[b]);
+        }
+    auto forEachQuadEdge = [&](int z, auto f) {
+        for (int a = 0; a < 3; ++a) {
+            if (z < quadEdgeLos[a][2] || z >= quadEdgeHis[a][2])
+                continue;
+            for (int y = quadEdgeLos[a][1]; y < quadEdgeHis[a][1]; ++y) {
+                auto bits = belowBits.data() + sampleIdx(0, y, z);
+                for (int x = quadEdgeLos[a][0]; x < quadEdgeHis[a][0]; ++x)
+                    if (bits[x] != bits[x + sampleStrides[a]])
+                        f(std::array{x, y, z}, a);
+            }
+        }
+    };
+    std::vector<uint32_t> slabQuadOffs(cellDim[2] + 2, 0);
+    for (int z = 0; z <= cellDim[2]; ++z)
+        forEachQuadEdge(z, [&](const std::array<int, 3> &, int) { ++slabQuadOffs[z + 1]; });
+
+    // Pass 3
+    auto vertOffs = static_cast<uint32_t>(verts.size());
+    slabVertOffs[0] = vertOffs;
+    for (size_t z = 1; z < slabVertOffs.size(); ++z)
+        slabVertOffs[z] += slabVertOffs[z - 1];
+    for (size_t z = 1; z < slabQuadOffs.size(); ++z)
+        slabQuadOffs[z] += slabQuadOffs[z - 1];
+    if (slabQuadOffs.back() == 0)
+        return;
+
+    auto idxOffs = idxs.size();
+    verts.resize(slabVertOffs.back());
+    norms.resize(slabVertOffs.back());
+    levels.resize(slabVertOffs.back(), isoLvl.level);
+    idxs.resize(idxOffs + 6 * static_cast<size_t>(slabQuadOffs.back()));
+
+    // Pass 4
+    for (int z = 0; z < extDim[2]; ++z)
+        for (int y = 0; y < extDim[1]; ++y)
+            for (int x = 0; x < extDim[0]; ++x) {
+                auto &id = cellVertIds[cellIdx(x, y, z)];
+                if (id == NoVert)
+                    continue;
+                id += slabVertOffs[z];
+
+                std::array<float, 8> field;
+                {
+                    auto p = volDat + (cellStart[2] + z) * volDimYxX +
+                             static_cast<size_t>(cellStart[1] + y) * volDim[0] + cellStart[0] + x;
+                    field[0] = p[0];
+                    field[1] = p[1];
+                    field[2] = p[volDim[0]];
+                    field[3] = p[volDim[0] + 1];
+                    p += volDimYxX;
+                    field[4] = p[0];
+                    field[5] = p[1];
+                    field[6] = p[volDim[0]];
+                    field[7] = p[volDim[0] + 1];
+                }
+
+                osg::Vec3 local;
+                auto crossNum = 0;
+                for (auto [c0, c1] : EdgeCorners) {
+                    if ((field[c0] < isoVal) == (field[c1] < isoVal))
+                        continue;
+                    auto t = (isoVal - field[c0]) / (field[c1] - field[c0]);
+                    for (int a = 0; a < 3; ++a)
+                        local[a] += CornerOffsets[c0][a] +
+                                    t * (CornerOffsets[c1][a] - CornerOffsets[c0][a]);
+                    ++crossNum;
+                }
+                local /= static_cast<float>(crossNum);
+
+                auto [u, v, w] = std::array{local.x(), local.y(), local.z()};
+                osg::Vec3 grad(
+                    (1.f - v) * (1.f - w) * (field[1] - field[0]) +
+                        v * (1.f - w) * (field[3] - field[2]) +
+                        (1.f - v) * w * (field[5] - field[4]) + v * w * (field[7] - field[6]),
+                    (1.f - u) * (1.f - w) * (field[2] - field[0]) +
+                        u * (1.f - w) * (field[3] - field[1]) +
+                        (1.f - u) * w * (field[6] - field[4]) + u * w * (field[7] - field[5]),
+                    (1.f - u) * (1.f - v) * (field[4] - field[0]) +
+                        u * (1.f - v) * (field[5] - field[1]) +
+                        (1.f - u) * v * (field[6] - field[2]) + u * v * (field[7] - field[3]));
+                auto n = -osg::Vec3(grad.x() / voxSz.x(), grad.y() / voxSz.y(),
+                                    grad.z() / voxSz.z());
+                n.normalize();
+
+                osg::Vec3 pos((cellStart[0] + x + local.x()) * voxSz.x(),
+                              (cellStart[1] + y + local.y()) * voxSz.y(),
+                              (cellStart[2] + z + local.z()) * voxSz.z());
+                verts[id] = pos;
+                norms[id] = n;
+                mesh.gridBox.expandBy(pos);
+            }
+
+    for (int z = 0; z <= cellDim[2]; ++z) {
+        auto idxItr = idxs.begin() + idxOffs + 6 * static_cast<size_t>(slabQuadOffs[z]);
+        forEachQuadEdge(z, [&](const std::array<int, 3> &p, int a) {
+            // Going around axis a from (u, v) = (-1, -1), the quad faces +a
+            auto u = (a + 1) % 3;
+            auto v = (a + 2) % 3;
+            std::array<uint32_t, 4> quad;
+            for (int i = 0; i < 4; ++i) {
+                auto c = p;
+                c[u] -= i == 0 || i == 3;
+                c[v] -= i < 2;
+                quad[i] = cellVertIds[cellIdx(c[0], c[1], c[2])];
+            }
+            if (belowBits[sampleIdx(p[0], p[1], p[2])])
+                std::swap(quad[1], quad[3]);
+
+            auto diag02 = (verts[quad[2]] - verts[quad[0]]).length2();
+            auto diag13 = (verts[quad[3]] - verts[quad[1]]).length2();
+            if (diag13 < diag02)
+                std::rotate(quad.begin(), quad.begin() + 1, quad.end());
+            for (auto i : {0, 1, 2, 0, 2, 3})
+                *idxItr++ = quad[i];
+        });
+    }
+}
+
+/*
+ * Appends the surface of each of isoLvls to mesh in turn. A cell crossed by several isovalues
+ * gets one vertex per surface, tagged by the level of its isovalue, and quads only join
+ * vertices of the same surface.
+ */
+template <typename VoxTy>
+void SurfaceNetsCells(const VoxTy *volDat, const std::array<int, 3> &volDim,
+                      const std::array<int, 3> &cellStart, const std::array<int, 3> &cellDim,
+                      const osg::Vec3 &voxSz, const std::vector<IsoLevel> &isoLvls,
+                      SurfaceMesh &mesh) {
+    for (auto &isoLvl : isoLvls)
+        SurfaceNetsCells(volDat, volDim, cellStart, cellDim, voxSz, isoLvl, mesh);
+}
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_SURFACE_NETS_H
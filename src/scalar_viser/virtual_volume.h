@@ -0,0 +1,274 @@
+#ifndef SCIVIS_SCALAR_VISER_VIRTUAL_VOLUME_H
+#define SCIVIS_SCALAR_VISER_VIRTUAL_VOLUME_H
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <mutex>
+
+#include <array>
+#include <vector>
+
+#include <osg/GLExtensions>
+#include <osg/Texture3D>
+
+#include <volume_loader/brick_loader.h>
+
+#include "brick_pager.h"
+#include "geo_mapping.h"
+
+namespace SciVis {
+namespace ScalarViser {
+
+/*
+ * A volume of full resolution paged into a fixed budget of texture memory. A coarse texture
+ * of the whole volume is always bound. Bricks of the full resolution are streamed by a
+ * BrickLoader into the slots of a physical atlas, as the BrickPager decides from where the
+ * camera looks, and a page table tells the shader which bricks are resident and where. Bricks
+ * not resident are sampled from the coarse texture instead.
+ */
+class VirtualVolume : public osg::Referenced {
+  public:
+    // Bricks asked from the loader per frame at most, which bounds the uploads per frame
+    static constexpr int MaxLoadNumPerFrame = 16;
+    // Slots per axis at most, as they are indexed by bytes in the page table
+    static constexpr int MaxSlotNumPerAxis = 255;
+    static constexpr int MaxAtlasLen = 2048;
+
+  private:
+    // Uploads the bricks pushed since the last draw into the atlas
+    class BrickSubload : public osg::Texture3D::SubloadCallback {
+      private:
+        std::array<int, 3> atlasDim;
+        int apronLen;
+
+        mutable std::mutex mtx;
+        mutable std::vector<std::pair<std::array<int, 3>, std::vector<float>>> pendings;
+
+      public:
+        BrickSubload(const std::array<int, 3> &atlasDim, int apronLen)
+            : atlasDim(atlasDim), apronLen(apronLen) {}
+
+        void Push(const std::array<int, 3> &origin, std::vector<float> &&dat) {
+            std::lock_guard lock(mtx);
+            pendings.emplace_back(origin, std::move(dat));
+        }
+
+        virtual void load(const osg::Texture3D &tex, osg::State &state) const override {
+            auto ext = state.get<osg::GLExtensions>();
+            ext->glTexImage3D(GL_TEXTURE_3D, 0, GL_R8, atlasDim[0], atlasDim[1], atlasDim[2], 0,
+                              GL_RED, GL_FLOAT, nullptr);
+            subload(tex, state);
+        }
+        virtual void subload(const osg::Texture3D &, osg::State &state) const override {
+            decltype(pendings) uploads;
+            {
+                std::lock_guard lock(mtx);
+                uploads.swap(pendings);
+            }
+
+            auto ext = state.get<osg::GLExtensions>();
+            for (auto &[origin, dat] : uploads)
+                ext->glTexSubImage3D(GL_TEXTURE_3D, 0, origin[0], origin[1], origin[2], apronLen,
+                                     apronLen, apronLen, GL_RED, GL_FLOAT, dat.data());
+        }
+    };
+
+    std::unique_ptr<VolumeLoader::BrickLoader> loader;
+    // Slots per axis of the atlas, which the pager is sized to
+    std::array<int, 3> slotDim;
+    BrickPager pager;
+    GeoExtent geoExt;
+
+    int apronLen;
+    // Full resolution voxels per coarse one
+    float coarseRatio;
+    std::vector<osg::BoundingBox> brickBounds;
+    std::vector<float> brickVoxSzs;
+
+    osg::ref_ptr<osg::Texture3D> coarseTex;
+    osg::ref_ptr<osg::Texture3D> atlasTex;
+    osg::ref_ptr<osg::Texture3D> pageTex;
+    osg::ref_ptr<osg::Image> pageImg;
+    osg::ref_ptr<BrickSubload> subload;
+
+  public:
+    /*
+     * coarseTex is the whole volume at a lower resolution, as from RawConvertor. Bricks of the
+     * atlas, with their aprons, take no more than budgetInBytes of one byte voxels.
+     */
+    VirtualVolume(std::unique_ptr<VolumeLoader::BrickLoader> loader,
+                  osg::ref_ptr<osg::Texture3D> coarseTex, size_t budgetInBytes)
+        : loader(std::move(loader)), slotDim(cmptSlotDimension(*this->loader, budgetInBytes)),
+          pager(cmptBrickNum(*this->loader), slotDim[0] * slotDim[1] * slotDim[2]),
+          coarseTex(coarseTex) {
+        auto &volDim = this->loader->GetVolumeDimension();
+        auto &brickDim = this->loader->GetBrickDimension();
+        auto brickLen = this->loader->GetBrickLength();
+        apronLen = brickLen + 2;
+
+        coarseRatio = 1.f;
+        if (auto coarseImg = coarseTex.valid() ? coarseTex->getImage() : nullptr; coarseImg)
+            coarseRatio = std::max({static_cast<float>(volDim[0]) / coarseImg->s(),
+                                    static_cast<float>(volDim[1]) / coarseImg->t(),
+                                    static_cast<float>(volDim[2]) / coarseImg->r()});
+
+        brickBounds.resize(pager.GetBrickNum());
+        brickVoxSzs.resize(pager.GetBrickNum());
+        for (int i = 0; i < pager.GetBrickNum(); ++i) {
+            std::array<int, 3> idx3{i % brickDim[0], i / brickDim[0] % brickDim[1],
+                                    i / (brickDim[0] * brickDim[1])};
+            osg::Vec3 gridMin, gridMax;
+            for (int a = 0; a < 3; ++a) {
+                gridMin[a] = static_cast<float>(idx3[a] * brickLen) / volDim[a];
+                gridMax[a] =
+                    std::min(static_cast<float>((idx3[a] + 1) * brickLen) / volDim[a], 1.f);
+            }
+            brickBounds[i] = geoExt.GridBoxToECEFBound(osg::BoundingBox(gridMin, gridMax));
+            // Diagonal of the brick over that of its voxels, spans of a voxel in ECEF
+            brickVoxSzs[i] = (brickBounds[i].corner(7) - brickBounds[i].corner(0)).length() /
+                             (brickLen * std::sqrt(3.f));
+        }
+
+        std::array atlasDim{slotDim[0] * apronLen, slotDim[1] * apronLen, slotDim[2] * apronLen};
+        subload = new BrickSubload(atlasDim, apronLen);
+        atlasTex = new osg::Texture3D;
+        atlasTex->setTextureSize(atlasDim[0], atlasDim[1], atlasDim[2]);
+        atlasTex->setInternalFormat(GL_R8);
+        atlasTex->setSourceFormat(GL_RED);
+        atlasTex->setSourceType(GL_FLOAT);
+        atlasTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+        atlasTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::LINEAR);
+        atlasTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        atlasTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        atlasTex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        atlasTex->setSubloadCallback(subload);
+
+        // RGB is the slot of a resident brick, A is 255 for it and 0 otherwise
+        pageImg = new osg::Image;
+        pageImg->allocateImage(brickDim[0], brickDim[1], brickDim[2], GL_RGBA, GL_UNSIGNED_BYTE);
+        pageImg->setInternalTextureFormat(GL_RGBA);
+        std::fill_n(pageImg->data(), static_cast<size_t>(pager.GetBrickNum()) * 4, 0);
+        pageTex = new osg::Texture3D;
+        pageTex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::NEAREST);
+        pageTex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+        pageTex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        pageTex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        pageTex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP_TO_EDGE);
+        pageTex->setInternalFormatMode(osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+        pageTex->setImage(pageImg);
+    }
+
+    osg::ref_ptr<osg::Texture3D> GetCoarseTexture() const { return coarseTex; }
+    osg::ref_ptr<osg::Texture3D> GetAtlasTexture() const { return atlasTex; }
+    osg::ref_ptr<osg::Texture3D> GetPageTexture() const { return pageTex; }
+    osg::Vec3 GetVolumeDimension() const {
+        auto &volDim = loader->GetVolumeDimension();
+        return osg::Vec3(volDim[0], volDim[1], volDim[2]);
+    }
+    osg::Vec3 GetAtlasDimension() const {
+        return osg::Vec3(slotDim[0] * apronLen, slotDim[1] * apronLen, slotDim[2] * apronLen);
+    }
+    int GetBrickLength() const { return loader->GetBrickLength(); }
+    const BrickPager &GetPager() const { return pager; }
+
+    /*
+     * Takes in the bricks loaded since the last frame, then requests the bricks whose coarse
+     * voxels span more than a pixel in the view, larger spans first. Returns true if bricks were
+     * made resident or evicted, which changes what the volume samples.
+     */
+    bool Update(const osg::Matrixd &modelView, const osg::Matrixd &proj,
+                const osg::Viewport &viewport) {
+        for (auto &brick : loader->TakeLoaded()) {
+            if (pager.GetSlot(brick.idx) != BrickPager::NonResident)
+                continue;
+            if (auto slot = pager.Commit(brick.idx); slot != BrickPager::NonResident)
+                subload->Push(getSlotOrigin(slot), std::move(brick.dat));
+        }
+
+        pager.BeginFrame();
+        requestVisibleBricks(modelView, proj, viewport);
+        loader->Request(pager.EndFrame(MaxLoadNumPerFrame));
+
+        if (pager.TakeSlotsChanged()) {
+            auto entry = pageImg->data();
+            for (auto slot : pager.GetBrickSlots()) {
+                if (slot == BrickPager::NonResident)
+                    std::fill_n(entry, 4, 0);
+                else {
+                    entry[0] = static_cast<uint8_t>(slot % slotDim[0]);
+                    entry[1] = static_cast<uint8_t>(slot / slotDim[0] % slotDim[1]);
+                    entry[2] = static_cast<uint8_t>(slot / (slotDim[0] * slotDim[1]));
+                    entry[3] = 255;
+                }
+                entry += 4;
+            }
+            pageImg->dirty();
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    static int cmptBrickNum(const VolumeLoader::BrickLoader &loader) {
+        auto &brickDim = loader.GetBrickDimension();
+        return brickDim[0] * brickDim[1] * brickDim[2];
+    }
+    // Slots fill the atlas x-fastest, within the budget and MaxAtlasLen on each axis
+    static std::array<int, 3> cmptSlotDimension(const VolumeLoader::BrickLoader &loader,
+                                                size_t budgetInBytes) {
+        auto apronLen = static_cast<size_t>(loader.GetBrickLength() + 2);
+        auto slotNum = std::min(budgetInBytes / (apronLen * apronLen * apronLen),
+                                static_cast<size_t>(cmptBrickNum(loader)));
+        return BrickPager::CmptSlotDimension(
+            static_cast<int>(slotNum),
+            std::min(MaxSlotNumPerAxis, MaxAtlasLen / static_cast<int>(apronLen)));
+    }
+
+    std::array<int, 3> getSlotOrigin(uint32_t slot) const {
+        return {static_cast<int>(slot % slotDim[0]) * apronLen,
+                static_cast<int>(slot / slotDim[0] % slotDim[1]) * apronLen,
+                static_cast<int>(slot / (slotDim[0] * slotDim[1])) * apronLen};
+    }
+
+    void requestVisibleBricks(const osg::Matrixd &modelView, const osg::Matrixd &proj,
+                              const osg::Viewport &viewport) {
+        auto isPersp = proj(3, 3) == 0.;
+        auto vpH = std::max(viewport.height(), 1.);
+        // Span of a pixel at a unit distance in perspective views, or at any in orthographic
+        auto pixelSpan = 2. / (proj(1, 1) * vpH);
+        auto eyePos = osg::Matrixd::inverse(modelView).getTrans();
+        auto mvp = modelView * proj;
+
+        for (int i = 0; i < pager.GetBrickNum(); ++i) {
+            auto &bound = brickBounds[i];
+            if (isOutOfFrustum(bound, mvp))
+                continue;
+
+            auto centerDist = (osg::Vec3d(bound.center()) - eyePos).length();
+            auto dist = std::max(centerDist - static_cast<double>(bound.radius()), 1.);
+            auto pixels = brickVoxSzs[i] * coarseRatio / (isPersp ? pixelSpan * dist : pixelSpan);
+            if (pixels > 1.)
+                pager.Request(i, static_cast<float>(pixels));
+        }
+    }
+
+    static bool isOutOfFrustum(const osg::BoundingBox &bound, const osg::Matrixd &mvp) {
+        // Outside if all corners are beyond one of the clipping planes
+        std::array<int, 6> outNums{0, 0, 0, 0, 0, 0};
+        for (int c = 0; c < 8; ++c) {
+            auto corner = bound.corner(c);
+            auto clip = osg::Vec4d(corner.x(), corner.y(), corner.z(), 1.) * mvp;
+            for (int a = 0; a < 3; ++a) {
+                outNums[2 * a] += clip[a] < -clip.w() ? 1 : 0;
+                outNums[2 * a + 1] += clip[a] > clip.w() ? 1 : 0;
+            }
+        }
+        return std::find(outNums.begin(), outNums.end(), 8) != outNums.end();
+    }
+};
+
+} // namespace ScalarViser
+} // namespace SciVis
+
+#endif // !SCIVIS_SCALAR_VISER_VIRTUAL_VOLUME_H
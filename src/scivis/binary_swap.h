@@ -0,0 +1,111 @@
+#ifndef SCIVIS_BINARY_SWAP_H
+#define SCIVIS_BINARY_SWAP_H
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+
+#include <optional>
+#include <utility>
+#include <vector>
+
+#include "communicator.h"
+
+namespace SciVis {
+
+/*
+ * Sort-last compositing of images rendered by the ranks of comm, whose number should be a power
+ * of 2. Each image holds pxNum RGBA pixels of colors premultiplied by their opacities. At stage
+ * k, rank r holds the composite of ranks [r >> k << k, +2^k) over its part of the image, trades
+ * half of that part with rank r ^ 2^k, and composites the half it keeps. isLowerInFront(s)
+ * tells whether the ranks below s are in front of those from s on, for the two blocks of ranks
+ * meeting at s. Returns the range of pixels composited over all ranks, which is left in rgba,
+ * or none if a message was lost, after which rgba is not valid.
+ */
+template <typename IsLowerInFrontFuncTy>
+std::optional<std::pair<size_t, size_t>> BinarySwapComposite(Communicator &comm, float *rgba,
+                                                             size_t pxNum,
+                                                             IsLowerInFrontFuncTy isLowerInFront) {
+    auto rank = comm.GetRank();
+    auto rankNum = comm.GetRankNum();
+
+    size_t begin = 0;
+    size_t end = pxNum;
+    std::vector<float> recved;
+    for (int bit = 1; bit < rankNum; bit <<= 1) {
+        auto partner = rank ^ bit;
+        auto isLower = (rank & bit) == 0;
+        auto mid = begin + (end - begin) / 2;
+        auto [keptBeg, keptEnd] = isLower ? std::pair(begin, mid) : std::pair(mid, end);
+        auto [sentBeg, sentEnd] = isLower ? std::pair(mid, end) : std::pair(begin, mid);
+
+        // The lower rank sends first, so that blocking sends do not wait on each other
+        recved.resize((keptEnd - keptBeg) * 4);
+        auto sendHalf = [&]() {
+            return comm.Send(partner, rgba + sentBeg * 4, (sentEnd - sentBeg) * 4 * sizeof(float));
+        };
+        auto recvHalf = [&]() {
+            return comm.Recv(partner, recved.data(), recved.size() * sizeof(float));
+        };
+        if (isLower ? !sendHalf() || !recvHalf() : !recvHalf() || !sendHalf())
+            return std::nullopt;
+
+        auto isMineInFront = isLowerInFront((rank & ~(2 * bit - 1)) | bit) == isLower;
+        auto mine = rgba + keptBeg * 4;
+        for (size_t i = 0; i < keptEnd - keptBeg; ++i) {
+            auto front = isMineInFront ? mine + i * 4 : recved.data() + i * 4;
+            auto back = isMineInFront ? recved.data() + i * 4 : mine + i * 4;
+            auto transparency = 1.f - front[3];
+            for (int c = 0; c < 4; ++c)
+                mine[i * 4 + c] = front[c] + transparency * back[c];
+        }
+
+        begin = keptBeg;
+        end = keptEnd;
+    }
+
+    return std::pair(begin, end);
+}
+
+// Range of pixels BinarySwapComposite leaves composited in rank of rankNum
+inline std::pair<size_t, size_t> GetBinarySwapRange(int rank, int rankNum, size_t pxNum) {
+    size_t begin = 0;
+    size_t end = pxNum;
+    for (int bit = 1; bit < rankNum; bit <<= 1) {
+        auto mid = begin + (end - begin) / 2;
+        if ((rank & bit) == 0)
+            end = mid;
+        else
+            begin = mid;
+    }
+    return {begin, end};
+}
+
+/*
+ * Collects the ranges composited by BinarySwapComposite into rgba of rootRank. Returns false if
+ * a message was lost, after which rgba of rootRank is not valid.
+ */
+inline bool GatherBinarySwap(Communicator &comm, float *rgba, size_t pxNum, int rootRank = 0) {
+    auto rank = comm.GetRank();
+    auto rankNum = comm.GetRankNum();
+    if (rank != rootRank) {
+        auto [begin, end] = GetBinarySwapRange(rank, rankNum, pxNum);
+        return comm.Send(rootRank, rgba + begin * 4, (end - begin) * 4 * sizeof(float));
+    }
+
+    for (int r = 0; r < rankNum; ++r)
+        if (r != rootRank) {
+            auto [begin, end] = GetBinarySwapRange(r, rankNum, pxNum);
+            if (!comm.Recv(r, rgba + begin * 4, (end - begin) * 4 * sizeof(float)))
+                return false;
+        }
+    return true;
+}
+
+inline bool IsBinarySwappable(int rankNum) {
+    return rankNum > 0 && std::has_single_bit(static_cast<unsigned>(rankNum));
+}
+
+} // namespace SciVis
+
+#endif // !SCIVIS_BINARY_SWAP_H
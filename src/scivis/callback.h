@@ -2,6 +2,7 @@
 #define SCIVIS_CALLBACK_H
 
 #include <osg/Camera>
+#include <osg/FrameStamp>
 #include <osg/Uniform>
 
 namespace SciVis {
@@ -9,15 +10,33 @@ namespace SciVis {
 class MCallback : public osg::NodeCallback {
   private:
     osg::ref_ptr<osg::Uniform> M;
+    osg::Matrixf lastM;
+    bool isSet = false;
+    unsigned int lastFrameNum = ~0u;
 
   public:
     MCallback(osg::ref_ptr<osg::Uniform> M) : M(M) {}
     virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+        // World matrices are walked up the parents at most once per frame, whatever the
+        // traversals of the node in it
+        if (auto frameStamp = nv->getFrameStamp(); frameStamp) {
+            if (isSet && frameStamp->getFrameNumber() == lastFrameNum) {
+                traverse(node, nv);
+                return;
+            }
+            lastFrameNum = frameStamp->getFrameNumber();
+        }
+
         auto mats = node->getWorldMatrices();
         osg::Matrixd l2w = mats[0];
         for (uint32_t i = 1; i < mats.size(); ++i)
             l2w *= mats[i];
-        M->set(osg::Matrixf(l2w));
+        // Uploads only on changes, as most nodes do not move between frames
+        if (osg::Matrixf newM(l2w); !isSet || newM != lastM) {
+            lastM = newM;
+            isSet = true;
+            M->set(newM);
+        }
 
         traverse(node, nv);
     }
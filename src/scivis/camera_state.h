@@ -0,0 +1,97 @@
+#ifndef SCIVIS_CAMERA_STATE_H
+#define SCIVIS_CAMERA_STATE_H
+
+#include <osg/CullStack>
+#include <osg/FrameStamp>
+#include <osg/NodeCallback>
+#include <osg/StateSet>
+#include <osg/Uniform>
+
+namespace SciVis {
+
+/*
+ * Camera state of the frame, as uniforms shared by the state sets of any number of renderers.
+ * It is refreshed by a cull callback on the group of each renderer, not on each drawable, and
+ * at most once per frame and viewport, so that cull time does not grow with the number of
+ * volumes. Uniforms are set only when their values change, so that a still camera costs no
+ * upload. Values are taken in the coordinates of the group, which are ECEF here.
+ */
+class CameraState : public osg::Referenced {
+  private:
+    unsigned int lastFrameNum = ~0u;
+    const osg::Viewport *lastViewport = nullptr;
+
+    osg::Vec3 lastEyePos;
+    float lastPixelSpanPerDist = 0.f;
+
+  public:
+    osg::ref_ptr<osg::Uniform> eyePos;
+    // Span of a pixel per unit of distance from the eye in perspective views, 0 in orthographic
+    // ones, in which the span of a pixel does not change with the distance
+    osg::ref_ptr<osg::Uniform> pixelSpanPerDist;
+
+    class Callback : public osg::NodeCallback {
+      private:
+        osg::ref_ptr<CameraState> state;
+
+      public:
+        Callback(osg::ref_ptr<CameraState> state) : state(state) {}
+        virtual void operator()(osg::Node *node, osg::NodeVisitor *nv) {
+            state->Update(nv);
+            traverse(node, nv);
+        }
+    };
+
+    CameraState() {
+#define STATEMENT(name, val)                                                                       \
+    name = new osg::Uniform(#name, val);                                                           \
+    name->setDataVariance(osg::Object::DYNAMIC)
+        STATEMENT(eyePos, lastEyePos);
+        STATEMENT(pixelSpanPerDist, lastPixelSpanPerDist);
+#undef STATEMENT
+    }
+
+    // Binds the uniforms to states, and refreshes them on the cull traversal of node
+    void Attach(osg::Node *node) {
+        auto states = node->getOrCreateStateSet();
+        states->setDataVariance(osg::Object::DYNAMIC);
+        states->addUniform(eyePos);
+        states->addUniform(pixelSpanPerDist);
+        node->addCullCallback(new Callback(this));
+    }
+
+    void Update(osg::NodeVisitor *nv) {
+        auto cs = dynamic_cast<osg::CullStack *>(nv);
+        if (!cs || !cs->getProjectionMatrix() || !cs->getViewport())
+            return;
+
+        // Renderers sharing the state are culled in the same frame with the same camera
+        auto viewport = cs->getViewport();
+        if (auto frameStamp = nv->getFrameStamp(); frameStamp) {
+            if (frameStamp->getFrameNumber() == lastFrameNum && viewport == lastViewport)
+                return;
+            lastFrameNum = frameStamp->getFrameNumber();
+            lastViewport = viewport;
+        }
+
+        auto eyePosVal = nv->getEyePoint();
+        if (eyePosVal != lastEyePos) {
+            lastEyePos = eyePosVal;
+            eyePos->set(eyePosVal);
+        }
+
+        // A pixel spans 2 / (P11 * viewport height) per unit of distance in perspective views
+        auto &proj = *cs->getProjectionMatrix();
+        auto vpH = viewport->height();
+        auto pixelSpanPerDistVal =
+            proj(3, 3) == 0. && vpH > 0. ? static_cast<float>(2. / (proj(1, 1) * vpH)) : 0.f;
+        if (pixelSpanPerDistVal != lastPixelSpanPerDist) {
+            lastPixelSpanPerDist = pixelSpanPerDistVal;
+            pixelSpanPerDist->set(pixelSpanPerDistVal);
+        }
+    }
+};
+
+} // namespace SciVis
+
+#endif // !SCIVIS_CAMERA_STATE_H
@@ -0,0 +1,334 @@
+#ifndef SCIVIS_COMMUNICATOR_H
+#define SCIVIS_COMMUNICATOR_H
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <thread>
+
+#include <deque>
+#include <vector>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#pragma comment(lib, "Ws2_32.lib")
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+namespace SciVis {
+
+/*
+ * Blocking point-to-point messages between the ranks of a group, as the compositing of
+ * renderers in several processes needs. Messages between two ranks arrive in their order, and
+ * are received with the sizes they were sent with. Send and Recv return false if the message
+ * could not be passed whole, e.g. as the peer is gone, after which the buffer is not valid.
+ */
+class Communicator {
+  public:
+    virtual ~Communicator() {}
+
+    virtual int GetRank() const = 0;
+    virtual int GetRankNum() const = 0;
+    virtual bool Send(int dstRank, const void *dat, size_t size) = 0;
+    virtual bool Recv(int srcRank, void *dat, size_t size) = 0;
+};
+
+/*
+ * Ranks as threads of one process, passing messages through shared memory. Sends never block.
+ */
+class SharedMemoryCommunicator : public Communicator {
+  private:
+    struct Group {
+        int rankNum;
+        std::mutex mtx;
+        std::condition_variable cv;
+        // Messages from rank src to rank dst at [src * rankNum + dst]
+        std::vector<std::deque<std::vector<uint8_t>>> mailboxes;
+    };
+
+    int rank;
+    std::shared_ptr<Group> grp;
+
+    SharedMemoryCommunicator(int rank, std::shared_ptr<Group> grp) : rank(rank), grp(grp) {}
+
+  public:
+    // Communicators of ranks [0, rankNum) of a new group
+    static std::vector<std::unique_ptr<SharedMemoryCommunicator>> CreateGroup(int rankNum) {
+        auto grp = std::make_shared<Group>();
+        grp->rankNum = rankNum;
+        grp->mailboxes.resize(static_cast<size_t>(rankNum) * rankNum);
+
+        std::vector<std::unique_ptr<SharedMemoryCommunicator>> comms;
+        for (int r = 0; r < rankNum; ++r)
+            comms.emplace_back(new SharedMemoryCommunicator(r, grp));
+        return comms;
+    }
+
+    virtual int GetRank() const override { return rank; }
+    virtual int GetRankNum() const override { return grp->rankNum; }
+
+    virtual bool Send(int dstRank, const void *dat, size_t size) override {
+        if (dstRank < 0 || dstRank >= grp->rankNum)
+            return false;
+
+        auto src = reinterpret_cast<const uint8_t *>(dat);
+        {
+            std::lock_guard lock(grp->mtx);
+            grp->mailboxes[static_cast<size_t>(rank) * grp->rankNum + dstRank].emplace_back(
+                src, src + size);
+        }
+        grp->cv.notify_all();
+        return true;
+    }
+    virtual bool Recv(int srcRank, void *dat, size_t size) override {
+        if (srcRank < 0 || srcRank >= grp->rankNum)
+            return false;
+
+        auto &mailbox = grp->mailboxes[static_cast<size_t>(srcRank) * grp->rankNum + rank];
+        std::vector<uint8_t> msg;
+        {
+            std::unique_lock lock(grp->mtx);
+            grp->cv.wait(lock, [&]() { return !mailbox.empty(); });
+            msg = std::move(mailbox.front());
+            mailbox.pop_front();
+        }
+        std::memcpy(dat, msg.data(), std::min(size, msg.size()));
+        return msg.size() == size;
+    }
+};
+
+/*
+ * Ranks as processes on one machine or several, connected pairwise by TCP. Rank r listens on
+ * basePort + r of hosts[r]. Sends block once the buffers of the socket are full, so that two
+ * ranks sending large messages to each other at once may deadlock. The lower one should send
+ * first.
+ */
+class SocketCommunicator : public Communicator {
+  public:
+    static constexpr int ConnectTimeoutInSec = 30;
+
+  private:
+#ifdef _WIN32
+    using SocketTy = SOCKET;
+    static constexpr SocketTy InvalidSocket = INVALID_SOCKET;
+    static constexpr int SendFlags = 0;
+    static void closeSocket(SocketTy sock) { closesocket(sock); }
+    static bool isInterrupted() { return WSAGetLastError() == WSAEINTR; }
+    static int pollSocket(pollfd *fd, int timeoutInMs) { return WSAPoll(fd, 1, timeoutInMs); }
+#else
+    using SocketTy = int;
+    static constexpr SocketTy InvalidSocket = -1;
+    // A peer gone makes send fail instead of raising SIGPIPE, which would end the process
+#ifdef MSG_NOSIGNAL
+    static constexpr int SendFlags = MSG_NOSIGNAL;
+#else
+    static constexpr int SendFlags = 0;
+#endif
+    static void closeSocket(SocketTy sock) { close(sock); }
+    static bool isInterrupted() { return errno == EINTR; }
+    static int pollSocket(pollfd *fd, int timeoutInMs) { return poll(fd, 1, timeoutInMs); }
+#endif
+
+    int rank;
+    std::vector<SocketTy> socks;
+
+    SocketCommunicator(int rank, int rankNum) : rank(rank), socks(rankNum, InvalidSocket) {}
+
+  public:
+    /*
+     * Connects rank to all others of rankNum ranks, whose processes should call it as well,
+     * and waits up to ConnectTimeoutInSec for them. hosts holds the IPv4 address of each rank.
+     */
+    static std::unique_ptr<SocketCommunicator> Connect(int rank,
+                                                       const std::vector<std::string> &hosts,
+                                                       uint16_t basePort,
+                                                       std::string *errMsg = nullptr) {
+        auto reportErr = [&](const std::string &err) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), err);
+            return nullptr;
+        };
+#ifdef _WIN32
+        static const auto isStarted = []() {
+            WSADATA wsaDat;
+            return WSAStartup(MAKEWORD(2, 2), &wsaDat) == 0;
+        }();
+        if (!isStarted)
+            return reportErr("Cannot start Winsock");
+#endif
+
+        auto rankNum = static_cast<int>(hosts.size());
+        if (rank < 0 || rank >= rankNum)
+            return reportErr(std::format("Rank {} is out of {} hosts", rank, rankNum));
+        auto cmptAddr = [&](int r) {
+            sockaddr_in addr{};
+            addr.sin_family = AF_INET;
+            addr.sin_port = htons(static_cast<uint16_t>(basePort + r));
+            inet_pton(AF_INET, hosts[r].c_str(), &addr.sin_addr);
+            return addr;
+        };
+
+        std::unique_ptr<SocketCommunicator> comm(new SocketCommunicator(rank, rankNum));
+
+        // Higher ranks connect to lower ones, which accept them
+        auto listenSock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (listenSock == InvalidSocket)
+            return reportErr("Cannot create socket");
+        {
+            int isReused = 1;
+            setsockopt(listenSock, SOL_SOCKET, SO_REUSEADDR,
+                       reinterpret_cast<const char *>(&isReused), sizeof(isReused));
+            auto addr = cmptAddr(rank);
+            addr.sin_addr.s_addr = htonl(INADDR_ANY);
+            if (bind(listenSock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) != 0 ||
+                listen(listenSock, rankNum) != 0) {
+                closeSocket(listenSock);
+                return reportErr(std::format("Cannot listen on port {}", basePort + rank));
+            }
+        }
+
+        auto deadline =
+            std::chrono::steady_clock::now() + std::chrono::seconds(ConnectTimeoutInSec);
+        for (int r = 0; r < rank; ++r) {
+            auto addr = cmptAddr(r);
+            while (true) {
+                auto sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+                if (connect(sock, reinterpret_cast<sockaddr *>(&addr), sizeof(addr)) == 0) {
+                    comm->socks[r] = sock;
+                    break;
+                }
+                closeSocket(sock);
+                if (std::chrono::steady_clock::now() > deadline) {
+                    closeSocket(listenSock);
+                    return reportErr(std::format("Cannot connect to rank {} at {}:{}", r,
+                                                 hosts[r], basePort + r));
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+            }
+            comm->setUpSocket(r);
+            int32_t myRank = rank;
+            if (!comm->Send(r, &myRank, sizeof(myRank))) {
+                closeSocket(listenSock);
+                return reportErr(std::format("Cannot send to rank {}", r));
+            }
+        }
+        for (int i = rank + 1; i < rankNum; ++i) {
+            auto sock = waitReadable(listenSock, deadline) ? accept(listenSock, nullptr, nullptr)
+                                                           : InvalidSocket;
+            int32_t peerRank = -1;
+            if (sock != InvalidSocket && (!waitReadable(sock, deadline) ||
+                                          !recvAll(sock, &peerRank, sizeof(peerRank))))
+                peerRank = -1;
+            if (peerRank <= rank || peerRank >= rankNum ||
+                comm->socks[peerRank] != InvalidSocket) {
+                if (sock != InvalidSocket)
+                    closeSocket(sock);
+                closeSocket(listenSock);
+                return reportErr("Cannot accept connections of higher ranks");
+            }
+            comm->socks[peerRank] = sock;
+            comm->setUpSocket(peerRank);
+        }
+        closeSocket(listenSock);
+
+        return comm;
+    }
+
+    ~SocketCommunicator() {
+        for (auto sock : socks)
+            if (sock != InvalidSocket)
+                closeSocket(sock);
+    }
+
+    virtual int GetRank() const override { return rank; }
+    virtual int GetRankNum() const override { return static_cast<int>(socks.size()); }
+
+    virtual bool Send(int dstRank, const void *dat, size_t size) override {
+        if (dstRank < 0 || dstRank >= static_cast<int>(socks.size()) ||
+            socks[dstRank] == InvalidSocket)
+            return false;
+
+        auto src = reinterpret_cast<const char *>(dat);
+        while (size > 0) {
+            auto sent = send(socks[dstRank], src, static_cast<int>(std::min(size, ChunkSz)),
+                             SendFlags);
+            if (sent < 0 && isInterrupted())
+                continue;
+            if (sent <= 0)
+                return false;
+            src += sent;
+            size -= sent;
+        }
+        return true;
+    }
+    virtual bool Recv(int srcRank, void *dat, size_t size) override {
+        if (srcRank < 0 || srcRank >= static_cast<int>(socks.size()) ||
+            socks[srcRank] == InvalidSocket)
+            return false;
+        return recvAll(socks[srcRank], dat, size);
+    }
+
+  private:
+    static constexpr size_t ChunkSz = size_t(1) << 30;
+
+    // Without Nagle's algorithm, as messages are few and large
+    void setUpSocket(int peerRank) {
+        int isNoDelay = 1;
+        setsockopt(socks[peerRank], IPPROTO_TCP, TCP_NODELAY,
+                   reinterpret_cast<const char *>(&isNoDelay), sizeof(isNoDelay));
+    }
+
+    // Returns whether sock has a connection to accept or data to receive before deadline
+    static bool waitReadable(SocketTy sock, std::chrono::steady_clock::time_point deadline) {
+        while (true) {
+            auto remaining = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - std::chrono::steady_clock::now());
+            pollfd fd{};
+            fd.fd = sock;
+            fd.events = POLLIN;
+            auto ret = pollSocket(&fd, static_cast<int>(std::max(remaining.count(), int64_t(0))));
+            if (ret < 0 && isInterrupted())
+                continue;
+            return ret > 0;
+        }
+    }
+
+    // Fails once the peer closes the connection, as recv then returns 0
+    static bool recvAll(SocketTy sock, void *dat, size_t size) {
+        auto dst = reinterpret_cast<char *>(dat);
+        while (size > 0) {
+            auto recved = recv(sock, dst, static_cast<int>(std::min(size, ChunkSz)), 0);
+            if (recved < 0 && isInterrupted())
+                continue;
+            if (recved <= 0)
+                return false;
+            dst += recved;
+            size -= recved;
+        }
+        return true;
+    }
+};
+
+} // namespace SciVis
+
+#endif // !SCIVIS_COMMUNICATOR_H
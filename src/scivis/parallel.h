@@ -0,0 +1,47 @@
+#ifndef SCIVIS_PARALLEL_H
+#define SCIVIS_PARALLEL_H
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+#include <vector>
+
+namespace SciVis {
+
+inline unsigned GetWorkerNum() { return std::max(1u, std::thread::hardware_concurrency()); }
+
+/*
+ * Calls f(i) for i in [begin, end) on all hardware threads.
+ * Indices are handed out one by one, so uneven tasks (e.g. bricks) stay balanced.
+ */
+template <typename FuncTy> void ParallelFor(size_t begin, size_t end, FuncTy f) {
+    if (begin >= end)
+        return;
+
+    auto workerNum = static_cast<size_t>(GetWorkerNum());
+    workerNum = std::min(workerNum, end - begin);
+    if (workerNum == 1) {
+        for (auto i = begin; i < end; ++i)
+            f(i);
+        return;
+    }
+
+    std::atomic<size_t> next = begin;
+    auto work = [&]() {
+        for (auto i = next.fetch_add(1); i < end; i = next.fetch_add(1))
+            f(i);
+    };
+
+    std::vector<std::thread> workers;
+    workers.reserve(workerNum - 1);
+    for (size_t w = 1; w < workerNum; ++w)
+        workers.emplace_back(work);
+    work();
+    for (auto &worker : workers)
+        worker.join();
+}
+
+} // namespace SciVis
+
+#endif // !SCIVIS_PARALLEL_H
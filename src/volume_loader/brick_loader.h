@@ -0,0 +1,169 @@
+#ifndef SCIVIS_VOL_LOADER_BRICK_LOADER_H
+#define SCIVIS_VOL_LOADER_BRICK_LOADER_H
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <format>
+#include <fstream>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <source_location>
+#include <string>
+#include <thread>
+#include <utility>
+
+#include <array>
+#include <vector>
+
+namespace SciVis {
+namespace VolumeLoader {
+
+/*
+ * Streams bricks of brickLen^3 voxels out of a raw volume file on a background thread, so
+ * that volumes larger than memory are read only where they are needed. Each brick comes with
+ * an apron of one voxel on every side, clamped to the edges of the volume, so that bricks can
+ * be filtered on their own. Voxels are converted to float and laid out x-fastest.
+ */
+class BrickLoader {
+  public:
+    struct Brick {
+        int idx;
+        std::vector<float> dat;
+    };
+
+  private:
+    std::array<int, 3> volDim;
+    std::array<int, 3> brickDim;
+    int brickLen;
+    // Reads num voxels from the offset of voxel offs into dst
+    std::function<void(std::ifstream &, size_t, int, float *)> readRow;
+    std::ifstream is;
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<int> requests;
+    std::vector<Brick> loadeds;
+    bool isStopped = false;
+    std::thread worker;
+
+    BrickLoader(std::ifstream &&is, const std::array<int, 3> &volDim, int brickLen)
+        : volDim(volDim), brickLen(brickLen), is(std::move(is)) {
+        for (int a = 0; a < 3; ++a)
+            brickDim[a] = (volDim[a] + brickLen - 1) / brickLen;
+    }
+
+  public:
+    template <typename SrcTy, typename Src2DstFuncTy>
+    static std::unique_ptr<BrickLoader> Open(const std::string &filePath,
+                                             const std::array<int, 3> &volDim, int brickLen,
+                                             Src2DstFuncTy funcSrc2Dst,
+                                             std::string *errMsg = nullptr) {
+        std::ifstream is(filePath, std::ios::binary | std::ios::ate);
+        if (!is.is_open()) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: Cannot open file {}",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), filePath);
+            return nullptr;
+        }
+        auto voxNum = static_cast<size_t>(is.tellg()) / sizeof(SrcTy);
+        if (voxNum < static_cast<size_t>(volDim[0]) * volDim[1] * volDim[2]) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: Volume in file {} is smaller "
+                                      "than dim ({},{},{})",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name(), filePath,
+                                      volDim[0], volDim[1], volDim[2]);
+            return nullptr;
+        }
+
+        std::unique_ptr<BrickLoader> loader(new BrickLoader(std::move(is), volDim, brickLen));
+        loader->readRow = [funcSrc2Dst, src = std::vector<SrcTy>()](
+                              std::ifstream &is, size_t offs, int num, float *dst) mutable {
+            src.resize(num);
+            is.seekg(offs * sizeof(SrcTy));
+            is.read(reinterpret_cast<char *>(src.data()), sizeof(SrcTy) * num);
+            std::transform(src.begin(), src.end(), dst, funcSrc2Dst);
+        };
+        loader->worker = std::thread([loader = loader.get()]() { loader->work(); });
+        return loader;
+    }
+
+    ~BrickLoader() {
+        {
+            std::lock_guard lock(mtx);
+            isStopped = true;
+        }
+        cv.notify_one();
+        worker.join();
+    }
+
+    const std::array<int, 3> &GetVolumeDimension() const { return volDim; }
+    const std::array<int, 3> &GetBrickDimension() const { return brickDim; }
+    int GetBrickLength() const { return brickLen; }
+
+    // Replaces the bricks waiting to be loaded with brickIdxs, loaded in their order
+    void Request(const std::vector<int> &brickIdxs) {
+        {
+            std::lock_guard lock(mtx);
+            requests.assign(brickIdxs.begin(), brickIdxs.end());
+        }
+        cv.notify_one();
+    }
+
+    std::vector<Brick> TakeLoaded() {
+        std::lock_guard lock(mtx);
+        return std::exchange(loadeds, {});
+    }
+
+  private:
+    void work() {
+        while (true) {
+            int idx;
+            {
+                std::unique_lock lock(mtx);
+                cv.wait(lock, [&]() { return isStopped || !requests.empty(); });
+                if (isStopped)
+                    return;
+                idx = requests.front();
+                requests.pop_front();
+            }
+
+            auto brick = load(idx);
+
+            std::lock_guard lock(mtx);
+            loadeds.emplace_back(std::move(brick));
+        }
+    }
+
+    Brick load(int idx) {
+        std::array<int, 3> start{idx % brickDim[0] * brickLen,
+                                 idx / brickDim[0] % brickDim[1] * brickLen,
+                                 idx / (brickDim[0] * brickDim[1]) * brickLen};
+        auto apronLen = brickLen + 2;
+        Brick brick{idx, std::vector<float>(static_cast<size_t>(apronLen) * apronLen * apronLen)};
+
+        // Rows are read whole within the volume, and their ends are clamped to its edges
+        auto x0 = std::max(start[0] - 1, 0);
+        auto x1 = std::min(start[0] + brickLen, volDim[0] - 1);
+        std::vector<float> row(x1 - x0 + 1);
+        auto dst = brick.dat.data();
+        for (int z = start[2] - 1; z <= start[2] + brickLen; ++z)
+            for (int y = start[1] - 1; y <= start[1] + brickLen; ++y) {
+                auto cz = std::clamp(z, 0, volDim[2] - 1);
+                auto cy = std::clamp(y, 0, volDim[1] - 1);
+                readRow(is, (static_cast<size_t>(cz) * volDim[1] + cy) * volDim[0] + x0,
+                        static_cast<int>(row.size()), row.data());
+                for (int x = start[0] - 1; x <= start[0] + brickLen; ++x)
+                    *dst++ = row[std::clamp(x, 0, volDim[0] - 1) - x0];
+            }
+        return brick;
+    }
+};
+
+} // namespace VolumeLoader
+} // namespace SciVis
+
+#endif // !SCIVIS_VOL_LOADER_BRICK_LOADER_H
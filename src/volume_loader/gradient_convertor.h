@@ -0,0 +1,153 @@
+#ifndef SCIVIS_VOL_LOADER_GRADIENT_CONVERTOR_H
+#define SCIVIS_VOL_LOADER_GRADIENT_CONVERTOR_H
+
+#include <algorithm>
+#include <cmath>
+#include <format>
+#include <source_location>
+#include <string>
+
+#include <array>
+#include <vector>
+
+#include <osg/Texture3D>
+
+#include <scivis/parallel.h>
+
+namespace SciVis {
+namespace VolumeLoader {
+
+/*
+ * Precomputes the gradients of a volume by central differences, one-sided on its faces, so
+ * that shading costs a single fetch per sample. Gradients are in voxels of the grid, packed to
+ * RGBA8 with their directions in RGB, mapped from [-1, 1] to [0, 1], and their magnitudes over
+ * the largest one of the volume in A.
+ */
+class GradientConvertor {
+  public:
+    // volDat is x-fastest of volDim. Returns the packed gradients in the same layout
+    static std::vector<std::array<uint8_t, 4>> Convert(const float *volDat,
+                                                       const std::array<int, 3> &volDim) {
+        auto sliceVoxNum = static_cast<size_t>(volDim[0]) * volDim[1];
+        std::vector<std::array<uint8_t, 4>> grads(sliceVoxNum * volDim[2]);
+
+        // Magnitudes are normalized by the largest one, found in a first pass
+        std::vector<float> sliceMaxMags(volDim[2], 0.f);
+        ParallelFor(0, volDim[2], [&](size_t z) {
+            std::array<std::vector<float>, 3> rows;
+            for (auto &row : rows)
+                row.resize(volDim[0]);
+            auto maxSqrMag = 0.f;
+            for (int y = 0; y < volDim[1]; ++y) {
+                cmptRow(volDat, volDim, y, static_cast<int>(z), rows);
+                for (int x = 0; x < volDim[0]; ++x)
+                    maxSqrMag = std::max(maxSqrMag, rows[0][x] * rows[0][x] +
+                                                        rows[1][x] * rows[1][x] +
+                                                        rows[2][x] * rows[2][x]);
+            }
+            sliceMaxMags[z] = std::sqrt(maxSqrMag);
+        });
+        auto maxMag = *std::max_element(sliceMaxMags.begin(), sliceMaxMags.end());
+        auto invMaxMag = maxMag > 0.f ? 1.f / maxMag : 0.f;
+
+        ParallelFor(0, volDim[2], [&](size_t z) {
+            std::array<std::vector<float>, 3> rows;
+            for (auto &row : rows)
+                row.resize(volDim[0]);
+            for (int y = 0; y < volDim[1]; ++y) {
+                cmptRow(volDat, volDim, y, static_cast<int>(z), rows);
+                auto dst = grads.data() + z * sliceVoxNum + static_cast<size_t>(y) * volDim[0];
+                for (int x = 0; x < volDim[0]; ++x) {
+                    osg::Vec3 g(rows[0][x], rows[1][x], rows[2][x]);
+                    auto mag = g.length();
+                    if (mag > 0.f)
+                        g /= mag;
+                    for (int a = 0; a < 3; ++a)
+                        dst[x][a] = static_cast<uint8_t>(std::lround((g[a] * .5f + .5f) * 255.f));
+                    dst[x][3] = static_cast<uint8_t>(std::lround(mag * invMaxMag * 255.f));
+                }
+            }
+        });
+
+        return grads;
+    }
+
+    /*
+     * Packs the gradients of volTex into a texture of the same dimension. volTex should be of a
+     * GL_FLOAT image, as from RawConvertor.
+     */
+    static osg::ref_ptr<osg::Texture3D>
+    ConvertFromVolumeTexture(osg::ref_ptr<osg::Texture3D> volTex, std::string *errMsg = nullptr) {
+        auto volImg = volTex.valid() ? volTex->getImage() : nullptr;
+        if (!volImg || volImg->s() <= 0 || volImg->t() <= 0 || volImg->r() <= 0 ||
+            volImg->getPixelFormat() != GL_RED || volImg->getDataType() != GL_FLOAT) {
+            if (errMsg)
+                *errMsg = std::format("File:{} => Func:{} => Err: Volume is not of GL_RED and "
+                                      "GL_FLOAT",
+                                      std::source_location::current().file_name(),
+                                      std::source_location::current().function_name());
+            return nullptr;
+        }
+
+        std::array volDim{volImg->s(), volImg->t(), volImg->r()};
+        auto grads = Convert(reinterpret_cast<const float *>(volImg->data()), volDim);
+
+        osg::ref_ptr img = new osg::Image;
+        img->allocateImage(volDim[0], volDim[1], volDim[2], GL_RGBA, GL_UNSIGNED_BYTE);
+        img->setInternalTextureFormat(GL_RGBA);
+        std::copy(grads.begin(), grads.end(),
+                  reinterpret_cast<std::array<uint8_t, 4> *>(img->data()));
+
+        osg::ref_ptr tex = new osg::Texture3D;
+        tex->setFilter(osg::Texture::MAG_FILTER, osg::Texture::FilterMode::LINEAR);
+        tex->setFilter(osg::Texture::MIN_FILTER, osg::Texture::FilterMode::NEAREST);
+        tex->setWrap(osg::Texture::WRAP_S, osg::Texture::WrapMode::CLAMP);
+        tex->setWrap(osg::Texture::WRAP_T, osg::Texture::WrapMode::CLAMP);
+        tex->setWrap(osg::Texture::WRAP_R, osg::Texture::WrapMode::CLAMP);
+        tex->setInternalFormatMode(osg::Texture::InternalFormatMode::USE_IMAGE_DATA_FORMAT);
+        tex->setImage(img);
+
+        return tex;
+    }
+
+  private:
+    /*
+     * Gradients of the row at (y, z) into rows[0..2]. Rows around are taken whole, and the loop
+     * over the inner voxels has no branches, so that it vectorizes.
+     */
+    static void cmptRow(const float *volDat, const std::array<int, 3> &volDim, int y, int z,
+                        std::array<std::vector<float>, 3> &rows) {
+        auto w = volDim[0];
+        auto rowAt = [&](int y, int z) {
+            return volDat + (static_cast<size_t>(z) * volDim[1] + y) * w;
+        };
+        auto y0 = std::max(y - 1, 0), y1 = std::min(y + 1, volDim[1] - 1);
+        auto z0 = std::max(z - 1, 0), z1 = std::min(z + 1, volDim[2] - 1);
+        auto invDy = y1 == y0 ? 0.f : 1.f / (y1 - y0);
+        auto invDz = z1 == z0 ? 0.f : 1.f / (z1 - z0);
+
+        const float *__restrict row = rowAt(y, z);
+        const float *__restrict rowY0 = rowAt(y0, z);
+        const float *__restrict rowY1 = rowAt(y1, z);
+        const float *__restrict rowZ0 = rowAt(y, z0);
+        const float *__restrict rowZ1 = rowAt(y, z1);
+        float *__restrict gx = rows[0].data();
+        float *__restrict gy = rows[1].data();
+        float *__restrict gz = rows[2].data();
+
+        for (int x = 1; x < w - 1; ++x)
+            gx[x] = .5f * (row[x + 1] - row[x - 1]);
+        gx[0] = w == 1 ? 0.f : row[1] - row[0];
+        if (w > 1)
+            gx[w - 1] = row[w - 1] - row[w - 2];
+        for (int x = 0; x < w; ++x) {
+            gy[x] = invDy * (rowY1[x] - rowY0[x]);
+            gz[x] = invDz * (rowZ1[x] - rowZ0[x]);
+        }
+    }
+};
+
+} // namespace VolumeLoader
+} // namespace SciVis
+
+#endif // !SCIVIS_VOL_LOADER_GRADIENT_CONVERTOR_H
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <iostream>
+#include <source_location>
+
+#include <array>
+#include <vector>
+
+#include <scalar_viser/brick_pager.h>
+
+using namespace SciVis::ScalarViser;
+
+static int failNum = 0;
+
+static void check(bool cond, const char *what,
+                  std::source_location loc = std::source_location::current()) {
+    if (cond)
+        return;
+    ++failNum;
+    std::cerr << "Line:" << loc.line() << " => Failed: " << what << std::endl;
+}
+
+// Requests bricks with their priorities in a new frame
+static std::vector<int> requestFrame(BrickPager &pager,
+                                     const std::vector<std::pair<int, float>> &reqs,
+                                     size_t maxLoadNum) {
+    pager.BeginFrame();
+    for (auto [brick, priority] : reqs)
+        pager.Request(brick, priority);
+    return pager.EndFrame(maxLoadNum);
+}
+
+static void testPriorityOrder() {
+    BrickPager pager(8, 4);
+    auto missings =
+        requestFrame(pager, {{0, 1.f}, {1, 5.f}, {2, 3.f}, {3, 2.f}, {4, 4.f}, {5, .5f}}, 8);
+    check(missings == std::vector<int>{1, 4, 2, 3}, "Missing bricks are the most wanted first");
+}
+
+static void testMaxLoadNum() {
+    BrickPager pager(8, 4);
+    auto missings = requestFrame(pager, {{0, 1.f}, {1, 5.f}, {2, 3.f}, {3, 2.f}}, 2);
+    check(missings == std::vector<int>{1, 2}, "Missing bricks are capped by maxLoadNum");
+
+    // Resident bricks are not returned, so that the cap goes to the missing ones
+    for (auto brick : missings)
+        pager.Commit(brick);
+    missings = requestFrame(pager, {{0, 1.f}, {1, 5.f}, {2, 3.f}, {3, 2.f}}, 2);
+    check(missings == std::vector<int>{3, 0}, "Resident bricks do not count against the cap");
+}
+
+static void testLRUEviction() {
+    BrickPager pager(8, 2);
+    requestFrame(pager, {{0, 1.f}, {1, 1.f}}, 8);
+    auto slot0 = pager.Commit(0);
+    auto slot1 = pager.Commit(1);
+    check(slot0 != BrickPager::NonResident && slot1 != BrickPager::NonResident && slot0 != slot1,
+          "Bricks take free slots");
+
+    // Brick 0 is wanted more recently than brick 1, which is evicted first
+    requestFrame(pager, {{0, 1.f}}, 8);
+    requestFrame(pager, {{2, 1.f}}, 8);
+    check(pager.Commit(2) == slot1, "The least recently wanted slot is taken");
+    check(pager.GetSlot(1) == BrickPager::NonResident, "The evicted brick is not resident");
+    check(pager.GetSlot(0) == slot0, "The recently wanted brick stays resident");
+
+    requestFrame(pager, {{3, 1.f}}, 8);
+    check(pager.Commit(3) == slot0, "Slots are taken in the order they were last wanted");
+    check(pager.GetSlot(0) == BrickPager::NonResident, "The evicted brick is not resident");
+}
+
+static void testCommitWhenAllWanted() {
+    BrickPager pager(8, 2);
+    requestFrame(pager, {{0, 1.f}, {1, 1.f}}, 8);
+    pager.Commit(0);
+    pager.Commit(1);
+
+    auto missings = requestFrame(pager, {{0, 3.f}, {1, 2.f}, {2, 1.f}}, 8);
+    check(missings.empty(), "Bricks less wanted than slotNum others are not loaded");
+    check(pager.Commit(2) == BrickPager::NonResident,
+          "No slot is taken while every one is wanted in the frame");
+    check(pager.GetSlot(0) != BrickPager::NonResident &&
+              pager.GetSlot(1) != BrickPager::NonResident,
+          "Bricks wanted in the frame stay resident");
+}
+
+static void testSlotsChanged() {
+    BrickPager pager(8, 2);
+    check(pager.TakeSlotsChanged(), "Slots are changed at first");
+    check(!pager.TakeSlotsChanged(), "Taking the change clears it");
+
+    requestFrame(pager, {{0, 1.f}}, 8);
+    check(!pager.TakeSlotsChanged(), "Requests do not change slots");
+    pager.Commit(0);
+    check(pager.TakeSlotsChanged(), "Committing a brick changes slots");
+    pager.Commit(0);
+    check(!pager.TakeSlotsChanged(), "Committing a resident brick does not change slots");
+
+    requestFrame(pager, {{0, 2.f}, {1, 1.f}}, 8);
+    pager.Commit(1);
+    pager.TakeSlotsChanged();
+    requestFrame(pager, {{0, 1.f}, {1, 1.f}}, 8);
+    check(pager.Commit(2) == BrickPager::NonResident && !pager.TakeSlotsChanged(),
+          "A dropped brick does not change slots");
+}
+
+static void testSlotDimension() {
+    // 32 voxel bricks with aprons in 64 MB, as the atlas is of one byte voxels
+    auto apronLen = 34;
+    auto maxLen = std::min(255, 2048 / apronLen);
+    auto slotNum = static_cast<int>((size_t(64) << 20) / (apronLen * apronLen * apronLen));
+    auto slotDim = BrickPager::CmptSlotDimension(slotNum, maxLen);
+    auto num = slotDim[0] * slotDim[1] * slotDim[2];
+    check(num <= slotNum, "Slots are within the budget");
+    check(num * 10 >= slotNum * 9, "Slots fill most of the budget");
+    for (int a = 0; a < 3; ++a)
+        check(slotDim[a] <= maxLen && slotDim[a] * apronLen <= 2048,
+              "The atlas is within the maximum length on each axis");
+    check(slotDim[0] <= 2 * slotDim[2], "Slots are laid out near a cube");
+
+    slotDim = BrickPager::CmptSlotDimension(512, 255);
+    check(slotDim == std::array{8, 8, 8}, "Slots of a cubic number fill a cube");
+    slotDim = BrickPager::CmptSlotDimension(256, 255);
+    check(slotDim[0] * slotDim[1] * slotDim[2] <= 256 && slotDim[0] <= 8,
+          "Slots are not rounded up to a box beyond the budget");
+
+    slotDim = BrickPager::CmptSlotDimension(1000000, 60);
+    check(slotDim == std::array{60, 60, 60}, "Slots are capped on each axis");
+
+    slotDim = BrickPager::CmptSlotDimension(5, 255);
+    check(slotDim[0] * slotDim[1] * slotDim[2] == 5, "Slots of a prime number fill a row");
+    slotDim = BrickPager::CmptSlotDimension(0, 255);
+    check(slotDim == std::array{1, 1, 1}, "There is a slot at least");
+}
+
+int main() {
+    testPriorityOrder();
+    testMaxLoadNum();
+    testLRUEviction();
+    testCommitWhenAllWanted();
+    testSlotsChanged();
+    testSlotDimension();
+
+    if (failNum != 0)
+        std::cerr << failNum << " checks failed" << std::endl;
+    return failNum == 0 ? 0 : 1;
+}
@@ -0,0 +1,147 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numbers>
+#include <source_location>
+
+#include <vector>
+
+#include <scalar_viser/direct_volume_cpu_renderer.h>
+
+using namespace SciVis::ScalarViser;
+
+static int failNum = 0;
+
+static void check(bool cond, const char *what,
+                  std::source_location loc = std::source_location::current()) {
+    if (cond)
+        return;
+    ++failNum;
+    std::cerr << "Line:" << loc.line() << " => Failed: " << what << std::endl;
+}
+
+// A shell over the whole globe, whose chords are known, of a constant volume
+static GeoExtent createGlobeExtent() {
+    GeoExtent ext;
+    ext.minLongtitute = -static_cast<float>(std::numbers::pi);
+    ext.maxLongtitute = static_cast<float>(std::numbers::pi);
+    ext.minLatitute = -static_cast<float>(std::numbers::pi) * .5f;
+    ext.maxLatitute = static_cast<float>(std::numbers::pi) * .5f;
+    return ext;
+}
+
+/*
+ * Renders the shell from outside, and compares each pixel against the opacity of its chord from
+ * where it enters the outer sphere to where it leaves it or enters the inner one. Marching
+ * overshoots the chord by less than a step, which bounds the error.
+ */
+static void testShellChords() {
+    constexpr int ImgSz = 64;
+    constexpr float Alpha = .2f;
+    const osg::Vec4 color(1.f, .5f, .25f, Alpha);
+
+    auto ext = createGlobeExtent();
+    auto thickness = ext.maxHeight - ext.minHeight;
+
+    DirectVolumeCPURenderer renderer;
+    renderer.SetVolume(std::vector<float>(4 * 4 * 4, .5f), {4, 4, 4}, {color, color});
+    renderer.SetGeoExtent(ext);
+    renderer.SetReferenceStep(thickness);
+    renderer.SetMinStep(thickness / 256.f);
+    renderer.SetStepInPixels(.25f);
+
+    auto eyeDist = 3. * ext.maxHeight;
+    osg::Vec3d eyePos(eyeDist * .6, eyeDist * .48, eyeDist * .64);
+    auto viewMat = osg::Matrixd::lookAt(eyePos, osg::Vec3d(0., 0., 0.), osg::Vec3d(0., 0., 1.));
+    auto projMat = osg::Matrixd::perspective(45., 1., eyeDist * .1, eyeDist * 2.);
+    auto img = renderer.Render(viewMat, projMat, ImgSz, ImgSz);
+    check(img.valid() && img->s() == ImgSz && img->t() == ImgSz, "The image is of the size");
+    if (!img.valid())
+        return;
+    auto pxs = reinterpret_cast<const osg::Vec4 *>(img->data());
+
+    // Steps are the longest at the far side of the shell
+    auto pixelSpanPerDist = 2. / (projMat(1, 1) * ImgSz);
+    auto maxStep =
+        std::max(thickness / 256., .25 * pixelSpanPerDist * (eyeDist + ext.maxHeight));
+    auto tolerance = 1e-3 + 1. - std::pow(1. - Alpha, maxStep / thickness);
+
+    auto ndc2World = osg::Matrixd::inverse(viewMat * projMat);
+    auto hitNum = 0;
+    auto throughNum = 0;
+    auto maxErr = 0.;
+    auto maxColorErr = 0.f;
+    for (int y = 0; y < ImgSz; ++y)
+        for (int x = 0; x < ImgSz; ++x) {
+            osg::Vec3d ndc(2. * (x + .5) / ImgSz - 1., 2. * (y + .5) / ImgSz - 1., 1.);
+            auto dir = ndc2World.preMult(ndc) - eyePos;
+            dir.normalize();
+
+            auto b = eyePos * dir;
+            auto m2 = eyePos.length2() - b * b;
+            auto outerR2 = double(ext.maxHeight) * ext.maxHeight;
+            auto innerR2 = double(ext.minHeight) * ext.minHeight;
+            auto chord = 0.;
+            if (m2 < outerR2) {
+                auto tEntry = -b - std::sqrt(outerR2 - m2);
+                auto tExit = m2 < innerR2 ? -b - std::sqrt(innerR2 - m2)
+                                          : -b + std::sqrt(outerR2 - m2);
+                chord = tExit - tEntry;
+                throughNum += m2 < innerR2 ? 1 : 0;
+            }
+
+            auto &px = pxs[y * ImgSz + x];
+            if (chord == 0.) {
+                maxErr = std::max(maxErr, static_cast<double>(px.a()));
+                continue;
+            }
+            ++hitNum;
+            auto expected = 1. - std::pow(1. - Alpha, chord / thickness);
+            maxErr = std::max(maxErr, std::abs(px.a() - expected));
+            for (int c = 0; c < 3; ++c)
+                maxColorErr = std::max(maxColorErr, std::abs(px[c] - px.a() * color[c]));
+        }
+    check(maxErr <= tolerance, "Opacities are of the chords, and 0 off the shell");
+    check(maxColorErr <= 1e-5f, "Colors are premultiplied by the opacities");
+    check(hitNum > ImgSz * ImgSz / 4 && throughNum > 0 && throughNum < hitNum,
+          "The view covers the shell, both over and through the inner sphere");
+}
+
+// Ray offsets and low alpha step scales move samples, but not what a constant volume looks like
+static void testStepPolicy() {
+    constexpr int ImgSz = 32;
+    const osg::Vec4 color(.5f, .5f, .5f, .005f);
+
+    auto ext = createGlobeExtent();
+    DirectVolumeCPURenderer renderer;
+    renderer.SetVolume(std::vector<float>(4 * 4 * 4, .5f), {4, 4, 4}, {color, color});
+    renderer.SetGeoExtent(ext);
+    renderer.SetReferenceStep((ext.maxHeight - ext.minHeight) * .1f);
+    renderer.SetStepInPixels(.25f);
+
+    osg::Vec3d eyePos(3. * ext.maxHeight, 0., 0.);
+    auto viewMat = osg::Matrixd::lookAt(eyePos, osg::Vec3d(0., 0., 0.), osg::Vec3d(0., 0., 1.));
+    auto projMat = osg::Matrixd::perspective(45., 1., ext.maxHeight * .3, ext.maxHeight * 6.);
+
+    renderer.SetLowAlphaStepScale(1.f);
+    auto ref = renderer.Render(viewMat, projMat, ImgSz, ImgSz);
+    renderer.SetLowAlphaStepScale(2.f);
+    renderer.SetRayOffset(.5f);
+    auto img = renderer.Render(viewMat, projMat, ImgSz, ImgSz);
+
+    auto refPxs = reinterpret_cast<const osg::Vec4 *>(ref->data());
+    auto pxs = reinterpret_cast<const osg::Vec4 *>(img->data());
+    auto maxErr = 0.f;
+    for (int i = 0; i < ImgSz * ImgSz; ++i)
+        maxErr = std::max(maxErr, std::abs(pxs[i].a() - refPxs[i].a()));
+    check(maxErr < .02f, "Opacity correction keeps the opacities whatever the steps");
+}
+
+int main() {
+    testShellChords();
+    testStepPolicy();
+
+    if (failNum != 0)
+        std::cerr << failNum << " checks failed" << std::endl;
+    return failNum == 0 ? 0 : 1;
+}
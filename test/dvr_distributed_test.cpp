@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <source_location>
+#include <thread>
+
+#include <vector>
+
+#include <scalar_viser/direct_volume_distributed.h>
+
+using namespace SciVis;
+using namespace SciVis::ScalarViser;
+
+static int failNum = 0;
+
+static void check(bool cond, const char *what,
+                  std::source_location loc = std::source_location::current()) {
+    if (cond)
+        return;
+    ++failNum;
+    std::cerr << "Line:" << loc.line() << " => Failed: " << what << std::endl;
+}
+
+// Runs f(rank, comm) on each rank of a SharedMemoryCommunicator group in its own thread
+template <typename FuncTy> static void runRanks(int rankNum, FuncTy f) {
+    auto comms = SharedMemoryCommunicator::CreateGroup(rankNum);
+    std::vector<std::thread> threads;
+    for (int r = 0; r < rankNum; ++r)
+        threads.emplace_back([&, r]() { f(r, *comms[r]); });
+    for (auto &thread : threads)
+        thread.join();
+}
+
+// Composites random images of ranks by binary swap, against compositing them in order
+static void testBinarySwap(int rankNum, bool isLowerFront) {
+    constexpr size_t PxNum = 1001;
+
+    std::mt19937 rng(rankNum);
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    std::vector<std::vector<float>> imgs(rankNum, std::vector<float>(PxNum * 4));
+    for (auto &img : imgs)
+        for (size_t i = 0; i < PxNum; ++i) {
+            auto a = dist(rng) * .6f;
+            for (int c = 0; c < 3; ++c)
+                img[i * 4 + c] = dist(rng) * a;
+            img[i * 4 + 3] = a;
+        }
+
+    std::vector<float> expected(PxNum * 4, 0.f);
+    for (int k = 0; k < rankNum; ++k) {
+        auto &img = imgs[isLowerFront ? k : rankNum - 1 - k];
+        for (size_t i = 0; i < PxNum; ++i) {
+            auto trans = 1.f - expected[i * 4 + 3];
+            for (int c = 0; c < 4; ++c)
+                expected[i * 4 + c] += trans * img[i * 4 + c];
+        }
+    }
+
+    auto isOk = true;
+    runRanks(rankNum, [&](int rank, Communicator &comm) {
+        auto rgba = imgs[rank].data();
+        if (!BinarySwapComposite(comm, rgba, PxNum, [&](int) { return isLowerFront; }) ||
+            !GatherBinarySwap(comm, rgba, PxNum))
+            isOk = false;
+    });
+    check(isOk, "No message of binary swap is lost");
+
+    auto maxErr = 0.f;
+    for (size_t i = 0; i < PxNum * 4; ++i)
+        maxErr = std::max(maxErr, std::abs(imgs[0][i] - expected[i]));
+    check(maxErr < 1e-5f, "Binary swap composites in the order of ranks");
+}
+
+/*
+ * Renders a random volume split among ranks, from either side of it, against one renderer of
+ * the whole. Steps are not lengthened after transparent samples in either, and opacities stay
+ * below where rays are terminated, so that samples are the same.
+ */
+static void testDistributedRender(int rankNum) {
+    constexpr int ImgSz = 48;
+    const std::array VolDim{32, 16, 8};
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> dist(0.f, 1.f);
+    osg::ref_ptr volImg = new osg::Image;
+    volImg->allocateImage(VolDim[0], VolDim[1], VolDim[2], GL_RED, GL_FLOAT);
+    auto volPtr = reinterpret_cast<float *>(volImg->data());
+    std::generate(volPtr, volPtr + VolDim[0] * VolDim[1] * VolDim[2], [&]() { return dist(rng); });
+    osg::ref_ptr volTex = new osg::Texture3D;
+    volTex->setImage(volImg);
+
+    osg::ref_ptr tfImg = new osg::Image;
+    tfImg->allocateImage(16, 1, 1, GL_RGBA, GL_FLOAT);
+    auto tfPtr = reinterpret_cast<osg::Vec4 *>(tfImg->data());
+    for (int i = 0; i < 16; ++i) {
+        auto s = i / 15.f;
+        tfPtr[i] = osg::Vec4(s, .5f, 1.f - s, s * .2f);
+    }
+    osg::ref_ptr tfTex = new osg::Texture1D;
+    tfTex->setImage(tfImg);
+
+    GeoExtent geoExt;
+    auto refDt = geoExt.maxHeight - geoExt.minHeight;
+    DirectVolumeCPURenderer whole;
+    whole.SetVolume(volTex, tfTex);
+    whole.SetGeoExtent(geoExt);
+    whole.SetReferenceStep(refDt);
+    whole.SetLowAlphaStepScale(1.f);
+
+    for (auto eyeLon : {-.6, .6}) {
+        auto eyeDist = 2.5 * geoExt.maxHeight;
+        osg::Vec3d eyePos(eyeDist * std::cos(eyeLon), eyeDist * std::sin(eyeLon), 0.);
+        auto viewMat = osg::Matrixd::lookAt(eyePos, osg::Vec3d(geoExt.GridToECEF({.5f, .5f, .5f})),
+                                            osg::Vec3d(0., 0., 1.));
+        auto projMat = osg::Matrixd::perspective(30., 1., eyeDist * .1, eyeDist * 2.);
+        auto expected = whole.Render(viewMat, projMat, ImgSz, ImgSz);
+
+        osg::ref_ptr<osg::Image> img;
+        auto isOk = true;
+        runRanks(rankNum, [&](int rank, Communicator &comm) {
+            DirectVolumeDistributedRenderer renderer(comm);
+            if (!renderer.SetVolume(volTex, tfTex)) {
+                isOk = false;
+                return;
+            }
+            renderer.SetReferenceStep(refDt);
+            auto rankImg = renderer.Render(viewMat, projMat, ImgSz, ImgSz);
+            if (rank == 0)
+                img = rankImg;
+        });
+        check(isOk && img.valid(), "Rank 0 gets the image of the whole volume");
+        if (!img.valid())
+            continue;
+
+        auto pxs = reinterpret_cast<const float *>(img->data());
+        auto expectedPxs = reinterpret_cast<const float *>(expected->data());
+        auto maxErr = 0.f;
+        auto maxAlpha = 0.f;
+        for (int i = 0; i < ImgSz * ImgSz * 4; ++i) {
+            maxErr = std::max(maxErr, std::abs(pxs[i] - expectedPxs[i]));
+            if (i % 4 == 3)
+                maxAlpha = std::max(maxAlpha, expectedPxs[i]);
+        }
+        check(maxAlpha > .1f && maxAlpha < .95f, "The volume is seen but no ray is terminated");
+        check(maxErr < 1e-4f, "Ranks render what one renderer of the whole volume does");
+    }
+}
+
+int main() {
+    for (int rankNum : {2, 4}) {
+        testBinarySwap(rankNum, true);
+        testBinarySwap(rankNum, false);
+        testDistributedRender(rankNum);
+    }
+
+    if (failNum != 0)
+        std::cerr << failNum << " checks failed" << std::endl;
+    return failNum == 0 ? 0 : 1;
+}